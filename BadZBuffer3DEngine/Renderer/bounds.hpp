@@ -0,0 +1,88 @@
+#pragma once
+#include "../astd.hpp"
+#include "math.hpp"
+
+// Local space bounds of a set of points, a box and a sphere around the box's center
+struct Bounds3 {
+	Point3 min, max;
+	Point3 center;
+	double radius = 0;
+	bool empty = true; // No points, nothing can be visible
+};
+
+// Plane as normal . point + offset, the positive side is inside
+struct Plane3 {
+	Point3 normal;
+	double offset = 0;
+};
+
+// Which side of a set of planes a bounding volume is on
+enum class PlaneSide {
+	Outside, // Entirely on the negative side of at least one plane
+	Inside, // Entirely on the positive side of every plane
+	Crossing
+};
+
+inline Bounds3 computeBounds(const Point3* points, size_t count) {
+	Bounds3 ret;
+	if (count == 0)
+		return ret;
+
+	ret.empty = false;
+	ret.min = ret.max = points[0];
+	for (size_t p = 1; p < count; p++) {
+		ret.min = Point3{ std::min(ret.min.x, points[p].x), std::min(ret.min.y, points[p].y), std::min(ret.min.z, points[p].z) };
+		ret.max = Point3{ std::max(ret.max.x, points[p].x), std::max(ret.max.y, points[p].y), std::max(ret.max.z, points[p].z) };
+	}
+
+	// Centering on the box is looser than the minimal sphere but takes a single pass over the points
+	ret.center = Point3{ (ret.min.x + ret.max.x) / 2, (ret.min.y + ret.max.y) / 2, (ret.min.z + ret.max.z) / 2 };
+	double radius_squared = 0;
+	for (size_t p = 0; p < count; p++) {
+		Point3 offset = Point3{ points[p].x - ret.center.x, points[p].y - ret.center.y, points[p].z - ret.center.z };
+		radius_squared = std::max(radius_squared, dot(offset, offset));
+	}
+	ret.radius = std::sqrt(radius_squared);
+	return ret;
+}
+
+// Moves a plane given in the space transform maps into, back into the space transform maps from
+inline Plane3 planeToLocal(const Transform3& transform, Plane3 plane) {
+	const Point3& n = plane.normal;
+	Plane3 ret;
+	ret.normal = Point3{ n.x * transform.m[0][0] + n.y * transform.m[1][0] + n.z * transform.m[2][0],
+		n.x * transform.m[0][1] + n.y * transform.m[1][1] + n.z * transform.m[2][1],
+		n.x * transform.m[0][2] + n.y * transform.m[1][2] + n.z * transform.m[2][2] };
+	ret.offset = plane.offset + n.x * transform.m[0][3] + n.y * transform.m[1][3] + n.z * transform.m[2][3];
+	return ret;
+}
+
+// Tests the bounds against planes that are in the same space, the sphere settles most cases and the box the rest
+inline PlaneSide testBounds(const Bounds3& bounds, const Plane3* planes, size_t count) {
+	if (bounds.empty)
+		return PlaneSide::Outside;
+
+	PlaneSide ret = PlaneSide::Inside;
+	for (size_t p = 0; p < count; p++) {
+		const Plane3& plane = planes[p];
+		double length = std::sqrt(dot(plane.normal, plane.normal));
+		double distance = dot(plane.normal, bounds.center) + plane.offset;
+		if (distance < -bounds.radius * length)
+			return PlaneSide::Outside;
+		if (distance >= bounds.radius * length)
+			continue;
+
+		// The box corners farthest along and against the normal
+		Point3 farthest = Point3{ plane.normal.x >= 0 ? bounds.max.x : bounds.min.x,
+			plane.normal.y >= 0 ? bounds.max.y : bounds.min.y,
+			plane.normal.z >= 0 ? bounds.max.z : bounds.min.z };
+		Point3 nearest = Point3{ plane.normal.x >= 0 ? bounds.min.x : bounds.max.x,
+			plane.normal.y >= 0 ? bounds.min.y : bounds.max.y,
+			plane.normal.z >= 0 ? bounds.min.z : bounds.max.z };
+		if (dot(plane.normal, farthest) + plane.offset < 0)
+			return PlaneSide::Outside;
+		if (dot(plane.normal, nearest) + plane.offset < 0)
+			ret = PlaneSide::Crossing;
+	}
+	return ret;
+}
@@ -0,0 +1,480 @@
+#include "cluster_stream.hpp"
+#include <cstring>
+
+// Triangles whose Morton keys are computed by one task
+static const size_t KEY_BLOCK_SIZE = 1 << 16;
+// Bits of each axis in a Morton key
+static const U32 MORTON_BITS = 21;
+
+// Spreads the low 21 bits of the value so two zero bits follow each of them
+static U64 spreadBits(U64 value) {
+	value &= 0x1FFFFF;
+	value = (value | value << 32) & 0x1F00000000FFFFull;
+	value = (value | value << 16) & 0x1F0000FF0000FFull;
+	value = (value | value << 8) & 0x100F00F00F00F00Full;
+	value = (value | value << 4) & 0x10C30C30C30C30C3ull;
+	value = (value | value << 2) & 0x1249249249249249ull;
+	return value;
+}
+
+static ClusterFileBounds toFileBounds(const Bounds3& bounds) {
+	ClusterFileBounds ret;
+	ret.min = bounds.min;
+	ret.max = bounds.max;
+	ret.center = bounds.center;
+	ret.radius = bounds.radius;
+	ret.empty = bounds.empty;
+	return ret;
+}
+
+static Bounds3 fromFileBounds(const ClusterFileBounds& bounds) {
+	Bounds3 ret;
+	ret.min = bounds.min;
+	ret.max = bounds.max;
+	ret.center = bounds.center;
+	ret.radius = bounds.radius;
+	ret.empty = bounds.empty != 0;
+	return ret;
+}
+
+static U64 alignOffset(U64 offset) {
+	return (offset + 63) & ~(U64)63;
+}
+
+bool writeClusterFile(const Point3* vertices, size_t vertex_count, const IndexedTri* tris, size_t tri_count,
+	const fs::path& path, U32 cluster_tris) {
+	if (cluster_tris == 0 || tri_count > 0xFFFFFFFF)
+		return false;
+	for (size_t t = 0; t < tri_count; t++)
+		if (tris[t].a >= vertex_count || tris[t].b >= vertex_count || tris[t].c >= vertex_count)
+			return false;
+
+	// Key of every triangle's center on a Morton curve through the bounds, quantized to 21 bits an axis
+	ClusterFileHeader header;
+	Bounds3 bounds = computeBounds(vertices, vertex_count);
+	header.bounds = toFileBounds(bounds);
+	double max_key = (double)((1 << MORTON_BITS) - 1);
+	Point3 scale = Point3{ bounds.max.x > bounds.min.x ? max_key / (bounds.max.x - bounds.min.x) : 0,
+		bounds.max.y > bounds.min.y ? max_key / (bounds.max.y - bounds.min.y) : 0,
+		bounds.max.z > bounds.min.z ? max_key / (bounds.max.z - bounds.min.z) : 0 };
+	std::vector<std::pair<U64, U32>> keys(tri_count);
+	astd::ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+	pool.parallelFor((tri_count + KEY_BLOCK_SIZE - 1) / KEY_BLOCK_SIZE, [&](U64 block) {
+		size_t end = std::min(tri_count, (size_t)(block + 1) * KEY_BLOCK_SIZE);
+		for (size_t t = block * KEY_BLOCK_SIZE; t < end; t++) {
+			const Point3& a = vertices[tris[t].a];
+			const Point3& b = vertices[tris[t].b];
+			const Point3& c = vertices[tris[t].c];
+			U64 x = (U64)(((a.x + b.x + c.x) / 3 - bounds.min.x) * scale.x);
+			U64 y = (U64)(((a.y + b.y + c.y) / 3 - bounds.min.y) * scale.y);
+			U64 z = (U64)(((a.z + b.z + c.z) / 3 - bounds.min.z) * scale.z);
+			keys[t] = { spreadBits(x) | spreadBits(y) << 1 | spreadBits(z) << 2, (U32)t };
+		}
+	});
+	std::sort(keys.begin(), keys.end());
+
+	// Consecutive runs of the curve become the clusters
+	std::vector<ClusterFileEntry> table((tri_count + cluster_tris - 1) / cluster_tris);
+	header.cluster_count = table.size();
+	header.tri_count = tri_count;
+	header.table_offset = alignOffset(sizeof(ClusterFileHeader));
+
+	fs::path temp_path = path;
+	temp_path += ".tmp";
+	// Nothing of a failed write is left behind, path keeps what it held
+	auto removeTemp = [&]() {
+		std::error_code error;
+		fs::remove(temp_path, error);
+		return false;
+	};
+	{
+		std::ofstream fout(temp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!fout.is_open())
+			return removeTemp();
+		U64 written = 0;
+		auto writeAt = [&](U64 at, const void* data, U64 size) {
+			const char padding[64] = {};
+			fout.write(padding, at - written);
+			fout.write((const char*)data, size);
+			written = at + size;
+		};
+		// The header and the table are written again once the clusters know where they are
+		writeAt(0, &header, sizeof(header));
+		writeAt(header.table_offset, table.data(), table.size() * sizeof(ClusterFileEntry));
+
+		std::vector<U32> used;
+		std::vector<Point3> cluster_vertices;
+		std::vector<IndexedTri> cluster_tris_data;
+		U64 offset = alignOffset(written);
+		for (size_t c = 0; c < table.size(); c++) {
+			size_t first = c * cluster_tris, end = std::min(tri_count, first + cluster_tris);
+
+			// The cluster's own vertices, in the order of the source so their reads stay close together
+			used.clear();
+			for (size_t k = first; k < end; k++) {
+				const IndexedTri& tri = tris[keys[k].second];
+				used.push_back(tri.a);
+				used.push_back(tri.b);
+				used.push_back(tri.c);
+			}
+			std::sort(used.begin(), used.end());
+			used.erase(std::unique(used.begin(), used.end()), used.end());
+			cluster_vertices.resize(used.size());
+			for (size_t v = 0; v < used.size(); v++)
+				cluster_vertices[v] = vertices[used[v]];
+			auto localIndex = [&](U32 index) { return (U32)(std::lower_bound(used.begin(), used.end(), index) - used.begin()); };
+			cluster_tris_data.resize(end - first);
+			for (size_t k = first; k < end; k++) {
+				const IndexedTri& tri = tris[keys[k].second];
+				cluster_tris_data[k - first] = IndexedTri{ localIndex(tri.a), localIndex(tri.b), localIndex(tri.c), tri.color };
+			}
+
+			ClusterFileEntry& entry = table[c];
+			entry.bounds = toFileBounds(computeBounds(cluster_vertices.data(), cluster_vertices.size()));
+			entry.vertex_count = cluster_vertices.size();
+			entry.tri_count = cluster_tris_data.size();
+			entry.vertex_offset = offset;
+			entry.tri_offset = alignOffset(entry.vertex_offset + entry.vertex_count * sizeof(Point3));
+			offset = alignOffset(entry.tri_offset + entry.tri_count * sizeof(IndexedTri));
+			writeAt(entry.vertex_offset, cluster_vertices.data(), entry.vertex_count * sizeof(Point3));
+			writeAt(entry.tri_offset, cluster_tris_data.data(), entry.tri_count * sizeof(IndexedTri));
+			header.vertex_count += entry.vertex_count;
+		}
+
+		fout.seekp(0);
+		fout.write((const char*)&header, sizeof(header));
+		fout.seekp(header.table_offset);
+		fout.write((const char*)table.data(), table.size() * sizeof(ClusterFileEntry));
+		fout.close();
+		if (!fout.good())
+			return removeTemp();
+	}
+
+	std::error_code error;
+	fs::rename(temp_path, path, error);
+	if (error)
+		return removeTemp();
+	return true;
+}
+
+ClusterStream::ClusterStream(U32 loader_threads, size_t memory_budget) {
+	this->memory_budget = memory_budget;
+	this->table = std::make_shared<std::vector<ClusterFileEntry>>();
+	for (U32 t = 0; t < std::max<U32>(loader_threads, 1); t++)
+		this->loaders.emplace_back([this] { this->work(); });
+}
+
+ClusterStream::~ClusterStream() {
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->stopping = true;
+	}
+	this->work_ready.notify_all();
+	for (std::thread& loader : this->loaders)
+		loader.join();
+}
+
+bool ClusterStream::open(const fs::path& path) {
+	ClusterFileHeader header;
+	std::shared_ptr<std::vector<ClusterFileEntry>> table = std::make_shared<std::vector<ClusterFileEntry>>();
+	{
+		std::ifstream file(path, std::ios::in | std::ios::binary);
+		if (!file.is_open())
+			return false;
+		file.seekg(0, std::ios::end);
+		U64 file_size = (U64)file.tellg();
+		file.seekg(0);
+		if (file_size < sizeof(ClusterFileHeader))
+			return false;
+
+		ClusterFileHeader expected;
+		file.read((char*)&header, sizeof(header));
+		if (!file.good() || std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 || header.version != expected.version ||
+			header.byte_order != expected.byte_order || header.vertex_size != expected.vertex_size || header.tri_size != expected.tri_size ||
+			header.bounds.empty > 1)
+			return false;
+		// Checked without overflowing on a damaged header, the triangles of the clusters are checked as they're loaded
+		if (header.table_offset > file_size || header.cluster_count > (file_size - header.table_offset) / sizeof(ClusterFileEntry))
+			return false;
+		table->resize(header.cluster_count);
+		file.seekg(header.table_offset);
+		file.read((char*)table->data(), table->size() * sizeof(ClusterFileEntry));
+		if (!file.good())
+			return false;
+		// Clusters reaching past the end of the file would be read into huge buffers, other flags than 0 and 1 are damage too
+		for (const ClusterFileEntry& entry : *table)
+			if (entry.bounds.empty > 1 || entry.vertex_offset > file_size || entry.vertex_count > (file_size - entry.vertex_offset) / sizeof(Point3) ||
+				entry.tri_offset > file_size || entry.tri_count > (file_size - entry.tri_offset) / sizeof(IndexedTri))
+				return false;
+	}
+
+	std::unique_lock<std::mutex> lock(this->mutex);
+	// Loads of the old file finish first and are dropped
+	this->file_id++;
+	this->wanted_order.clear();
+	this->next_wanted = 0;
+	this->idle.wait(lock, [this] { return this->loading == 0; });
+
+	size_t cluster_count = table->size();
+	this->path = path;
+	this->header = header;
+	this->table = table;
+	this->state.assign(cluster_count, CLUSTER_ABSENT);
+	this->resident.assign(cluster_count, NULL);
+	this->wanted.assign(cluster_count, 0);
+	this->resident_bytes = 0;
+	// Plan the new file for the last view
+	this->view_changed = this->view_set;
+	lock.unlock();
+	this->work_ready.notify_all();
+	return true;
+}
+
+void ClusterStream::setMemoryBudget(size_t bytes) {
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->memory_budget = bytes;
+		this->view_changed = this->view_set;
+	}
+	this->work_ready.notify_all();
+}
+
+void ClusterStream::setView(const Plane3* planes, U32 plane_count, Point3 camera) {
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		bool same = this->view_set && this->view.planes.size() == plane_count && this->view.camera.x == camera.x &&
+			this->view.camera.y == camera.y && this->view.camera.z == camera.z;
+		for (U32 p = 0; same && p < plane_count; p++) {
+			const Plane3& plane = this->view.planes[p];
+			same = plane.normal.x == planes[p].normal.x && plane.normal.y == planes[p].normal.y &&
+				plane.normal.z == planes[p].normal.z && plane.offset == planes[p].offset;
+		}
+		if (same)
+			return;
+		this->view.planes.assign(planes, planes + plane_count);
+		this->view.camera = camera;
+		this->view_set = true;
+		this->view_changed = true;
+	}
+	this->work_ready.notify_all();
+}
+
+void ClusterStream::getResident(CountedVector<std::shared_ptr<MeshGeometry>>& clusters) {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	// Only wanted clusters are resident, and they come most important first
+	for (U32 cluster : this->wanted_order)
+		if (this->state[cluster] == CLUSTER_RESIDENT)
+			clusters.push_back(this->resident[cluster]);
+}
+
+void ClusterStream::finish() {
+	std::unique_lock<std::mutex> lock(this->mutex);
+	this->idle.wait(lock, [this] {
+		return !this->view_changed && !this->planning && this->loading == 0 && this->findNextWanted() == this->state.size();
+	});
+}
+
+size_t ClusterStream::getClusterCount() {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->table->size();
+}
+
+Bounds3 ClusterStream::getBounds() {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return fromFileBounds(this->header.bounds);
+}
+
+U64 ClusterStream::getTriCount() {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->header.tri_count;
+}
+
+size_t ClusterStream::getResidentCount() {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	size_t count = 0;
+	for (U32 cluster : this->wanted_order)
+		count += this->state[cluster] == CLUSTER_RESIDENT;
+	return count;
+}
+
+size_t ClusterStream::getResidentBytes() {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->resident_bytes;
+}
+
+U64 ClusterStream::getLoadCount() {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->load_count;
+}
+
+U64 ClusterStream::getEvictCount() {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->evict_count;
+}
+
+U64 ClusterStream::getFailCount() {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->fail_count;
+}
+
+void ClusterStream::work() {
+	std::ifstream file;
+	U64 opened_id = 0;
+	std::unique_lock<std::mutex> lock(this->mutex);
+	while (true) {
+		this->work_ready.wait(lock, [this] {
+			return this->stopping || (this->view_changed && !this->planning) || this->findNextWanted() < this->state.size();
+		});
+		if (this->stopping)
+			return;
+
+		// Plan on copies so the other loaders keep loading and the layers aren't held up by the sort
+		if (this->view_changed && !this->planning) {
+			this->planning = true;
+			this->view_changed = false;
+			View view = this->view;
+			std::shared_ptr<const std::vector<ClusterFileEntry>> table = this->table;
+			size_t memory_budget = this->memory_budget;
+			U64 file_id = this->file_id;
+			lock.unlock();
+
+			std::vector<U32> order = planView(view, *table, memory_budget);
+
+			lock.lock();
+			this->planning = false;
+			if (file_id == this->file_id)
+				this->applyPlan(order);
+			this->work_ready.notify_all();
+			this->idle.notify_all();
+			continue;
+		}
+
+		U32 cluster = this->findNextWanted();
+		if (cluster >= this->state.size())
+			continue;
+		this->state[cluster] = CLUSTER_LOADING;
+		this->loading++;
+		ClusterFileEntry entry = (*this->table)[cluster];
+		U64 file_id = this->file_id;
+		fs::path path;
+		if (opened_id != file_id)
+			path = this->path;
+		lock.unlock();
+
+		if (opened_id != file_id) {
+			file.close();
+			file.clear();
+			file.open(path, std::ios::in | std::ios::binary);
+			opened_id = file_id;
+		}
+		std::shared_ptr<MeshGeometry> geometry = std::make_shared<MeshGeometry>();
+		bool success = file.is_open() && readCluster(file, entry, *geometry);
+		if (success) {
+			// Computed here so the layers only read them
+			geometry->getBounds();
+			geometry->getGeometryId();
+		}
+
+		lock.lock();
+		this->loading--;
+		if (file_id == this->file_id) {
+			if (!success) {
+				this->state[cluster] = CLUSTER_FAILED;
+				this->fail_count++;
+			}
+			else if (this->wanted[cluster]) {
+				this->state[cluster] = CLUSTER_RESIDENT;
+				this->resident[cluster] = std::move(geometry);
+				this->resident_bytes += getClusterBytes(entry);
+				this->load_count++;
+			}
+			else {
+				// The view moved on while it loaded
+				this->state[cluster] = CLUSTER_ABSENT;
+			}
+		}
+		this->idle.notify_all();
+	}
+}
+
+size_t ClusterStream::getClusterBytes(const ClusterFileEntry& entry) {
+	return entry.vertex_count * sizeof(Point3) + entry.tri_count * sizeof(IndexedTri);
+}
+
+std::vector<U32> ClusterStream::planView(const View& view, const std::vector<ClusterFileEntry>& table, size_t memory_budget) {
+	// Clusters in view come first, nearer ones before farther ones in both groups
+	struct Priority {
+		bool out_of_view;
+		double distance;
+		U32 cluster;
+	};
+	std::vector<Priority> priorities;
+	priorities.reserve(table.size());
+	for (U32 c = 0; c < (U32)table.size(); c++) {
+		Bounds3 bounds = fromFileBounds(table[c].bounds);
+		if (bounds.empty)
+			continue;
+		Point3 offset = Point3{ bounds.center.x - view.camera.x, bounds.center.y - view.camera.y, bounds.center.z - view.camera.z };
+		double distance = std::max(0.0, std::sqrt(dot(offset, offset)) - bounds.radius);
+		bool out_of_view = testBounds(bounds, view.planes.data(), view.planes.size()) == PlaneSide::Outside;
+		priorities.push_back(Priority{ out_of_view, distance, c });
+	}
+	std::sort(priorities.begin(), priorities.end(), [](const Priority& a, const Priority& b) {
+		if (a.out_of_view != b.out_of_view)
+			return b.out_of_view;
+		return a.distance < b.distance;
+	});
+
+	std::vector<U32> order;
+	size_t bytes = 0;
+	for (const Priority& priority : priorities) {
+		size_t cluster_bytes = getClusterBytes(table[priority.cluster]);
+		if (bytes + cluster_bytes > memory_budget)
+			break;
+		bytes += cluster_bytes;
+		order.push_back(priority.cluster);
+	}
+	return order;
+}
+
+void ClusterStream::applyPlan(const std::vector<U32>& order) {
+	std::fill(this->wanted.begin(), this->wanted.end(), 0);
+	for (U32 cluster : order)
+		this->wanted[cluster] = 1;
+	// Everything resident stays within the plan, so the resident clusters always fit in the budget
+	for (size_t c = 0; c < this->state.size(); c++) {
+		if (this->state[c] == CLUSTER_RESIDENT && !this->wanted[c]) {
+			this->resident[c].reset();
+			this->state[c] = CLUSTER_ABSENT;
+			this->resident_bytes -= getClusterBytes((*this->table)[c]);
+			this->evict_count++;
+		}
+	}
+	this->wanted_order = order;
+	this->next_wanted = 0;
+}
+
+U32 ClusterStream::findNextWanted() {
+	while (this->next_wanted < this->wanted_order.size() && this->state[this->wanted_order[this->next_wanted]] != CLUSTER_ABSENT)
+		this->next_wanted++;
+	return this->next_wanted < this->wanted_order.size() ? this->wanted_order[this->next_wanted] : (U32)this->state.size();
+}
+
+bool ClusterStream::readCluster(std::ifstream& file, const ClusterFileEntry& entry, MeshGeometry& geometry) {
+	geometry.vertices.resize(entry.vertex_count);
+	geometry.tris.resize(entry.tri_count);
+	file.seekg(entry.vertex_offset);
+	file.read((char*)geometry.vertices.data(), entry.vertex_count * sizeof(Point3));
+	file.seekg(entry.tri_offset);
+	file.read((char*)geometry.tris.data(), entry.tri_count * sizeof(IndexedTri));
+	if (!file.good()) {
+		file.clear();
+		return false;
+	}
+
+	// Triangles pointing outside the vertices would be read out of bounds when rendering
+	for (const IndexedTri& tri : geometry.tris)
+		if (tri.a >= entry.vertex_count || tri.b >= entry.vertex_count || tri.c >= entry.vertex_count)
+			return false;
+	return true;
+}
@@ -0,0 +1,129 @@
+#pragma once
+#include "../astd.hpp"
+#include "renderer3d.hpp"
+
+// Bounds3 as a cluster file stores it, every byte a field so the same input always gives the same file
+struct ClusterFileBounds {
+	Point3 min, max;
+	Point3 center;
+	double radius = 0;
+	U32 empty = 1; // 0 or 1, the file is damaged otherwise
+	U32 reserved = 0;
+};
+
+// Header of a cluster file, followed by the table of ClusterFileEntry and every cluster's vertices and triangles,
+// everything 64 bytes aligned. Each cluster is a small indexed mesh of its own, so it's loaded with two reads
+struct ClusterFileHeader {
+	char magic[8] = { 'B', 'Z', 'B', 'C', 'L', 'U', 'S', 0 };
+	U32 version = 2; // Bumped whenever the layout changes
+	U32 byte_order = 0x01020304;
+	U32 vertex_size = sizeof(Point3);
+	U32 tri_size = sizeof(IndexedTri);
+	U64 cluster_count = 0;
+	U64 table_offset = 0;
+	U64 vertex_count = 0, tri_count = 0; // Totals of every cluster, shared vertices are counted once per cluster
+	ClusterFileBounds bounds; // Of the whole model
+};
+
+// Entry of the cluster table
+struct ClusterFileEntry {
+	ClusterFileBounds bounds;
+	U64 vertex_count = 0, tri_count = 0;
+	U64 vertex_offset = 0, tri_offset = 0;
+};
+
+// Triangles in a cluster, except the last one of a file
+static const U32 CLUSTER_TRIS = 4096;
+
+// Sorts the triangles along a Morton curve through their centers and cuts them into clusters of cluster_tris,
+// each written with its own copy of the vertices it uses, so nearby triangles end up in the same cluster
+// The arrays can be those of a mapped mesh cache (see buildClusterFileFromObj), besides them it only keeps
+// 16 bytes a triangle and one cluster in memory. Written to a temporary file first, returns if it went successful
+bool writeClusterFile(const Point3* vertices, size_t vertex_count, const IndexedTri* tris, size_t tri_count,
+	const fs::path& path, U32 cluster_tris = CLUSTER_TRIS);
+
+// Pages the clusters of a cluster file in and out of memory on background threads, so models far larger than
+// the memory can be drawn. Only the cluster table is read when opening, everything else is loaded on demand
+// Layers drawing the stream through StreamedMesh tell it where their camera looks, the loaders then keep the
+// clusters in view nearest first, then the others nearest first, as long as they fit in memory_budget
+// Clusters are handed out as shared geometry, so one evicted while a frame draws it stays alive until the frame is done
+class ClusterStream {
+public:
+	explicit ClusterStream(U32 loader_threads = 2, size_t memory_budget = (size_t)512 << 20);
+	ClusterStream(const ClusterStream&) = delete;
+	ClusterStream& operator=(const ClusterStream&) = delete;
+	~ClusterStream();
+
+	// Reads the header and the cluster table, dropping the clusters of the previous file
+	// Returns false and keeps the previous file if it's missing, from another version or layout, or its table is damaged
+	bool open(const fs::path& path);
+	// Bytes of vertices and triangles the loaded clusters may take, shrinking it evicts clusters at the next view
+	void setMemoryBudget(size_t bytes);
+
+	// Planes of the view in the file's space, inside on their positive side, and the camera's position in that space
+	// The loaders only plan again when the view moved
+	void setView(const Plane3* planes, U32 plane_count, Point3 camera);
+	// Appends the clusters loaded so far
+	void getResident(CountedVector<std::shared_ptr<MeshGeometry>>& clusters);
+	// Waits until every cluster wanted for the last view is loaded, or failed to, for offline rendering
+	void finish();
+
+	size_t getClusterCount();
+	Bounds3 getBounds(); // Of the whole model, empty until a file is open
+	U64 getTriCount();
+	size_t getResidentCount();
+	size_t getResidentBytes();
+	// Clusters loaded, evicted and failed to load since the stream was made
+	U64 getLoadCount();
+	U64 getEvictCount();
+	U64 getFailCount();
+
+private:
+	// Where a cluster is
+	static constexpr U8 CLUSTER_ABSENT = 0;
+	static constexpr U8 CLUSTER_LOADING = 1;
+	static constexpr U8 CLUSTER_RESIDENT = 2;
+	static constexpr U8 CLUSTER_FAILED = 3; // Couldn't be read or refers to vertices it doesn't have, never tried again
+
+	struct View {
+		std::vector<Plane3> planes;
+		Point3 camera;
+	};
+
+	std::vector<std::thread> loaders;
+	std::mutex mutex;
+	std::condition_variable work_ready, idle;
+	bool stopping = false;
+
+	fs::path path;
+	U64 file_id = 0; // Changes with every open(), so loaders reopen the file and drop loads of the old one
+	ClusterFileHeader header;
+	std::shared_ptr<const std::vector<ClusterFileEntry>> table; // Replaced by open(), so planning can read it unlocked
+	std::vector<U8> state;
+	std::vector<std::shared_ptr<MeshGeometry>> resident;
+	std::vector<U8> wanted; // The cluster is in wanted_order
+	std::vector<U32> wanted_order; // Clusters fitting in the budget, most important first
+	size_t next_wanted = 0; // Clusters of wanted_order before it are loaded or being loaded
+	size_t memory_budget;
+	size_t resident_bytes = 0;
+
+	View view;
+	bool view_set = false;
+	bool view_changed = false; // The view moved since the loaders last planned
+	bool planning = false; // A loader is planning, the others keep loading the last plan
+	U32 loading = 0;
+
+	U64 load_count = 0, evict_count = 0, fail_count = 0;
+
+	void work();
+	// Bytes a cluster takes once loaded
+	static size_t getClusterBytes(const ClusterFileEntry& entry);
+	// Orders every cluster by importance for the view, keeping those fitting in the budget, done without the lock
+	static std::vector<U32> planView(const View& view, const std::vector<ClusterFileEntry>& table, size_t memory_budget);
+	// Replaces the plan and evicts the resident clusters left out of it, under the lock
+	void applyPlan(const std::vector<U32>& order);
+	// Index of the next cluster to load, or the cluster count if everything wanted is loaded or loading
+	U32 findNextWanted();
+	// Reads a cluster of the open file into the geometry, returns false if it's damaged
+	static bool readCluster(std::ifstream& file, const ClusterFileEntry& entry, MeshGeometry& geometry);
+};
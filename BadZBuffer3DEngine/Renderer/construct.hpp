@@ -2,30 +2,254 @@
 #include "../astd.hpp"
 #include "math.hpp"
 #include "renderer3d.hpp"
+#include "obj_loader.hpp"
+#include "mapped_file.hpp"
+#include "simplify.hpp"
+#include "cluster_stream.hpp"
+#include <cstring>
 
-inline std::vector<SolidTri> loadFromObj(sf::String file_name) {
-	bool succ = false;
-	std::vector<U8> file = astd::readFromFile(file_name, &succ);
-	if (!succ)
-		return std::vector<SolidTri>();
+// Header of a binary mesh cache, followed by the vertices, the triangles, the level of detail table
+// and the levels' vertices and triangles, everything 64 bytes aligned
+// The payloads are IndexedMesh's own arrays as they are in memory, so loading them is a copy
+struct MeshCacheHeader {
+	char magic[8] = { 'B', 'Z', 'B', 'M', 'E', 'S', 'H', 0 };
+	U32 version = 2; // Bumped whenever the layout or the loader's output changes
+	U32 byte_order = 0x01020304; // Reads differently on a machine of the other endianness
+	U32 vertex_size = sizeof(Point3);
+	U32 tri_size = sizeof(IndexedTri);
+	U64 source_size = 0; // Size and modification time of the file the cache was made from
+	I64 source_time = 0;
+	U64 vertex_count = 0, tri_count = 0;
+	U64 vertex_offset = 0, tri_offset = 0;
+	U32 has_lods = 0; // The levels of detail were built, even if the mesh was too small for any
+	U32 lod_count = 0;
+	U64 lod_offset = 0; // Where the table of MeshCacheLod starts
+};
 
-	std::string str(file.begin(), file.end());
-	std::vector<sf::String> lines = astd::split(str, '\n');
+// Entry of the level of detail table of a binary mesh cache
+struct MeshCacheLod {
+	U64 vertex_count = 0, tri_count = 0;
+	U64 vertex_offset = 0, tri_offset = 0;
+	double error = 0;
+};
 
-	std::vector<Point3> vertices;
-	std::vector<SolidTri> ret;
+// Path of the cache kept next to a source file
+inline fs::path getMeshCachePath(sf::String file_name) {
+	fs::path path(file_name.toWideString());
+	path += ".bzmesh";
+	return path;
+}
+
+// Size and modification time a cache of the file has to match, returns false if the file can't be read
+inline bool getMeshSourceStamp(sf::String file_name, U64& size, I64& time) {
+	std::error_code error;
+	fs::path path(file_name.toWideString());
+	size = (U64)fs::file_size(path, error);
+	if (error)
+		return false;
+	time = (I64)fs::last_write_time(path, error).time_since_epoch().count();
+	return !error;
+}
+
+// Writes the mesh as a binary cache, stamped with its source's size and modification time
+// has_lods records if its levels of detail were built, it's written to a temporary file first so a cache is never
+// seen half written, returns if it went successful
+inline bool writeMeshCache(const IndexedMesh& mesh, const fs::path& cache_path, U64 source_size, I64 source_time, bool has_lods) {
+	MeshCacheHeader header;
+	header.source_size = source_size;
+	header.source_time = source_time;
+	header.vertex_count = mesh.vertices.size();
+	header.tri_count = mesh.tris.size();
+	header.has_lods = has_lods;
+	header.lod_count = (U32)mesh.lods.size();
+	auto align = [](U64 offset) { return (offset + 63) & ~(U64)63; };
+	header.vertex_offset = align(sizeof(MeshCacheHeader));
+	header.tri_offset = align(header.vertex_offset + header.vertex_count * sizeof(Point3));
+	header.lod_offset = align(header.tri_offset + header.tri_count * sizeof(IndexedTri));
+	std::vector<MeshCacheLod> lod_table(mesh.lods.size());
+	U64 offset = align(header.lod_offset + lod_table.size() * sizeof(MeshCacheLod));
+	for (size_t l = 0; l < mesh.lods.size(); l++) {
+		MeshCacheLod& entry = lod_table[l];
+		entry.vertex_count = mesh.lods[l].vertices.size();
+		entry.tri_count = mesh.lods[l].tris.size();
+		entry.error = mesh.lods[l].error;
+		entry.vertex_offset = offset;
+		entry.tri_offset = align(entry.vertex_offset + entry.vertex_count * sizeof(Point3));
+		offset = align(entry.tri_offset + entry.tri_count * sizeof(IndexedTri));
+	}
+
+	fs::path temp_path = cache_path;
+	temp_path += ".tmp";
+	// Nothing of a failed write is left behind, cache_path keeps what it held
+	auto removeTemp = [&]() {
+		std::error_code error;
+		fs::remove(temp_path, error);
+		return false;
+	};
+	{
+		std::ofstream fout(temp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!fout.is_open())
+			return removeTemp();
+		// Writes the bytes at the offset, padding from where the file ends
+		U64 written = 0;
+		auto writeAt = [&](U64 at, const void* data, U64 size) {
+			const char padding[64] = {};
+			fout.write(padding, at - written);
+			fout.write((const char*)data, size);
+			written = at + size;
+		};
+		writeAt(0, &header, sizeof(header));
+		writeAt(header.vertex_offset, mesh.vertices.data(), header.vertex_count * sizeof(Point3));
+		writeAt(header.tri_offset, mesh.tris.data(), header.tri_count * sizeof(IndexedTri));
+		writeAt(header.lod_offset, lod_table.data(), lod_table.size() * sizeof(MeshCacheLod));
+		for (size_t l = 0; l < mesh.lods.size(); l++) {
+			writeAt(lod_table[l].vertex_offset, mesh.lods[l].vertices.data(), lod_table[l].vertex_count * sizeof(Point3));
+			writeAt(lod_table[l].tri_offset, mesh.lods[l].tris.data(), lod_table[l].tri_count * sizeof(IndexedTri));
+		}
+		fout.close();
+		if (!fout.good())
+			return removeTemp();
+	}
+
+	std::error_code error;
+	fs::rename(temp_path, cache_path, error);
+	if (error)
+		return removeTemp();
+	return true;
+}
+
+// Copies vertex_count vertices and tri_count triangles at the offsets of the mapped cache,
+// returns false if they don't fit in the file or a triangle refers to a vertex that isn't there
+inline bool readMeshArrays(const MappedFile& file, U64 vertex_offset, U64 vertex_count, U64 tri_offset, U64 tri_count,
+	std::vector<Point3>& vertices, std::vector<IndexedTri>& tris) {
+	// Checked without overflowing on a damaged header
+	U64 file_size = file.getSize();
+	if (vertex_offset > file_size || vertex_count > (file_size - vertex_offset) / sizeof(Point3) ||
+		tri_offset > file_size || tri_count > (file_size - tri_offset) / sizeof(IndexedTri))
+		return false;
+
+	vertices.resize(vertex_count);
+	tris.resize(tri_count);
+	std::memcpy(vertices.data(), file.getData() + vertex_offset, vertex_count * sizeof(Point3));
+	std::memcpy(tris.data(), file.getData() + tri_offset, tri_count * sizeof(IndexedTri));
+
+	// Triangles pointing outside the vertices would be read out of bounds when rendering
+	for (const IndexedTri& tri : tris)
+		if (tri.a >= vertex_count || tri.b >= vertex_count || tri.c >= vertex_count)
+			return false;
+	return true;
+}
+
+// Maps a binary cache and reads its header, returns false if it's missing, from another version or layout,
+// or if it wasn't made from a source of this size and modification time
+inline bool mapMeshCache(const fs::path& cache_path, U64 source_size, I64 source_time, MappedFile& file, MeshCacheHeader& header) {
+	if (!file.open(cache_path) || file.getSize() < sizeof(MeshCacheHeader))
+		return false;
+
+	MeshCacheHeader expected;
+	std::memcpy(&header, file.getData(), sizeof(header));
+	if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 || header.version != expected.version ||
+		header.byte_order != expected.byte_order || header.vertex_size != expected.vertex_size || header.tri_size != expected.tri_size)
+		return false;
+	return header.source_size == source_size && header.source_time == source_time;
+}
 
-	for (sf::String& line : lines) {
-		std::vector<sf::String> piece = astd::split(line, ' ');
-		if (piece.size() < 4)
-			continue;
+// Maps a binary cache and copies it into mesh, returns false without touching mesh if it's missing, damaged,
+// from another version or layout, if it wasn't made from a source of this size and modification time,
+// or if it lacks the levels of detail and want_lods is set. Without want_lods, its levels aren't read
+inline bool readMeshCache(const fs::path& cache_path, U64 source_size, I64 source_time, bool want_lods, IndexedMesh& mesh) {
+	MappedFile file;
+	MeshCacheHeader header;
+	if (!mapMeshCache(cache_path, source_size, source_time, file, header))
+		return false;
+	if (want_lods && !header.has_lods)
+		return false;
 
-		if (piece[0] == 'v')
-			vertices.push_back(Point3{ astd::strToPoint(piece[1]), astd::strToPoint(piece[2]), astd::strToPoint(piece[3]) });
-		else if (piece[0] == 'f')
-			ret.push_back(SolidTri{ vertices[astd::strToInt(piece[1]) - 1], vertices[astd::strToInt(piece[2]) - 1], vertices[astd::strToInt(piece[3]) - 1],
-				0xFF000000 | (astd::getMicros() % (1 << 24)) });
+	IndexedMesh ret;
+	if (!readMeshArrays(file, header.vertex_offset, header.vertex_count, header.tri_offset, header.tri_count, ret.vertices, ret.tris))
+		return false;
+	if (want_lods) {
+		U64 file_size = file.getSize();
+		if (header.lod_offset > file_size || header.lod_count > (file_size - header.lod_offset) / sizeof(MeshCacheLod))
+			return false;
+		ret.lods.resize(header.lod_count);
+		for (U32 l = 0; l < header.lod_count; l++) {
+			MeshCacheLod entry;
+			std::memcpy(&entry, file.getData() + header.lod_offset + l * sizeof(MeshCacheLod), sizeof(entry));
+			ret.lods[l].error = entry.error;
+			if (!readMeshArrays(file, entry.vertex_offset, entry.vertex_count, entry.tri_offset, entry.tri_count, ret.lods[l].vertices, ret.lods[l].tris))
+				return false;
+		}
 	}
+	mesh = std::move(ret);
+	return true;
+}
+
+// Loads the OBJ file's vertices and faces as is, faces share the vertices they refer to
+// With build_lods, the mesh also gets its chain of levels of detail from buildLods()
+// With use_cache, a binary cache next to the file is loaded instead when it was made from the file as it is now,
+// otherwise the file is parsed and the cache is written for the next time, so the simplification only runs once
+inline IndexedMesh loadIndexedFromObj(sf::String file_name, bool use_cache = true, bool build_lods = true) {
+	U64 source_size = 0;
+	I64 source_time = 0;
+	if (!use_cache || !getMeshSourceStamp(file_name, source_size, source_time)) {
+		IndexedMesh ret = loadObjFile(file_name);
+		if (build_lods)
+			ret.lods = buildLods(ret.vertices, ret.tris);
+		return ret;
+	}
+
+	IndexedMesh ret;
+	fs::path cache_path = getMeshCachePath(file_name);
+	if (readMeshCache(cache_path, source_size, source_time, build_lods, ret))
+		return ret;
+
+	bool success = false;
+	ret = loadObjFile(file_name, &success);
+	if (build_lods)
+		ret.lods = buildLods(ret.vertices, ret.tris);
+	if (success)
+		writeMeshCache(ret, cache_path, source_size, source_time, build_lods);
+	return ret;
+}
+
+// Converts the OBJ file into a cluster file for ClusterStream, through the binary cache next to it
+// The clusters are cut from the mapped cache, so only the parse that makes a missing cache holds the whole mesh
+// Returns if it went successful
+inline bool buildClusterFileFromObj(sf::String file_name, const fs::path& cluster_path, U32 cluster_tris = CLUSTER_TRIS) {
+	U64 source_size = 0;
+	I64 source_time = 0;
+	if (!getMeshSourceStamp(file_name, source_size, source_time))
+		return false;
+
+	fs::path cache_path = getMeshCachePath(file_name);
+	MappedFile file;
+	MeshCacheHeader header;
+	if (!mapMeshCache(cache_path, source_size, source_time, file, header)) {
+		// Parsing writes the cache, the mesh is only used if it couldn't be written
+		IndexedMesh mesh = loadIndexedFromObj(file_name, true, false);
+		if (!mapMeshCache(cache_path, source_size, source_time, file, header))
+			return !mesh.tris.empty() && writeClusterFile(mesh.vertices.data(), mesh.vertices.size(), mesh.tris.data(), mesh.tris.size(), cluster_path, cluster_tris);
+	}
+
+	// Checked without overflowing on a damaged header, writeClusterFile checks the triangles
+	U64 file_size = file.getSize();
+	if (header.vertex_offset > file_size || header.vertex_count > (file_size - header.vertex_offset) / sizeof(Point3) ||
+		header.tri_offset > file_size || header.tri_count > (file_size - header.tri_offset) / sizeof(IndexedTri))
+		return false;
+	return writeClusterFile((const Point3*)(file.getData() + header.vertex_offset), (size_t)header.vertex_count,
+		(const IndexedTri*)(file.getData() + header.tri_offset), (size_t)header.tri_count, cluster_path, cluster_tris);
+}
+
+// Loads the OBJ file as separate triangles, every face gets its own copy of its vertices
+// A Mesh is always drawn in full, levels of detail only exist for an IndexedMesh or a MeshGeometry: use loadIndexedFromObj() for them
+inline std::vector<SolidTri> loadFromObj(sf::String file_name) {
+	IndexedMesh indexed = loadIndexedFromObj(file_name, true, false);
+
+	std::vector<SolidTri> ret;
+	ret.reserve(indexed.tris.size());
+	for (IndexedTri& tri : indexed.tris)
+		ret.push_back(SolidTri{ indexed.vertices[tri.a], indexed.vertices[tri.b], indexed.vertices[tri.c], tri.color });
 
 	return ret;
 }
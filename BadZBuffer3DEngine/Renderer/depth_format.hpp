@@ -0,0 +1,112 @@
+#pragma once
+#include "../astd.hpp"
+#include "math.hpp"
+
+// How the depth buffer stores depths, see BasicRender3DLayer::depth_format
+enum class DepthFormat {
+	Linear, // Camera depth in the precision's depth type, interpolated linearly across the screen
+	ReversedFloat, // near_clipping / depth as a float, 1 at the near clipping and shrinking towards 0 far away
+	Unorm24, // 1 / depth normalized between the clippings into 24 bits, kept in 4 bytes, nearest is largest
+	Unorm16 // Same in 2 bytes, half the bandwidth of Unorm24 for a much coarser depth far away
+};
+
+// The formats below turn camera depths into the values the rasterizers interpolate (Value, in the precision's depth type)
+// and the values the depth buffer and the pyramid store (Stored)
+// Every format but Linear interpolates a multiple of 1 / depth, which unlike the depth is linear across the screen,
+// and is reversed: nearer is larger and the buffers are cleared to 0
+// Triangles are clipped to the near clipping before they get here, so every depth is positive and at least that far
+
+template <class Depth>
+struct LinearDepth {
+	typedef Depth Value;
+	typedef Depth Stored;
+	static const bool REVERSED = false;
+	double near_clipping;
+
+	Value toValue(double depth) const { return (Value)depth; }
+	Stored encode(Value value) const { return value; }
+	double toDepth(Stored stored) const { return stored; }
+	// Something at the camera depth may still pass the depth test against the stored value
+	bool mayPass(double depth, Stored stored) const { return stored >= depth; }
+
+	static bool passes(Stored incoming, Stored stored) { return stored >= incoming; }
+	static Stored farther(Stored a, Stored b) { return std::max(a, b); }
+	static Stored clearValue() { return (Stored)INF; }
+	static Stored nearestLimit() { return (Stored)-INF; }
+};
+
+template <class Depth>
+struct ReversedFloatDepth {
+	typedef Depth Value;
+	typedef float Stored;
+	static const bool REVERSED = true;
+	double near_clipping;
+
+	Value toValue(double depth) const { return (Value)(this->near_clipping / depth); }
+	Stored encode(Value value) const { return (Stored)value; }
+	double toDepth(Stored stored) const { return this->near_clipping / stored; }
+	bool mayPass(double depth, Stored stored) const { return passes(this->encode(this->toValue(depth)), stored); }
+
+	static bool passes(Stored incoming, Stored stored) { return incoming >= stored; }
+	static Stored farther(Stored a, Stored b) { return std::min(a, b); }
+	static Stored clearValue() { return 0; }
+	static Stored nearestLimit() { return (Stored)INF; }
+};
+
+// 1 / depth mapped from the far clipping at 0 to the near clipping at 1, then quantized to 1 ... 2^BITS - 1
+// A step of the stored value is depth^2 * (1 / near_clipping - 1 / far_clipping) / (2^BITS - 2) deep at a depth,
+// so the near clipping should be kept as far as the scene allows
+template <class Depth, class StoredType, U32 BITS>
+struct UnormDepth {
+	typedef Depth Value;
+	typedef StoredType Stored;
+	static const bool REVERSED = true;
+	static const U32 MAX_STORED = (1u << BITS) - 1;
+	double near_clipping;
+	double inverse_near, inverse_far; // 1 / the clippings
+	Depth scale; // Stored steps from the far to the near clipping
+
+	UnormDepth(double near_clip, double far_clip) {
+		this->near_clipping = near_clip;
+		this->inverse_near = 1 / near_clip;
+		this->inverse_far = 1 / far_clip;
+		this->scale = (Depth)(MAX_STORED - 1);
+	}
+
+	Value toValue(double depth) const {
+		return (Value)((1 / depth - this->inverse_far) / (this->inverse_near - this->inverse_far));
+	}
+	// Truncated after adding a half, which the SIMD rasterizer reproduces exactly
+	Stored encode(Value value) const {
+		return (Stored)(I32)(std::min(std::max(value, (Value)0), (Value)1) * this->scale + (Value)1.5);
+	}
+	double toDepth(Stored stored) const {
+		return 1 / ((double)(stored - 1) / (MAX_STORED - 1) * (this->inverse_near - this->inverse_far) + this->inverse_far);
+	}
+	bool mayPass(double depth, Stored stored) const { return passes(this->encode(this->toValue(depth)), stored); }
+
+	static bool passes(Stored incoming, Stored stored) { return incoming >= stored; }
+	static Stored farther(Stored a, Stored b) { return std::min(a, b); }
+	static Stored clearValue() { return 0; }
+	static Stored nearestLimit() { return (Stored)MAX_STORED; }
+};
+
+template <class Depth>
+using Unorm24Depth = UnormDepth<Depth, U32, 24>;
+template <class Depth>
+using Unorm16Depth = UnormDepth<Depth, U16, 16>;
+
+// Bytes a stored depth takes in the format
+template <class Depth>
+size_t getDepthSize(DepthFormat format) {
+	switch (format) {
+	case DepthFormat::ReversedFloat:
+		return sizeof(float);
+	case DepthFormat::Unorm24:
+		return sizeof(U32);
+	case DepthFormat::Unorm16:
+		return sizeof(U16);
+	default:
+		return sizeof(Depth);
+	}
+}
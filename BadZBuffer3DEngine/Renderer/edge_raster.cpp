@@ -0,0 +1,448 @@
+#include "renderer3d.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define EDGE_RASTER_SSE2
+#include <emmintrin.h>
+#endif
+
+// Vertices are snapped to 1/16th of a pixel before setting up the edge functions
+static const I64 SUBPIXEL_BITS = 4;
+static const I64 SUBPIXEL_ONE = 1 << SUBPIXEL_BITS;
+// Triangles reaching further than this many pixels go to the scanline rasterizer,
+// which keeps the edge values of a partially covered block within 32 bits
+static const double EDGE_RANGE = 1 << 14;
+static const I64 BLOCK_SIZE = 8;
+#if RENDER_STATS
+// Set bits of every 4 bit mask
+static const U8 MASK_BITS[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+#endif
+
+#ifdef EDGE_RASTER_SSE2
+// Depths of a group of 4 pixels, masks are 4 lanes of 32 bits like the coverage
+template <class Depth>
+struct DepthLanes;
+
+// 2 pairs of doubles
+template <>
+struct DepthLanes<double> {
+	__m128d lo, hi;
+
+	static DepthLanes set1(double value) {
+		return DepthLanes{ _mm_set1_pd(value), _mm_set1_pd(value) };
+	}
+	static DepthLanes setr(double d0, double d1, double d2, double d3) {
+		return DepthLanes{ _mm_setr_pd(d0, d1), _mm_setr_pd(d2, d3) };
+	}
+	static DepthLanes load(const double* ptr) {
+		return DepthLanes{ _mm_loadu_pd(ptr), _mm_loadu_pd(ptr + 2) };
+	}
+	void store(double* ptr) const {
+		_mm_storeu_pd(ptr, this->lo);
+		_mm_storeu_pd(ptr + 2, this->hi);
+	}
+	DepthLanes add(const DepthLanes& other) const {
+		return DepthLanes{ _mm_add_pd(this->lo, other.lo), _mm_add_pd(this->hi, other.hi) };
+	}
+	DepthLanes multiply(const DepthLanes& other) const {
+		return DepthLanes{ _mm_mul_pd(this->lo, other.lo), _mm_mul_pd(this->hi, other.hi) };
+	}
+	DepthLanes clamp(const DepthLanes& low, const DepthLanes& high) const {
+		return DepthLanes{ _mm_min_pd(_mm_max_pd(this->lo, low.lo), high.lo), _mm_min_pd(_mm_max_pd(this->hi, low.hi), high.hi) };
+	}
+	// Narrows the 64 bit masks of the pairs to 32 bit lanes
+	static __m128i narrow(__m128d mask_lo, __m128d mask_hi) {
+		return _mm_castps_si128(_mm_shuffle_ps(_mm_castpd_ps(mask_lo), _mm_castpd_ps(mask_hi), _MM_SHUFFLE(2, 0, 2, 0)));
+	}
+	__m128i greaterEqual(const DepthLanes& other) const {
+		return narrow(_mm_cmpge_pd(this->lo, other.lo), _mm_cmpge_pd(this->hi, other.hi));
+	}
+	// Lanes of this where the mask is set, of other elsewhere
+	DepthLanes select(__m128i mask, const DepthLanes& other) const {
+		__m128d mask_lo = _mm_castsi128_pd(_mm_unpacklo_epi32(mask, mask));
+		__m128d mask_hi = _mm_castsi128_pd(_mm_unpackhi_epi32(mask, mask));
+		return DepthLanes{ _mm_or_pd(_mm_and_pd(mask_lo, this->lo), _mm_andnot_pd(mask_lo, other.lo)),
+			_mm_or_pd(_mm_and_pd(mask_hi, this->hi), _mm_andnot_pd(mask_hi, other.hi)) };
+	}
+};
+
+// 4 floats, a single register
+template <>
+struct DepthLanes<float> {
+	__m128 lanes;
+
+	static DepthLanes set1(float value) {
+		return DepthLanes{ _mm_set1_ps(value) };
+	}
+	static DepthLanes setr(float d0, float d1, float d2, float d3) {
+		return DepthLanes{ _mm_setr_ps(d0, d1, d2, d3) };
+	}
+	static DepthLanes load(const float* ptr) {
+		return DepthLanes{ _mm_loadu_ps(ptr) };
+	}
+	void store(float* ptr) const {
+		_mm_storeu_ps(ptr, this->lanes);
+	}
+	DepthLanes add(const DepthLanes& other) const {
+		return DepthLanes{ _mm_add_ps(this->lanes, other.lanes) };
+	}
+	DepthLanes multiply(const DepthLanes& other) const {
+		return DepthLanes{ _mm_mul_ps(this->lanes, other.lanes) };
+	}
+	DepthLanes clamp(const DepthLanes& low, const DepthLanes& high) const {
+		return DepthLanes{ _mm_min_ps(_mm_max_ps(this->lanes, low.lanes), high.lanes) };
+	}
+	__m128i greaterEqual(const DepthLanes& other) const {
+		return _mm_castps_si128(_mm_cmpge_ps(this->lanes, other.lanes));
+	}
+	DepthLanes select(__m128i mask, const DepthLanes& other) const {
+		__m128 mask_ps = _mm_castsi128_ps(mask);
+		return DepthLanes{ _mm_or_ps(_mm_and_ps(mask_ps, this->lanes), _mm_andnot_ps(mask_ps, other.lanes)) };
+	}
+};
+
+// Rounds the lanes to floats the way a cast does
+static __m128 toFloatLanes(const DepthLanes<double>& values) {
+	return _mm_movelh_ps(_mm_cvtpd_ps(values.lo), _mm_cvtpd_ps(values.hi));
+}
+static __m128 toFloatLanes(const DepthLanes<float>& values) {
+	return values.lanes;
+}
+
+// Truncates the lanes to 32 bit integers the way a cast does
+static __m128i toIntLanes(const DepthLanes<double>& values) {
+	return _mm_unpacklo_epi64(_mm_cvttpd_epi32(values.lo), _mm_cvttpd_epi32(values.hi));
+}
+static __m128i toIntLanes(const DepthLanes<float>& values) {
+	return _mm_cvttps_epi32(values.lanes);
+}
+
+// Depths of a group of 4 pixels as the format stores them, encoded from the interpolated values
+template <class Format>
+struct StoredLanes;
+
+// The values themselves
+template <class Depth>
+struct StoredLanes<LinearDepth<Depth>> {
+	DepthLanes<Depth> lanes;
+
+	static StoredLanes encode(const LinearDepth<Depth>&, const DepthLanes<Depth>& values) {
+		return StoredLanes{ values };
+	}
+	static StoredLanes load(const Depth* ptr) {
+		return StoredLanes{ DepthLanes<Depth>::load(ptr) };
+	}
+	void store(Depth* ptr) const {
+		this->lanes.store(ptr);
+	}
+	__m128i passes(const StoredLanes& stored) const {
+		return stored.lanes.greaterEqual(this->lanes);
+	}
+	StoredLanes select(__m128i mask, const StoredLanes& other) const {
+		return StoredLanes{ this->lanes.select(mask, other.lanes) };
+	}
+};
+
+template <class Depth>
+struct StoredLanes<ReversedFloatDepth<Depth>> {
+	__m128 lanes;
+
+	static StoredLanes encode(const ReversedFloatDepth<Depth>&, const DepthLanes<Depth>& values) {
+		return StoredLanes{ toFloatLanes(values) };
+	}
+	static StoredLanes load(const float* ptr) {
+		return StoredLanes{ _mm_loadu_ps(ptr) };
+	}
+	void store(float* ptr) const {
+		_mm_storeu_ps(ptr, this->lanes);
+	}
+	__m128i passes(const StoredLanes& stored) const {
+		return _mm_castps_si128(_mm_cmpge_ps(this->lanes, stored.lanes));
+	}
+	StoredLanes select(__m128i mask, const StoredLanes& other) const {
+		__m128 mask_ps = _mm_castsi128_ps(mask);
+		return StoredLanes{ _mm_or_ps(_mm_and_ps(mask_ps, this->lanes), _mm_andnot_ps(mask_ps, other.lanes)) };
+	}
+};
+
+// Held as 32 bit integers, which are compared signed since no stored value reaches the sign bit
+template <class Depth, class Stored, U32 BITS>
+struct StoredLanes<UnormDepth<Depth, Stored, BITS>> {
+	__m128i lanes;
+
+	static StoredLanes encode(const UnormDepth<Depth, Stored, BITS>& format, const DepthLanes<Depth>& values) {
+		DepthLanes<Depth> scaled = values.clamp(DepthLanes<Depth>::set1(0), DepthLanes<Depth>::set1(1))
+			.multiply(DepthLanes<Depth>::set1(format.scale)).add(DepthLanes<Depth>::set1((Depth)1.5));
+		return StoredLanes{ toIntLanes(scaled) };
+	}
+	static StoredLanes load(const Stored* ptr) {
+		if constexpr (sizeof(Stored) == 2)
+			return StoredLanes{ _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)ptr), _mm_setzero_si128()) };
+		else
+			return StoredLanes{ _mm_loadu_si128((const __m128i*)ptr) };
+	}
+	void store(Stored* ptr) const {
+		if constexpr (sizeof(Stored) == 2) {
+			// Packing saturates to signed 16 bits, so the values go through it shifted down by half the range
+			const __m128i bias = _mm_set1_epi32(0x8000);
+			__m128i packed = _mm_packs_epi32(_mm_sub_epi32(this->lanes, bias), _mm_setzero_si128());
+			_mm_storel_epi64((__m128i*)ptr, _mm_xor_si128(packed, _mm_set1_epi16((short)0x8000)));
+		}
+		else
+			_mm_storeu_si128((__m128i*)ptr, this->lanes);
+	}
+	__m128i passes(const StoredLanes& stored) const {
+		return _mm_xor_si128(_mm_cmplt_epi32(this->lanes, stored.lanes), _mm_set1_epi32(-1));
+	}
+	StoredLanes select(__m128i mask, const StoredLanes& other) const {
+		return StoredLanes{ _mm_or_si128(_mm_and_si128(mask, this->lanes), _mm_andnot_si128(mask, other.lanes)) };
+	}
+};
+#endif
+
+// Rasterizes a projected triangle with half-space tests, only touching the pixels inside the region
+template <class Precision>
+template <class Format, class Shader>
+void BasicRender3DLayer<Precision>::rasterizeTriEdges(const Format& format, const ScreenTri<Precision>& projected_tri, const Shader& shader,
+	RasterRegion& region) {
+	typedef typename Format::Stored Stored;
+	// The setup runs in double whatever the precision, only the per-pixel depths use the precision's depth type
+	Point3 p[3];
+	const ScreenVertex<Precision>* vertices[3] = { &projected_tri.a, &projected_tri.b, &projected_tri.c };
+	for (U32 v = 0; v < 3; v++)
+		p[v] = Point3{ Precision::toPixels(vertices[v]->x), Precision::toPixels(vertices[v]->y), (double)vertices[v]->z };
+	for (Point3& point : p) {
+		if (!(point.x > -EDGE_RANGE && point.x < EDGE_RANGE && point.y > -EDGE_RANGE && point.y < EDGE_RANGE)) {
+			this->rasterizeTriScanline(format, projected_tri, shader, region);
+			return;
+		}
+	}
+
+	// Snap to the subpixel grid, rounding through a positive offset since truncating is cheaper than llround
+	// Fixed point coordinates were snapped to the same grid by the projection
+	const double snap_offset = EDGE_RANGE * SUBPIXEL_ONE + 0.5;
+	I64 fx[3], fy[3];
+	for (U32 v = 0; v < 3; v++) {
+		if constexpr (Precision::SUBPIXEL_BITS == SUBPIXEL_BITS) {
+			fx[v] = vertices[v]->x;
+			fy[v] = vertices[v]->y;
+		}
+		else {
+			fx[v] = (I64)(p[v].x * SUBPIXEL_ONE + snap_offset) - (I64)(EDGE_RANGE * SUBPIXEL_ONE);
+			fy[v] = (I64)(p[v].y * SUBPIXEL_ONE + snap_offset) - (I64)(EDGE_RANGE * SUBPIXEL_ONE);
+		}
+	}
+
+	// Make the winding clockwise on screen so the inside of every edge is positive
+	I64 area = (fx[1] - fx[0]) * (fy[2] - fy[0]) - (fy[1] - fy[0]) * (fx[2] - fx[0]);
+	if (area == 0)
+		return;
+	if (area < 0) {
+		std::swap(fx[1], fx[2]);
+		std::swap(fy[1], fy[2]);
+		std::swap(p[1], p[2]);
+	}
+
+	// Bounding box of the pixel centers the triangle can cover, clipped to the region
+	// Most subpixel triangles cover no center and stop here
+	const I64 half = SUBPIXEL_ONE / 2;
+	I64 box_min_x = std::max(region.min_x, (std::min({ fx[0], fx[1], fx[2] }) - half + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS);
+	I64 box_min_y = std::max(region.min_y, (std::min({ fy[0], fy[1], fy[2] }) - half + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS);
+	I64 box_max_x = std::min(region.max_x - 1, (std::max({ fx[0], fx[1], fx[2] }) - half) >> SUBPIXEL_BITS);
+	I64 box_max_y = std::min(region.max_y - 1, (std::max({ fy[0], fy[1], fy[2] }) - half) >> SUBPIXEL_BITS);
+	if (box_min_x > box_max_x || box_min_y > box_max_y)
+		return;
+
+	// Edge i goes from vertex i to the next one, its value grows by step_x and step_y per pixel
+	// Edges that aren't top or left edges are biased by 1, so pixels exactly on them go to the neighbouring triangle
+	I64 step_x[3], step_y[3], origin[3];
+	for (U32 i = 0; i < 3; i++) {
+		U32 j = (i + 1) % 3;
+		I64 dx = fx[j] - fx[i];
+		I64 dy = fy[j] - fy[i];
+		bool top_left = (dy == 0 && dx > 0) || dy < 0;
+		step_x[i] = -dy * SUBPIXEL_ONE;
+		step_y[i] = dx * SUBPIXEL_ONE;
+		// Value at the center of the pixel 0, 0
+		origin[i] = -dy * (half - fx[i]) + dx * (half - fy[i]) - (top_left ? 0 : 1);
+	}
+
+	// Plane of the format's values, interpolated linearly in screen space like the scanline rasterizer
+	double ux = p[1].x - p[0].x, uy = p[1].y - p[0].y, uz = p[1].z - p[0].z;
+	double vx = p[2].x - p[0].x, vy = p[2].y - p[0].y, vz = p[2].z - p[0].z;
+	double det = ux * vy - uy * vx;
+	if (det == 0)
+		return;
+	double dzdx = (uz * vy - vz * uy) / det;
+	double dzdy = (vz * ux - uz * vx) / det;
+	double z_origin = p[0].z + dzdx * (0.5 - p[0].x) + dzdy * (0.5 - p[0].y);
+	// Pixel centers just outside the triangle's edges extrapolate the plane, keep them within the vertices' depths
+	// so the nearest vertex stays the nearest point the occlusion test has to consider
+	double z_min = std::min({ p[0].z, p[1].z, p[2].z });
+	double z_max = std::max({ p[0].z, p[1].z, p[2].z });
+
+	// Locals so the stores into the buffers don't force reloading the members
+	Stored* depth_buffer = (Stored*)this->depth_buffer;
+	U32* target = region.target;
+	size_t width = this->width;
+
+	// Single pixel test, used where a block doesn't fit in the region
+	auto shadePixel = [&](I64 x, I64 y, I32 e0, I32 e1, I32 e2) -> bool {
+		if ((e0 | e1 | e2) < 0)
+			return false;
+		Depth depth = (Depth)std::min(std::max(z_origin + dzdx * x + dzdy * y, z_min), z_max);
+		IF_RENDER_STATS(region.pixels_tested++);
+		size_t index = (size_t)y * width + x;
+		Stored stored = format.encode(depth);
+		if (Format::passes(stored, depth_buffer[index])) {
+			depth_buffer[index] = stored;
+			target[index] = shader.shade(x, y);
+			IF_RENDER_STATS(region.pixels_written++);
+			return true;
+		}
+		return false;
+	};
+
+#ifdef EDGE_RASTER_SSE2
+	typedef DepthLanes<Depth> Lanes;
+	typedef StoredLanes<Format> Encoded;
+	const Lanes depth_group_step = Lanes::set1((Depth)(dzdx * 4));
+	const Lanes depth_row_step = Lanes::set1((Depth)dzdy);
+	// A constant shader's color is the same for every group
+	const __m128i constant_lanes = _mm_set1_epi32(Shader::CONSTANT ? (int)shader.shade(0, 0) : 0);
+	const __m128i all_set = _mm_set1_epi32(-1);
+	const Lanes z_min_lanes = Lanes::set1((Depth)z_min);
+	const Lanes z_max_lanes = Lanes::set1((Depth)z_max);
+#endif
+
+	for (I64 by = box_min_y & ~(BLOCK_SIZE - 1); by <= box_max_y; by += BLOCK_SIZE) {
+		for (I64 bx = box_min_x & ~(BLOCK_SIZE - 1); bx <= box_max_x; bx += BLOCK_SIZE) {
+			// Test the block's corners against each edge, skip it if it's fully outside of one,
+			// edges the block is fully inside of don't need to be tested per pixel
+			I32 block_value[3], block_step_x[3], block_step_y[3];
+			bool outside = false;
+			bool inside = true;
+			for (U32 i = 0; i < 3; i++) {
+				I64 value = origin[i] + step_x[i] * bx + step_y[i] * by;
+				I64 far_x = step_x[i] * (BLOCK_SIZE - 1);
+				I64 far_y = step_y[i] * (BLOCK_SIZE - 1);
+				I64 highest = value + std::max<I64>(far_x, 0) + std::max<I64>(far_y, 0);
+				I64 lowest = value + std::min<I64>(far_x, 0) + std::min<I64>(far_y, 0);
+				if (highest < 0) {
+					outside = true;
+					break;
+				}
+				if (lowest >= 0) {
+					block_value[i] = 0;
+					block_step_x[i] = 0;
+					block_step_y[i] = 0;
+				}
+				else {
+					inside = false;
+					block_value[i] = (I32)value;
+					block_step_x[i] = (I32)step_x[i];
+					block_step_y[i] = (I32)step_y[i];
+				}
+			}
+			if (outside)
+				continue;
+
+			I64 row_start = std::max(by, box_min_y);
+			I64 row_end = std::min(by + BLOCK_SIZE, box_max_y + 1);
+			bool written = false;
+#ifdef EDGE_RASTER_SSE2
+			// Whole block rows of 2 groups of 4 pixels inside the region take the SIMD path
+			if (bx >= region.min_x && bx + BLOCK_SIZE <= region.max_x) {
+				// Edge values and depths of the first group of the first row, stepped per group and per row
+				__m128i w_row[3], w_group_step[3], w_row_step[3];
+				for (U32 i = 0; i < 3; i++) {
+					I32 start = block_value[i] + block_step_y[i] * (I32)(row_start - by);
+					w_row[i] = _mm_setr_epi32(start, start + block_step_x[i], start + block_step_x[i] * 2, start + block_step_x[i] * 3);
+					w_group_step[i] = _mm_set1_epi32(block_step_x[i] * 4);
+					w_row_step[i] = _mm_set1_epi32(block_step_y[i]);
+				}
+				double depth_start = z_origin + dzdx * bx + dzdy * row_start;
+				Lanes z_row = Lanes::setr((Depth)depth_start, (Depth)(depth_start + dzdx), (Depth)(depth_start + dzdx * 2), (Depth)(depth_start + dzdx * 3));
+
+				for (I64 y = row_start; y < row_end; y++) {
+					__m128i w0 = w_row[0], w1 = w_row[1], w2 = w_row[2];
+					Lanes z = z_row;
+					size_t index = (size_t)y * width + bx;
+
+					for (I64 group = 0; group < BLOCK_SIZE; group += 4, index += 4) {
+						// Coverage of the 4 pixels, the sign bit of any edge value rejects a pixel
+						__m128i covered = all_set;
+						if (!inside) {
+							covered = _mm_cmpgt_epi32(_mm_or_si128(_mm_or_si128(w0, w1), w2), all_set);
+							w0 = _mm_add_epi32(w0, w_group_step[0]);
+							w1 = _mm_add_epi32(w1, w_group_step[1]);
+							w2 = _mm_add_epi32(w2, w_group_step[2]);
+						}
+						Lanes group_z = z.clamp(z_min_lanes, z_max_lanes);
+						z = z.add(depth_group_step);
+						if (!inside && _mm_movemask_epi8(covered) == 0)
+							continue;
+
+						// In front of the previous depth on a covered pixel
+						Encoded old_z = Encoded::load(depth_buffer + index);
+						Encoded new_z = Encoded::encode(format, group_z);
+						__m128i pass = _mm_and_si128(new_z.passes(old_z), covered);
+						IF_RENDER_STATS(region.pixels_tested += MASK_BITS[_mm_movemask_ps(_mm_castsi128_ps(covered))]);
+						int pass_bits = _mm_movemask_ps(_mm_castsi128_ps(pass));
+						if (pass_bits == 0)
+							continue;
+						written = true;
+						IF_RENDER_STATS(region.pixels_written += MASK_BITS[pass_bits]);
+
+						new_z.select(pass, old_z).store(depth_buffer + index);
+
+						__m128i value_lanes = constant_lanes;
+						if constexpr (!Shader::CONSTANT) {
+							I64 x = bx + group;
+							value_lanes = _mm_setr_epi32((int)shader.shade(x, y), (int)shader.shade(x + 1, y), (int)shader.shade(x + 2, y),
+								(int)shader.shade(x + 3, y));
+						}
+						__m128i* pixels = (__m128i*)(target + index);
+						__m128i old_value = _mm_loadu_si128(pixels);
+						_mm_storeu_si128(pixels, _mm_or_si128(_mm_and_si128(pass, value_lanes), _mm_andnot_si128(pass, old_value)));
+					}
+
+					for (U32 i = 0; i < 3; i++)
+						w_row[i] = _mm_add_epi32(w_row[i], w_row_step[i]);
+					z_row = z_row.add(depth_row_step);
+				}
+				if (written)
+					this->markWritten(region, bx, bx, by);
+				continue;
+			}
+#endif
+
+			// Block sticks out of the region or no SIMD, one pixel at a time
+			for (I64 y = row_start; y < row_end; y++) {
+				for (I64 x = std::max(bx, region.min_x); x < std::min(bx + BLOCK_SIZE, region.max_x); x++) {
+					I32 dx = (I32)(x - bx), dy = (I32)(y - by);
+					written |= shadePixel(x, y, block_value[0] + block_step_x[0] * dx + block_step_y[0] * dy,
+						block_value[1] + block_step_x[1] * dx + block_step_y[1] * dy,
+						block_value[2] + block_step_x[2] * dx + block_step_y[2] * dy);
+				}
+			}
+			if (written)
+				this->markWritten(region, std::max(bx, region.min_x), std::max(bx, region.min_x), by);
+		}
+	}
+}
+
+#define INSTANTIATE_EDGES(Precision, Format, Shader) \
+	template void BasicRender3DLayer<Precision>::rasterizeTriEdges(const Format<Precision::Depth>&, const ScreenTri<Precision>&, const Shader&, RasterRegion&);
+#define INSTANTIATE_EDGES_SHADERS(Precision, Format) \
+	INSTANTIATE_EDGES(Precision, Format, FlatShader) \
+	INSTANTIATE_EDGES(Precision, Format, GouraudShader) \
+	INSTANTIATE_EDGES(Precision, Format, TexturedShader<false>) \
+	INSTANTIATE_EDGES(Precision, Format, TexturedShader<true>)
+#define INSTANTIATE_EDGES_FORMATS(Precision) \
+	INSTANTIATE_EDGES_SHADERS(Precision, LinearDepth) \
+	INSTANTIATE_EDGES_SHADERS(Precision, ReversedFloatDepth) \
+	INSTANTIATE_EDGES_SHADERS(Precision, Unorm24Depth) \
+	INSTANTIATE_EDGES_SHADERS(Precision, Unorm16Depth)
+INSTANTIATE_EDGES_FORMATS(DoublePrecision)
+INSTANTIATE_EDGES_FORMATS(FloatPrecision)
+INSTANTIATE_EDGES_FORMATS(FixedPrecision)
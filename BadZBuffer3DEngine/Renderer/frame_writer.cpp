@@ -0,0 +1,154 @@
+#include "frame_writer.hpp"
+
+FrameWriter::FrameWriter(U32 writer_threads, U32 queue_size) {
+	this->queue_size = std::max<U32>(queue_size, 1);
+	for (U32 t = 0; t < std::max<U32>(writer_threads, 1); t++)
+		this->writers.emplace_back([this] { this->work(); });
+}
+
+FrameWriter::~FrameWriter() {
+	this->finish();
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->stopping = true;
+	}
+	this->job_ready.notify_all();
+	for (std::thread& writer : this->writers)
+		writer.join();
+	for (U32* buffer : this->free_buffers)
+		delete[] buffer;
+}
+
+U32* FrameWriter::acquireBuffer(U32 width, U32 height) {
+	std::unique_lock<std::mutex> lock(this->mutex);
+	if (width != this->pool_width || height != this->pool_height) {
+		for (U32* buffer : this->free_buffers)
+			delete[] buffer;
+		this->free_buffers.clear();
+		this->pool_width = width;
+		this->pool_height = height;
+	}
+
+	// Allocate while there are fewer buffers than the queue holds, otherwise wait for one to come back
+	if (this->free_buffers.empty() && this->jobs.size() + this->writing >= this->queue_size) {
+		U64 wait_start = astd::getNanos();
+		this->slot_free.wait(lock, [this] { return !this->free_buffers.empty() || this->jobs.size() + this->writing < this->queue_size; });
+		this->wait_ns += astd::getNanos() - wait_start;
+	}
+	if (!this->free_buffers.empty()) {
+		U32* buffer = this->free_buffers.back();
+		this->free_buffers.pop_back();
+		return buffer;
+	}
+	return new U32[(size_t)width * height];
+}
+
+void FrameWriter::write(U32* buffer, U32 width, U32 height, const fs::path& path, FrameFormat format) {
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		if (this->jobs.size() + this->writing >= this->queue_size) {
+			U64 wait_start = astd::getNanos();
+			this->slot_free.wait(lock, [this] { return this->jobs.size() + this->writing < this->queue_size; });
+			this->wait_ns += astd::getNanos() - wait_start;
+		}
+		this->jobs.push_back(Job{ buffer, width, height, path, format });
+	}
+	this->job_ready.notify_one();
+}
+
+void FrameWriter::finish() {
+	std::unique_lock<std::mutex> lock(this->mutex);
+	this->idle.wait(lock, [this] { return this->jobs.empty() && this->writing == 0; });
+}
+
+U64 FrameWriter::getWrittenCount() {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->written;
+}
+
+U64 FrameWriter::getFailedCount() {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->failed;
+}
+
+U64 FrameWriter::getWaitNanos() {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->wait_ns;
+}
+
+const char* FrameWriter::getExtension(FrameFormat format) {
+	switch (format) {
+	case FrameFormat::PPM:
+		return "ppm";
+	case FrameFormat::PNG:
+		return "png";
+	default:
+		return "raw";
+	}
+}
+
+void FrameWriter::work() {
+	std::vector<U8> scratch;
+	std::unique_lock<std::mutex> lock(this->mutex);
+	while (true) {
+		this->job_ready.wait(lock, [this] { return this->stopping || !this->jobs.empty(); });
+		if (this->jobs.empty())
+			return;
+		Job job = std::move(this->jobs.front());
+		this->jobs.pop_front();
+		this->writing++;
+		lock.unlock();
+
+		bool success = writeFrame(job, scratch);
+
+		lock.lock();
+		this->writing--;
+		if (success)
+			this->written++;
+		else
+			this->failed++;
+		// Buffers of an old size aren't worth keeping
+		if (job.width == this->pool_width && job.height == this->pool_height)
+			this->free_buffers.push_back(job.buffer);
+		else
+			delete[] job.buffer;
+		this->slot_free.notify_all();
+		if (this->jobs.empty() && this->writing == 0)
+			this->idle.notify_all();
+	}
+}
+
+bool FrameWriter::writeFrame(const Job& job, std::vector<U8>& scratch) {
+	size_t pixel_count = (size_t)job.width * job.height;
+
+	if (job.format == FrameFormat::PNG) {
+		sf::Image image;
+		image.create(job.width, job.height, (const U8*)job.buffer);
+		return image.saveToFile(job.path.string());
+	}
+
+	std::ofstream fout(job.path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!fout.is_open())
+		return false;
+
+	if (job.format == FrameFormat::Raw) {
+		fout.write((const char*)job.buffer, pixel_count * sizeof(U32));
+		// Closing flushes the last of the frame, which can fail too
+		fout.close();
+		return fout.good();
+	}
+
+	// Red is the lowest byte of a color, the way sf::Texture reads the buffer
+	std::string header = "P6\n" + std::to_string(job.width) + " " + std::to_string(job.height) + "\n255\n";
+	scratch.resize(pixel_count * 3);
+	for (size_t p = 0; p < pixel_count; p++) {
+		U32 color = job.buffer[p];
+		scratch[p * 3] = (U8)color;
+		scratch[p * 3 + 1] = (U8)(color >> 8);
+		scratch[p * 3 + 2] = (U8)(color >> 16);
+	}
+	fout.write(header.data(), header.size());
+	fout.write((const char*)scratch.data(), scratch.size());
+	fout.close();
+	return fout.good();
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include "../astd.hpp"
+#include <deque>
+
+// File formats FrameWriter can write a frame in
+enum class FrameFormat {
+	PPM, // Binary P6, RGB without the alpha
+	PNG, // RGBA, encoded by sf::Image
+	Raw // The buffer's bytes as they are with no header, RGBA on little endian machines like sf::Texture reads them
+};
+
+// Writes finished frames to disk on background threads, so rendering only waits when the writers fall behind
+// Frames go around a pool of buffers: acquireBuffer() hands out a free one, which replaces a layer's render_buffer
+// through swapRenderBuffer(), write() queues the finished one and the writers return it to the pool once it's on disk
+// At most queue_size frames wait or are being written at once, write() and acquireBuffer() block past that
+class FrameWriter {
+public:
+	explicit FrameWriter(U32 writer_threads = 2, U32 queue_size = 4);
+	FrameWriter(const FrameWriter&) = delete;
+	FrameWriter& operator=(const FrameWriter&) = delete;
+	// Writes every queued frame before stopping the writers
+	~FrameWriter();
+
+	// Free width * height buffer allocated with new[], its content is undefined
+	// Buffers of the pool with another size are freed, so the pool follows the size of the frames
+	U32* acquireBuffer(U32 width, U32 height);
+	// Queues a width * height buffer allocated with new[] to be written to the path, the writer owns it from then on
+	void write(U32* buffer, U32 width, U32 height, const fs::path& path, FrameFormat format);
+	// Waits until every queued frame is written
+	void finish();
+
+	// Frames written and frames whose file couldn't be written so far
+	U64 getWrittenCount();
+	U64 getFailedCount();
+	// Nanoseconds write() and acquireBuffer() spent waiting for the writers so far
+	U64 getWaitNanos();
+
+	// File extension of the format, without the dot
+	static const char* getExtension(FrameFormat format);
+
+private:
+	struct Job {
+		U32* buffer;
+		U32 width, height;
+		fs::path path;
+		FrameFormat format;
+	};
+
+	U32 queue_size;
+	std::vector<std::thread> writers;
+	std::mutex mutex;
+	std::condition_variable job_ready, slot_free, idle;
+	std::deque<Job> jobs;
+	U32 writing = 0; // Jobs taken by a writer and not done yet
+	bool stopping = false;
+
+	std::vector<U32*> free_buffers; // All of pool_width * pool_height
+	U32 pool_width = 0, pool_height = 0;
+
+	U64 written = 0, failed = 0;
+	U64 wait_ns = 0;
+
+	void work();
+	// Writes the frame's file, scratch keeps the converted pixels between frames, returns if it went successful
+	static bool writeFrame(const Job& job, std::vector<U8>& scratch);
+};
@@ -0,0 +1,106 @@
+#include "mapped_file.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+	this->close();
+}
+
+bool MappedFile::open(const fs::path& path) {
+	this->close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size)) {
+		CloseHandle(file);
+		return false;
+	}
+	this->file_handle = file;
+	this->size = (size_t)file_size.QuadPart;
+
+	// Mapping an empty file fails, it's simply left without data
+	if (this->size != 0) {
+		HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL) {
+			this->close();
+			return false;
+		}
+		this->mapping_handle = mapping;
+		this->data = (const U8*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (this->data == NULL) {
+			this->close();
+			return false;
+		}
+	}
+#else
+	int file = ::open(path.c_str(), O_RDONLY);
+	if (file < 0)
+		return false;
+	struct stat info;
+	if (fstat(file, &info) != 0) {
+		::close(file);
+		return false;
+	}
+	this->descriptor = file;
+	this->size = (size_t)info.st_size;
+
+	if (this->size != 0) {
+		void* view = mmap(NULL, this->size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (view == MAP_FAILED) {
+			this->close();
+			return false;
+		}
+		// Files are read front to back, let the OS read ahead aggressively
+		madvise(view, this->size, MADV_SEQUENTIAL);
+		this->data = (const U8*)view;
+	}
+#endif
+
+	this->opened = true;
+	return true;
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+	if (this->data != NULL)
+		UnmapViewOfFile(this->data);
+	if (this->mapping_handle != NULL)
+		CloseHandle((HANDLE)this->mapping_handle);
+	if (this->file_handle != NULL)
+		CloseHandle((HANDLE)this->file_handle);
+	this->mapping_handle = NULL;
+	this->file_handle = NULL;
+#else
+	if (this->data != NULL)
+		munmap((void*)this->data, this->size);
+	if (this->descriptor >= 0)
+		::close(this->descriptor);
+	this->descriptor = -1;
+#endif
+	this->data = NULL;
+	this->size = 0;
+	this->opened = false;
+}
+
+bool MappedFile::isOpen() const {
+	return this->opened;
+}
+
+const U8* MappedFile::getData() const {
+	return this->data;
+}
+
+size_t MappedFile::getSize() const {
+	return this->size;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include "../astd.hpp"
+
+// Read-only memory map of a whole file, pages are loaded by the OS as they're touched
+class MappedFile {
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	// Maps the file, closing the previous one, returns if it went successful
+	bool open(const fs::path& path);
+	void close();
+
+	bool isOpen() const;
+	// NULL for an empty file
+	const U8* getData() const;
+	size_t getSize() const;
+
+private:
+	const U8* data = NULL;
+	size_t size = 0;
+	bool opened = false;
+#ifdef _WIN32
+	void* file_handle = NULL;
+	void* mapping_handle = NULL;
+#else
+	int descriptor = -1;
+#endif
+};
@@ -6,27 +6,37 @@ using std::cos;
 using std::tan;
 using std::pow;
 
-struct Point2 {
-	double x = 0;
-	double y = 0;
+// Points are templated on their scalar type so the screen space part of the renderer can run on other precisions,
+// the world space math and transforms stay in double
+template <class T>
+struct BasicPoint2 {
+	T x = 0;
+	T y = 0;
 };
 
-struct Point3 {
-	double x = 0;
-	double y = 0;
-	double z = 0;
+template <class T>
+struct BasicPoint3 {
+	T x = 0;
+	T y = 0;
+	T z = 0;
 };
 
-inline double dot(Point3 a, Point3 b) {
+typedef BasicPoint2<double> Point2;
+typedef BasicPoint3<double> Point3;
+
+template <class T>
+inline T dot(BasicPoint3<T> a, BasicPoint3<T> b) {
 	return a.x * b.x + a.y * b.y + a.z * b.z;
 }
 
-inline double dot(Point2 a, Point2 b) {
+template <class T>
+inline T dot(BasicPoint2<T> a, BasicPoint2<T> b) {
 	return a.x * b.x + a.y * b.y;
 }
 
-inline Point3 cross(Point3 a, Point3 b) {
-	return Point3{ a.y * b.z - a.z * b.y,
+template <class T>
+inline BasicPoint3<T> cross(BasicPoint3<T> a, BasicPoint3<T> b) {
+	return BasicPoint3<T>{ a.y * b.z - a.z * b.y,
 		a.z * b.x - a.x * b.z,
 		a.x * b.y - a.y * b.x };
 }
@@ -40,9 +50,10 @@ inline double toFov(double degree) {
 }
 
 // Rotates point in 3D from the 0, 0, 0 origin
-inline Point3 rotate3D(Point3 point, double s_yaw, double c_yaw, double s_pitch, double c_pitch, double s_roll, double c_roll) {
-	double old_x = point.x;
-	double old_y = point.y;
+template <class T>
+inline BasicPoint3<T> rotate3D(BasicPoint3<T> point, T s_yaw, T c_yaw, T s_pitch, T c_pitch, T s_roll, T c_roll) {
+	T old_x = point.x;
+	T old_y = point.y;
 
 	// Rotation matrix for the yaw and pitch rotations
 	point.x = point.x * c_yaw + point.z * s_yaw;
@@ -59,9 +70,70 @@ inline Point3 rotate3D(Point3 point, double s_yaw, double c_yaw, double s_pitch,
 	return point;
 }
 
+// Affine transform as a row-major 3x4 matrix, the last column is the translation
+struct Transform3 {
+	double m[3][4] = { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 } };
+};
+
+inline Point3 transformPoint(const Transform3& t, Point3 point) {
+	return Point3{ t.m[0][0] * point.x + t.m[0][1] * point.y + t.m[0][2] * point.z + t.m[0][3],
+		t.m[1][0] * point.x + t.m[1][1] * point.y + t.m[1][2] * point.z + t.m[1][3],
+		t.m[2][0] * point.x + t.m[2][1] * point.y + t.m[2][2] * point.z + t.m[2][3] };
+}
+
+// Combines 2 transforms, the result applies inner first and then outer
+inline Transform3 combine(const Transform3& outer, const Transform3& inner) {
+	Transform3 ret;
+	for (U32 row = 0; row < 3; row++) {
+		for (U32 col = 0; col < 4; col++) {
+			ret.m[row][col] = outer.m[row][0] * inner.m[0][col] + outer.m[row][1] * inner.m[1][col] + outer.m[row][2] * inner.m[2][col];
+			if (col == 3)
+				ret.m[row][col] += outer.m[row][3];
+		}
+	}
+	return ret;
+}
+
+inline Transform3 translation3D(Point3 offset) {
+	Transform3 ret;
+	ret.m[0][3] = offset.x;
+	ret.m[1][3] = offset.y;
+	ret.m[2][3] = offset.z;
+	return ret;
+}
+
+inline Transform3 scale3D(Point3 scale) {
+	Transform3 ret;
+	ret.m[0][0] = scale.x;
+	ret.m[1][1] = scale.y;
+	ret.m[2][2] = scale.z;
+	return ret;
+}
+
+// The same rotation as rotate3D as a matrix, built by rotating each axis
+inline Transform3 rotation3D(double s_yaw, double c_yaw, double s_pitch, double c_pitch, double s_roll, double c_roll) {
+	Point3 axis_x = rotate3D(Point3{ 1, 0, 0 }, s_yaw, c_yaw, s_pitch, c_pitch, s_roll, c_roll);
+	Point3 axis_y = rotate3D(Point3{ 0, 1, 0 }, s_yaw, c_yaw, s_pitch, c_pitch, s_roll, c_roll);
+	Point3 axis_z = rotate3D(Point3{ 0, 0, 1 }, s_yaw, c_yaw, s_pitch, c_pitch, s_roll, c_roll);
+
+	Transform3 ret;
+	ret.m[0][0] = axis_x.x; ret.m[0][1] = axis_y.x; ret.m[0][2] = axis_z.x;
+	ret.m[1][0] = axis_x.y; ret.m[1][1] = axis_y.y; ret.m[1][2] = axis_z.y;
+	ret.m[2][0] = axis_x.z; ret.m[2][1] = axis_y.z; ret.m[2][2] = axis_z.z;
+	return ret;
+}
+
+// Rotation matrix from yaw, pitch and roll in degrees
+inline Transform3 rotation3D(Point3 degrees) {
+	return rotation3D(sin(toRadian(degrees.x)), cos(toRadian(degrees.x)),
+		sin(toRadian(degrees.y)), cos(toRadian(degrees.y)),
+		sin(toRadian(degrees.z)), cos(toRadian(degrees.z)));
+}
+
 // Rotates point in 2D from the origin 0, 0
-inline Point2 rotate2D(Point2 point, double s, double c) {
-	return Point2{ point.x * c + point.y * s, point.x * -s + point.y * c };
+template <class T>
+inline BasicPoint2<T> rotate2D(BasicPoint2<T> point, T s, T c) {
+	return BasicPoint2<T>{ point.x * c + point.y * s, point.x * -s + point.y * c };
 }
 
 // Otherwise known as linear lerp
@@ -73,33 +145,35 @@ inline double remap(double x, double a_min, double a_max, double b_min, double b
 }
 
 // Check if the points are drawn clockwise
-inline bool isClockwise(Point2 a, Point2 b, Point2 c) {
+template <class T>
+inline bool isClockwise(BasicPoint2<T> a, BasicPoint2<T> b, BasicPoint2<T> c) {
 	return (c.y - a.y) * (b.x - a.x) < (b.y - a.y) * (c.x - a.x);
 }
 
 // Checks if 2 lines intersect, optional intersection_point pointer to get the intersection point if they did intersect
-inline bool getLineIntersection(Point2 a, Point2 b, Point2 c, Point2 d, Point2* intersection_point = NULL) {
-	Point2 s1{ b.x - a.x, b.y - a.y };
-	Point2 s2{ d.x - c.x, d.y - c.y };
+template <class T>
+inline bool getLineIntersection(BasicPoint2<T> a, BasicPoint2<T> b, BasicPoint2<T> c, BasicPoint2<T> d, BasicPoint2<T>* intersection_point = NULL) {
+	BasicPoint2<T> s1{ b.x - a.x, b.y - a.y };
+	BasicPoint2<T> s2{ d.x - c.x, d.y - c.y };
 
 	// Don't Repeat Yourself x3, performance boost x3
-	double dry1 = a.x - c.x;
-	double dry2 = a.y - c.y;
-	double dry3 = -s2.x * s1.y + s1.x * s2.y;
+	T dry1 = a.x - c.x;
+	T dry2 = a.y - c.y;
+	T dry3 = -s2.x * s1.y + s1.x * s2.y;
 
 	// This happens if the points are the same
 	if (dry3 == 0) {
 		if (intersection_point != NULL)
-			*intersection_point = Point2{ (a.x + b.x) / 2, (a.y + b.y) / 2 };
+			*intersection_point = BasicPoint2<T>{ (a.x + b.x) / 2, (a.y + b.y) / 2 };
 		return true;
 	}
 
-	double s = (-s1.y * dry1 + s1.x * dry2) / dry3;
-	double t = (s2.x * dry2 - s2.y * dry1) / dry3;
+	T s = (-s1.y * dry1 + s1.x * dry2) / dry3;
+	T t = (s2.x * dry2 - s2.y * dry1) / dry3;
 
 	if (s >= 0 && s <= 1 && t >= 0 && t <= 1) {
 		if (intersection_point != NULL)
-			*intersection_point = Point2{ a.x + (t * s1.x), a.y + (t * s1.y) };
+			*intersection_point = BasicPoint2<T>{ a.x + (t * s1.x), a.y + (t * s1.y) };
 		return true;
 	}
 	return false;
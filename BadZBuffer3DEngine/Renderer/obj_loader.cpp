@@ -0,0 +1,218 @@
+#include "obj_loader.hpp"
+#include "mapped_file.hpp"
+#include <charconv>
+#include <cstring>
+
+// Chunks smaller than this aren't worth a task of their own
+static const size_t MIN_CHUNK_SIZE = 1 << 18;
+// Triangle corner of a face that refers to a vertex that doesn't exist
+static const U32 INVALID_INDEX = 0xFFFFFFFF;
+
+// Part of the file made of whole lines, along with what it holds
+struct ObjChunk {
+	const char* begin;
+	const char* end;
+	size_t vertex_count = 0, tri_count = 0;
+	size_t vertex_base = 0, tri_base = 0; // Where the chunk's vertices and triangles go in the mesh
+	bool has_invalid = false;
+};
+
+static inline bool isBlank(char chr) {
+	return chr == ' ' || chr == '\t' || chr == '\r';
+}
+
+static inline const char* skipBlanks(const char* it, const char* end) {
+	while (it < end && isBlank(*it))
+		it++;
+	return it;
+}
+
+static inline const char* skipToken(const char* it, const char* end) {
+	while (it < end && !isBlank(*it))
+		it++;
+	return it;
+}
+
+// Checks if the line starts with the keyword followed by a blank, returns where the arguments start or NULL
+static inline const char* matchKeyword(const char* line, const char* end, char keyword) {
+	if (end - line < 2 || line[0] != keyword || !isBlank(line[1]))
+		return NULL;
+	return line + 2;
+}
+
+// Reads the next number of the line, 0 if it's missing or malformed
+static inline const char* readDouble(const char* it, const char* end, double& value) {
+	it = skipBlanks(it, end);
+	if (it < end && *it == '+')
+		it++;
+	value = 0;
+	std::from_chars_result result = std::from_chars(it, end, value);
+	if (result.ec != std::errc())
+		value = 0;
+	return skipToken(it, end);
+}
+
+// Runs a callback for every line of [begin, end) with the blanks at its start skipped
+template <class LineCallback>
+static void forEachLine(const char* begin, const char* end, const LineCallback& callback) {
+	const char* line = begin;
+	while (line < end) {
+		const char* line_end = (const char*)std::memchr(line, '\n', end - line);
+		if (line_end == NULL)
+			line_end = end;
+		callback(skipBlanks(line, line_end), line_end);
+		line = line_end + 1;
+	}
+}
+
+// Counts what a chunk holds without parsing any number, so every chunk knows where to put its data before parsing
+static void countChunk(ObjChunk& chunk) {
+	forEachLine(chunk.begin, chunk.end, [&](const char* line, const char* line_end) {
+		if (matchKeyword(line, line_end, 'v') != NULL) {
+			chunk.vertex_count++;
+			return;
+		}
+		const char* it = matchKeyword(line, line_end, 'f');
+		if (it == NULL)
+			return;
+		size_t corners = 0;
+		for (it = skipBlanks(it, line_end); it < line_end; it = skipBlanks(skipToken(it, line_end), line_end))
+			corners++;
+		if (corners >= 3)
+			chunk.tri_count += corners - 2;
+	});
+}
+
+// Parses a chunk straight into its part of the mesh, total_vertices is the vertex count of the whole file
+static void parseChunk(ObjChunk& chunk, IndexedMesh& mesh, size_t total_vertices) {
+	Point3* vertex = mesh.vertices.data() + chunk.vertex_base;
+	IndexedTri* tri = mesh.tris.data() + chunk.tri_base;
+	size_t vertices_before = chunk.vertex_base; // Vertices defined above the current line, for relative indices
+
+	// Position index of a corner such as "7", "-2", "7/3" or "7//5"
+	auto readIndex = [&](const char*& it, const char* end) -> U32 {
+		I64 index = 0;
+		std::from_chars_result result = std::from_chars(it, end, index);
+		it = skipBlanks(skipToken(it, end), end);
+		if (result.ec != std::errc() || index == 0)
+			return INVALID_INDEX;
+		I64 absolute = index > 0 ? index - 1 : (I64)vertices_before + index;
+		if (absolute < 0 || absolute >= (I64)total_vertices)
+			return INVALID_INDEX;
+		return (U32)absolute;
+	};
+
+	forEachLine(chunk.begin, chunk.end, [&](const char* line, const char* line_end) {
+		const char* it = matchKeyword(line, line_end, 'v');
+		if (it != NULL) {
+			Point3 point;
+			it = readDouble(it, line_end, point.x);
+			it = readDouble(it, line_end, point.y);
+			readDouble(it, line_end, point.z);
+			*vertex++ = point;
+			vertices_before++;
+			return;
+		}
+
+		it = matchKeyword(line, line_end, 'f');
+		if (it == NULL)
+			return;
+
+		// Count the corners first so a face with less than 3 takes no triangles, like when counting
+		size_t corners = 0;
+		for (const char* corner = skipBlanks(it, line_end); corner < line_end; corner = skipBlanks(skipToken(corner, line_end), line_end))
+			corners++;
+		if (corners < 3)
+			return;
+
+		// Fan from the first corner, a face with a bad corner keeps its triangles marked invalid so the counts still match
+		it = skipBlanks(it, line_end);
+		U32 first = readIndex(it, line_end);
+		U32 previous = readIndex(it, line_end);
+		bool valid = first != INVALID_INDEX && previous != INVALID_INDEX;
+		IndexedTri* face = tri;
+		for (size_t c = 2; c < corners; c++) {
+			U32 current = readIndex(it, line_end);
+			valid = valid && current != INVALID_INDEX;
+			size_t tri_index = (size_t)(tri - mesh.tris.data());
+			// Repeatable random color from the triangle's index
+			U32 hash = (U32)tri_index * 0x9E3779B1u;
+			hash ^= hash >> 15;
+			hash *= 0x85EBCA77u;
+			hash ^= hash >> 13;
+			*tri++ = IndexedTri{ first, previous, current, 0xFF000000 | (hash & 0xFFFFFF) };
+			previous = current;
+		}
+		if (!valid) {
+			for (; face < tri; face++)
+				face->a = INVALID_INDEX;
+			chunk.has_invalid = true;
+		}
+	});
+}
+
+IndexedMesh parseObj(const char* text, size_t size, U32 thread_count) {
+	IndexedMesh ret;
+	if (size == 0)
+		return ret;
+
+	if (thread_count == 0)
+		thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+	// A few chunks per thread evens out chunks that are heavier than the others, every chunk ends after a line break
+	size_t chunk_count = std::max<size_t>(1, std::min<size_t>((size_t)thread_count * 4, size / MIN_CHUNK_SIZE));
+	std::vector<ObjChunk> chunks;
+	chunks.reserve(chunk_count);
+	const char* end = text + size;
+	const char* chunk_begin = text;
+	for (size_t c = 1; c <= chunk_count && chunk_begin < end; c++) {
+		const char* chunk_end = c == chunk_count ? end : text + size / chunk_count * c;
+		if (chunk_end < chunk_begin)
+			chunk_end = chunk_begin;
+		const char* line_break = (const char*)std::memchr(chunk_end, '\n', end - chunk_end);
+		chunk_end = line_break == NULL ? end : line_break + 1;
+		ObjChunk chunk;
+		chunk.begin = chunk_begin;
+		chunk.end = chunk_end;
+		chunks.push_back(chunk);
+		chunk_begin = chunk_end;
+	}
+
+	astd::ThreadPool pool(std::min<U32>(thread_count, (U32)chunks.size()));
+	pool.parallelFor(chunks.size(), [&](U64 c) {
+		countChunk(chunks[c]);
+	});
+
+	size_t total_vertices = 0, total_tris = 0;
+	for (ObjChunk& chunk : chunks) {
+		chunk.vertex_base = total_vertices;
+		chunk.tri_base = total_tris;
+		total_vertices += chunk.vertex_count;
+		total_tris += chunk.tri_count;
+	}
+	ret.vertices.resize(total_vertices);
+	ret.tris.resize(total_tris);
+
+	pool.parallelFor(chunks.size(), [&](U64 c) {
+		parseChunk(chunks[c], ret, total_vertices);
+	});
+
+	// Drop the triangles of bad faces, only files with broken faces pay for it
+	bool has_invalid = false;
+	for (ObjChunk& chunk : chunks)
+		has_invalid = has_invalid || chunk.has_invalid;
+	if (has_invalid)
+		ret.tris.erase(std::remove_if(ret.tris.begin(), ret.tris.end(), [](const IndexedTri& tri) { return tri.a == INVALID_INDEX; }), ret.tris.end());
+
+	return ret;
+}
+
+IndexedMesh loadObjFile(sf::String file_name, bool* success, U32 thread_count) {
+	MappedFile file;
+	bool opened = file.open(fs::path(file_name.toWideString()));
+	if (success != NULL)
+		*success = opened;
+	if (!opened)
+		return IndexedMesh();
+	return parseObj((const char*)file.getData(), file.getSize(), thread_count);
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include "../astd.hpp"
+#include "renderer3d.hpp"
+
+// Parses OBJ text into an indexed mesh, on thread_count threads (0 for one per hardware thread)
+// Only the positions of "v" and "f" lines are used, faces may use the v/vt/vn forms, negative (relative) indices
+// and more than 3 corners, which are split into a fan. Faces referring to vertices that don't exist are skipped
+// Each face gets a random color, repeatable for the same file
+IndexedMesh parseObj(const char* text, size_t size, U32 thread_count = 0);
+
+// Memory maps the OBJ file and parses it with parseObj, success is set to whether the file could be opened
+IndexedMesh loadObjFile(sf::String file_name, bool* success = NULL, U32 thread_count = 0);
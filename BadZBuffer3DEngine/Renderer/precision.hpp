@@ -0,0 +1,48 @@
+#pragma once
+#include "../astd.hpp"
+
+// Number types of the screen space part of the renderer, picked per layer at compile time (see BasicRender3DLayer)
+// Screen holds the projected X and Y, Depth the projected depths and the values the depth format interpolates,
+// along with the depth buffer and the pyramid of the Linear format (see depth_format.hpp)
+// Meshes, their transforms and the culling before the projection stay in double for every precision
+
+// Doubles everywhere, the reference the other precisions are compared against
+struct DoublePrecision {
+	typedef double Screen;
+	typedef double Depth;
+	// Screen coordinates are in 1 / 2^SUBPIXEL_BITS pixels
+	static const U32 SUBPIXEL_BITS = 0;
+
+	static const char* getName() { return "double"; }
+	static Screen toScreen(double pixels) { return pixels; }
+	static double toPixels(Screen value) { return value; }
+};
+
+// Floats halve the size of the vertex arrays, the depth buffer and the pyramid and double the SIMD lanes of the depth test
+// Depths keep about 7 significant digits, so surfaces closer than that at the far end can fight
+struct FloatPrecision {
+	typedef float Screen;
+	typedef float Depth;
+	static const U32 SUBPIXEL_BITS = 0;
+
+	static const char* getName() { return "float"; }
+	static Screen toScreen(double pixels) { return (float)pixels; }
+	static double toPixels(Screen value) { return value; }
+};
+
+// 28.4 fixed point screen coordinates, snapped once by the projection so the edge rasterizer uses them as they are,
+// with float depths
+struct FixedPrecision {
+	typedef I32 Screen;
+	typedef float Depth;
+	static const U32 SUBPIXEL_BITS = 4;
+	// Coordinates further than this many pixels from the origin are clamped to it so they fit in 28 bits,
+	// far past the guard band, so the triangles of clamped vertices are always clipped before they're rasterized
+	static constexpr double SCREEN_LIMIT = (double)(1 << 26);
+
+	static const char* getName() { return "fixed"; }
+	static Screen toScreen(double pixels) {
+		return (I32)std::lrint(std::min(std::max(pixels, -SCREEN_LIMIT), SCREEN_LIMIT) * (1 << SUBPIXEL_BITS));
+	}
+	static double toPixels(Screen value) { return value * (1.0 / (1 << SUBPIXEL_BITS)); }
+};
@@ -0,0 +1,121 @@
+#pragma once
+#include "../astd.hpp"
+#include "renderer3d.hpp"
+
+// Shows the frames of a layer rendered on a thread of its own
+// The layer renders the next frame into its render_buffer while the previous one is shown from a second buffer,
+// the two are swapped once a frame finishes, and the texture is updated straight from the shown buffer
+// Layer is one of the BasicRender3DLayer instantiations
+template <class Layer>
+class FramePresenter {
+public:
+	explicit FramePresenter(Layer& layer) : layer(layer) {
+		this->render_thread = std::thread([this] { this->renderLoop(); });
+	}
+
+	FramePresenter(const FramePresenter&) = delete;
+	FramePresenter& operator=(const FramePresenter&) = delete;
+
+	~FramePresenter() {
+		this->waitFrame();
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->stopping = true;
+		}
+		this->wake.notify_all();
+		this->render_thread.join();
+		delete[] this->front_buffer;
+	}
+
+	// Clears the layer to the color and renders it on the render thread, stats is filled there
+	// Neither the layer nor stats may be touched until waitFrame() returns
+	void startFrame(U32 clear_color, RenderStats* stats = NULL) {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->clear_color = clear_color;
+		this->stats = stats;
+		this->frame_pending = true;
+		this->wake.notify_all();
+	}
+
+	// Waits for the frame startFrame() began and takes it to be shown, returns the seconds its render took
+	double waitFrame() {
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->done.wait(lock, [this] { return !this->frame_pending && !this->rendering; });
+		}
+		if (!this->frame_ready)
+			return 0;
+		this->frame_ready = false;
+
+		// An unchanged frame is already shown, the layer keeps it and may skip rendering it again
+		if (this->front_buffer != NULL && this->layer.isFrameUnchanged() &&
+			this->front_width == this->layer.width && this->front_height == this->layer.height)
+			return this->render_seconds;
+
+		size_t size = (size_t)this->layer.width * this->layer.height;
+		if (this->front_buffer == NULL || this->front_width != this->layer.width || this->front_height != this->layer.height) {
+			delete[] this->front_buffer;
+			this->front_buffer = new U32[size];
+			this->front_width = this->layer.width;
+			this->front_height = this->layer.height;
+		}
+		this->front_buffer = this->layer.swapRenderBuffer(this->front_buffer);
+		this->texture_stale = true;
+		return this->render_seconds;
+	}
+
+	// Sprite showing the last frame waitFrame() took, the texture is updated on the first call after it
+	// Has to be called from the thread owning the window's context
+	const sf::Sprite& getSprite() {
+		if (this->texture_stale) {
+			sf::Vector2u size = this->texture.getSize();
+			if (size.x != this->front_width || size.y != this->front_height) {
+				this->texture.create(this->front_width, this->front_height);
+				this->sprite.setTexture(this->texture, true);
+			}
+			this->texture.update((const U8*)this->front_buffer);
+			this->texture_stale = false;
+		}
+		return this->sprite;
+	}
+
+private:
+	Layer& layer;
+	std::thread render_thread;
+	std::mutex mutex;
+	std::condition_variable wake, done;
+	bool frame_pending = false, rendering = false, stopping = false;
+	bool frame_ready = false; // A frame finished since the last waitFrame()
+	U32 clear_color = 0;
+	RenderStats* stats = NULL;
+	double render_seconds = 0;
+
+	U32* front_buffer = NULL; // The frame being shown, the layer renders into the other buffer
+	U32 front_width = 0, front_height = 0;
+	sf::Texture texture;
+	sf::Sprite sprite;
+	bool texture_stale = false;
+
+	void renderLoop() {
+		std::unique_lock<std::mutex> lock(this->mutex);
+		while (true) {
+			this->wake.wait(lock, [this] { return this->frame_pending || this->stopping; });
+			if (this->stopping)
+				return;
+			this->frame_pending = false;
+			this->rendering = true;
+			RenderStats* stats = this->stats;
+			U32 clear_color = this->clear_color;
+			lock.unlock();
+
+			double seconds = this->layer.clear(clear_color);
+			seconds += this->layer.render(stats);
+
+			lock.lock();
+			this->render_seconds = seconds;
+			this->rendering = false;
+			this->frame_ready = true;
+			this->done.notify_all();
+		}
+	}
+};
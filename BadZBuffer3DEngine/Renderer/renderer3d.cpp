@@ -1,139 +1,1746 @@
 #include "renderer3d.hpp"
+#include "cluster_stream.hpp"
+#include <unordered_map>
 
-Render3DLayer::Render3DLayer(U32 w, U32 h, double camera_fov, double far_clip, double near_clip) {
-	// Default constructor, assigns variables and allocate render_buffer
-	this->width = w;
-	this->height = h;
+FrameArena::~FrameArena() {
+	for (std::pair<U8*, size_t>& extra : this->overflow)
+		::operator delete(extra.first, std::align_val_t(64));
+	::operator delete(this->block, std::align_val_t(64));
+}
+
+void FrameArena::reset() {
+	if (!this->overflow.empty()) {
+		// The frame needed more than the main block, replace everything with one block of the frame's peak size
+		size_t peak = this->used + this->overflow_used;
+		for (std::pair<U8*, size_t>& extra : this->overflow)
+			::operator delete(extra.first, std::align_val_t(64));
+		this->overflow.clear();
+		::operator delete(this->block, std::align_val_t(64));
+		this->block = peak ? this->newBlock(peak) : NULL;
+		this->capacity = peak;
+	}
+	this->used = 0;
+	this->overflow_used = 0;
+}
+
+void* FrameArena::allocBytes(size_t size) {
+	size = (size + 63) & ~(size_t)63;
+	if (this->used + size <= this->capacity) {
+		void* ptr = this->block + this->used;
+		this->used += size;
+		return ptr;
+	}
+
+	// Out of space, serve it from a separate block until the next reset merges them
+	U8* extra = this->newBlock(size);
+	this->overflow.push_back({ extra, size });
+	this->overflow_used += size;
+	return extra;
+}
+
+U8* FrameArena::newBlock(size_t size) {
+	this->allocation_count++;
+	return (U8*)::operator new(size, std::align_val_t(64));
+}
+
+// Every buffer a layer allocates comes from here, counted into its allocation_count for getAllocationCount()
+template <class T>
+static T* newBuffer(U64& allocation_count, size_t count) {
+	allocation_count++;
+	return new T[count];
+}
+
+// Geometry ids are unique across every mesh, so a cache can't mistake one mesh for another
+static U64 newGeometryId() {
+	static std::atomic<U64> next_id(1);
+	return next_id++;
+}
+
+bool GeometryState::refresh(const void* points, size_t point_count, const void* tris, size_t tri_count) {
+	bool stale = this->refreshed_generation != this->generation || this->points != points || this->point_count != point_count;
+	if (stale || this->tris != tris || this->tri_count != tri_count) {
+		this->refreshed_generation = this->generation;
+		this->points = points;
+		this->point_count = point_count;
+		this->tris = tris;
+		this->tri_count = tri_count;
+		this->id = newGeometryId();
+	}
+	return stale;
+}
+
+const Bounds3& Mesh::getBounds() {
+	if (this->geometry.refresh(this->solid_tris.data(), this->solid_tris.size())) {
+		std::vector<Point3> corners;
+		corners.reserve(this->solid_tris.size() * 3);
+		for (const SolidTri& tri : this->solid_tris) {
+			corners.push_back(tri.a);
+			corners.push_back(tri.b);
+			corners.push_back(tri.c);
+		}
+		this->geometry.bounds = computeBounds(corners.data(), corners.size());
+	}
+	return this->geometry.bounds;
+}
+
+U64 Mesh::getGeometryId() {
+	this->getBounds();
+	return this->geometry.id;
+}
+
+void Mesh::invalidateGeometry() {
+	this->geometry.invalidate();
+}
+
+const Bounds3& CompactMesh::getBounds() {
+	if (this->geometry.refresh(this->corners.data(), this->corners.size())) {
+		std::vector<Point3> points(this->corners.size());
+		for (size_t c = 0; c < this->corners.size(); c++)
+			points[c] = this->getCorner(c);
+		this->geometry.bounds = computeBounds(points.data(), points.size());
+	}
+	return this->geometry.bounds;
+}
+
+U64 CompactMesh::getGeometryId() {
+	this->getBounds();
+	return this->geometry.id;
+}
+
+void CompactMesh::invalidateGeometry() {
+	this->geometry.invalidate();
+}
+
+double CompactMesh::getErrorBound() const {
+	return std::sqrt(dot(this->step, this->step)) / 2;
+}
+
+size_t CompactMesh::getMemorySize() const {
+	return this->corners.size() * sizeof(QuantizedPoint) + this->color_indices.size() * sizeof(U16) +
+		this->palette.size() * sizeof(U32) + this->colors.size() * sizeof(U32);
+}
+
+CompactMesh compressMesh(const Mesh& mesh) {
+	CompactMesh ret;
+	ret.position = mesh.position;
+	ret.rotation = mesh.rotation;
+	ret.cull_mode = mesh.cull_mode;
+	if (mesh.solid_tris.empty())
+		return ret;
+
+	Point3 min = mesh.solid_tris[0].a, max = min;
+	for (const SolidTri& tri : mesh.solid_tris) {
+		for (const Point3* corner : { &tri.a, &tri.b, &tri.c }) {
+			min = Point3{ std::min(min.x, corner->x), std::min(min.y, corner->y), std::min(min.z, corner->z) };
+			max = Point3{ std::max(max.x, corner->x), std::max(max.y, corner->y), std::max(max.z, corner->z) };
+		}
+	}
+	// A flat axis keeps a step of 0, every corner is at the origin on it
+	ret.origin = min;
+	ret.step = Point3{ (max.x - min.x) / 65535, (max.y - min.y) / 65535, (max.z - min.z) / 65535 };
+	auto quantize = [](double value, double origin, double step) -> U16 {
+		if (step == 0)
+			return 0;
+		return (U16)std::min(std::max(std::round((value - origin) / step), 0.0), 65535.0);
+	};
+	ret.corners.resize(mesh.solid_tris.size() * 3);
+	for (size_t t = 0; t < mesh.solid_tris.size(); t++) {
+		const SolidTri& tri = mesh.solid_tris[t];
+		const Point3* corners[3] = { &tri.a, &tri.b, &tri.c };
+		for (U32 c = 0; c < 3; c++)
+			ret.corners[t * 3 + c] = QuantizedPoint{ quantize(corners[c]->x, ret.origin.x, ret.step.x),
+				quantize(corners[c]->y, ret.origin.y, ret.step.y), quantize(corners[c]->z, ret.origin.z, ret.step.z) };
+	}
+
+	// Colors are numbered in the order they first appear, the palette is given up once it outgrows its indices
+	std::unordered_map<U32, U16> color_index;
+	ret.color_indices.resize(mesh.solid_tris.size());
+	for (size_t t = 0; t < mesh.solid_tris.size(); t++) {
+		auto found = color_index.find(mesh.solid_tris[t].color);
+		if (found == color_index.end()) {
+			if (ret.palette.size() == 65536) {
+				ret.color_indices.clear();
+				ret.palette.clear();
+				ret.colors.resize(mesh.solid_tris.size());
+				for (size_t c = 0; c < mesh.solid_tris.size(); c++)
+					ret.colors[c] = mesh.solid_tris[c].color;
+				break;
+			}
+			found = color_index.emplace(mesh.solid_tris[t].color, (U16)ret.palette.size()).first;
+			ret.palette.push_back(mesh.solid_tris[t].color);
+		}
+		ret.color_indices[t] = found->second;
+	}
+	return ret;
+}
+
+// Bounds of the vertices of an indexed mesh or a geometry, whose id covers their triangles too
+template <class Indexed>
+static const Bounds3& getIndexedBounds(Indexed& mesh, GeometryState& geometry) {
+	if (geometry.refresh(mesh.vertices.data(), mesh.vertices.size(), mesh.tris.data(), mesh.tris.size()))
+		geometry.bounds = computeBounds(mesh.vertices.data(), mesh.vertices.size());
+	return geometry.bounds;
+}
+
+const Bounds3& IndexedMesh::getBounds() {
+	return getIndexedBounds(*this, this->geometry);
+}
+
+U64 IndexedMesh::getGeometryId() {
+	this->getBounds();
+	return this->geometry.id;
+}
+
+void IndexedMesh::invalidateGeometry() {
+	this->geometry.invalidate();
+}
+
+const Bounds3& MeshGeometry::getBounds() {
+	return getIndexedBounds(*this, this->geometry);
+}
+
+U64 MeshGeometry::getGeometryId() {
+	this->getBounds();
+	return this->geometry.id;
+}
+
+void MeshGeometry::invalidateGeometry() {
+	this->geometry.invalidate();
+}
+
+std::shared_ptr<MeshGeometry> shareGeometry(IndexedMesh&& mesh) {
+	std::shared_ptr<MeshGeometry> geometry = std::make_shared<MeshGeometry>();
+	geometry->vertices = std::move(mesh.vertices);
+	geometry->tris = std::move(mesh.tris);
+	geometry->cull_mode = mesh.cull_mode;
+	geometry->lods = std::move(mesh.lods);
+	geometry->shading = mesh.shading;
+	geometry->vertex_colors = std::move(mesh.vertex_colors);
+	geometry->vertex_uvs = std::move(mesh.vertex_uvs);
+	geometry->texture = std::move(mesh.texture);
+	return geometry;
+}
+
+template <class Precision>
+BasicRender3DLayer<Precision>::BasicRender3DLayer(U32 w, U32 h, double camera_fov, double far_clip, double near_clip) {
+	// Default constructor, assigns variables and allocate render_buffer and the depth buffer
+	this->width = 0;
+	this->height = 0;
+	this->render_buffer = NULL;
 	this->fov = camera_fov;
 	this->far_clipping = far_clip;
 	this->near_clipping = near_clip;
-	this->render_buffer = new U32[(size_t)w * (size_t)h];
+	this->resize(w, h);
 }
 
-Render3DLayer::~Render3DLayer() {
-	// Deallocate render_buffer
+template <class Precision>
+BasicRender3DLayer<Precision>::~BasicRender3DLayer() {
+	// Deallocate the buffers and stop the rasterizer threads
 	delete[] this->render_buffer;
+	delete[] this->depth_buffer;
+	delete[] this->id_buffer;
+	delete[] this->hiz;
+	delete[] this->hiz_dirty;
+	delete this->thread_pool;
+	delete this->view_pool;
+	for (MeshCache& cache : this->mesh_cache) {
+		delete[] cache.vertex_x;
+		delete[] cache.vertex_y;
+		delete[] cache.vertex_z;
+	}
+	delete[] this->mesh_bounds;
+	delete[] this->mesh_shading;
+	delete[] this->assembled_tris;
+	delete[] this->assembled_tri_mesh;
+	delete[] this->assembled_tri_index;
+	delete[] this->assembled_tri_shade;
+	delete[] this->sorted_tris;
+	delete[] this->sorted_tri_mesh;
+	delete[] this->sorted_tri_index;
+	delete[] this->sorted_tri_shade;
 }
 
-double Render3DLayer::clear(U32 color) {
-	double start = astd::getTime();
+template <class Precision>
+void BasicRender3DLayer<Precision>::resize(U32 w, U32 h) {
+	if (this->render_buffer != NULL && w == this->width && h == this->height)
+		return;
+	this->width = w;
+	this->height = h;
+	delete[] this->render_buffer;
+	delete[] this->depth_buffer;
+	delete[] this->id_buffer;
+	delete[] this->hiz;
+	delete[] this->hiz_dirty;
+	this->id_buffer = NULL;
+	this->ids_valid = false;
+	this->render_buffer = newBuffer<U32>(this->allocation_count, (size_t)w * (size_t)h);
+
+	// Every level of the pyramid is half the size of the previous one, rounded up
+	size_t hiz_size = 0;
+	for (U32 level = 0; level < HIZ_LEVELS; level++) {
+		U32 cell_bits = HIZ_BLOCK_BITS + level;
+		this->hiz_width[level] = (w + (1 << cell_bits) - 1) >> cell_bits;
+		this->hiz_height[level] = (h + (1 << cell_bits) - 1) >> cell_bits;
+		this->hiz_offset[level] = hiz_size;
+		hiz_size += (size_t)this->hiz_width[level] * this->hiz_height[level];
+	}
+	this->hiz_dirty = newBuffer<U8>(this->allocation_count, (size_t)this->hiz_width[0] * this->hiz_height[0]);
+	for (size_t c = 0; c < (size_t)this->hiz_width[0] * this->hiz_height[0]; c++)
+		this->hiz_dirty[c] = 0;
+	this->buffer_format = this->depth_format;
+	this->depth_buffer = NULL;
+	this->hiz = NULL;
+	this->allocateDepth();
+	this->buffers_cleared = false;
+	this->buffers_hold_frame = false;
+	this->clear_pending = false;
+	this->last_frame_on_clear = false;
+}
+
+template <class Precision>
+double BasicRender3DLayer<Precision>::clear(U32 color) {
+	U64 start = astd::getNanos();
+	// The buffers may already hold the next frame, render() clears them if they don't
+	if (this->reuse_unchanged_frames && this->buffers_hold_frame && color == this->clear_color && this->depth_format == this->buffer_format)
+		this->clear_pending = true;
+	else
+		this->clearBuffers(color);
+	return (astd::getNanos() - start) / 1e9; // Returns total process time
+}
+
+template <class Precision>
+void BasicRender3DLayer<Precision>::clearBuffers(U32 color) {
+	if (this->depth_format != this->buffer_format) {
+		this->buffer_format = this->depth_format;
+		this->allocateDepth();
+	}
+
 	size_t size = (size_t)this->width * (size_t)this->height;
-	// Set every pixel into opaque black
+	// Set every pixel into the color and every depth to the farthest one
 	for (size_t p = 0; p < size; p++)
 		this->render_buffer[p] = color;
-	return astd::getTime() - start; // Returns total process time
+	this->dispatchDepth([&](const auto& format) {
+		typedef typename std::decay_t<decltype(format)>::Stored Stored;
+		Stored* depth_buffer = (Stored*)this->depth_buffer;
+		Stored* hiz = (Stored*)this->hiz;
+		for (size_t p = 0; p < size; p++)
+			depth_buffer[p] = format.clearValue();
+		size_t hiz_size = this->hiz_offset[HIZ_LEVELS - 1] + (size_t)this->hiz_width[HIZ_LEVELS - 1] * this->hiz_height[HIZ_LEVELS - 1];
+		for (size_t c = 0; c < hiz_size; c++)
+			hiz[c] = format.clearValue();
+	});
+	if (this->id_buffer != NULL)
+		for (size_t p = 0; p < size; p++)
+			this->id_buffer[p] = NO_TRIANGLE;
+	for (size_t c = 0; c < (size_t)this->hiz_width[0] * this->hiz_height[0]; c++)
+		this->hiz_dirty[c] = 0;
+	this->clear_color = color;
+	this->buffers_cleared = true;
+	this->buffers_hold_frame = false;
+	this->clear_pending = false;
 }
 
-double Render3DLayer::render() {
-	double start = astd::getTime();
-	// TRANSLATIONS RELATIVE TO THE CAMERA //
+template <class Precision>
+void BasicRender3DLayer<Precision>::allocateDepth() {
+	delete[] this->depth_buffer;
+	delete[] this->hiz;
+	size_t depth_size = getDepthSize<Depth>(this->buffer_format);
+	size_t hiz_size = this->hiz_offset[HIZ_LEVELS - 1] + (size_t)this->hiz_width[HIZ_LEVELS - 1] * this->hiz_height[HIZ_LEVELS - 1];
+	this->depth_buffer = newBuffer<U8>(this->allocation_count, (size_t)this->width * this->height * depth_size);
+	this->hiz = newBuffer<U8>(this->allocation_count, hiz_size * depth_size);
+	this->dispatchDepth([&](const auto& format) {
+		typedef typename std::decay_t<decltype(format)>::Stored Stored;
+		for (size_t c = 0; c < hiz_size; c++)
+			((Stored*)this->hiz)[c] = format.clearValue();
+	});
+	// The buffers no longer hold anything
+	this->buffers_cleared = false;
+	this->buffers_hold_frame = false;
+	this->last_frame_on_clear = false;
+}
+
+template <class Precision>
+void BasicRender3DLayer<Precision>::reserveFrame(size_t mesh_count, size_t tri_count) {
+	// Meshes removed from the end take their cache along
+	for (size_t m = mesh_count; m < this->mesh_cache.size(); m++) {
+		delete[] this->mesh_cache[m].vertex_x;
+		delete[] this->mesh_cache[m].vertex_y;
+		delete[] this->mesh_cache[m].vertex_z;
+	}
+	this->mesh_cache.resize(mesh_count);
 
-	// Precalculate the sine and cosine of the camera angles
-	double s_yaw_cam = sin(toRadian(-this->rotation.x));
-	double c_yaw_cam = cos(toRadian(-this->rotation.x));
+	if (mesh_count > this->mesh_capacity) {
+		delete[] this->mesh_bounds;
+		delete[] this->mesh_shading;
+		this->mesh_bounds = newBuffer<ScreenBounds>(this->allocation_count, mesh_count);
+		this->mesh_shading = newBuffer<Shading>(this->allocation_count, mesh_count);
+		this->mesh_capacity = mesh_count;
+	}
+	if (tri_count > this->tri_capacity)
+		this->growAssembled(tri_count, 0);
+}
 
-	double s_pitch_cam = sin(toRadian(-this->rotation.y));
-	double c_pitch_cam = cos(toRadian(-this->rotation.y));
+template <class Precision>
+void BasicRender3DLayer<Precision>::growAssembled(size_t tri_count, size_t kept) {
+	// Grow ahead so a few more triangles don't reallocate every frame
+	size_t capacity = std::max(tri_count, this->tri_capacity + this->tri_capacity / 2);
+	ScreenTri<Precision>* assembled_tris = newBuffer<ScreenTri<Precision>>(this->allocation_count, capacity);
+	U32* assembled_tri_mesh = newBuffer<U32>(this->allocation_count, capacity);
+	U32* assembled_tri_index = newBuffer<U32>(this->allocation_count, capacity);
+	U32* assembled_tri_shade = newBuffer<U32>(this->allocation_count, capacity);
+	std::copy(this->assembled_tris, this->assembled_tris + kept, assembled_tris);
+	std::copy(this->assembled_tri_mesh, this->assembled_tri_mesh + kept, assembled_tri_mesh);
+	std::copy(this->assembled_tri_index, this->assembled_tri_index + kept, assembled_tri_index);
+	std::copy(this->assembled_tri_shade, this->assembled_tri_shade + kept, assembled_tri_shade);
+	delete[] this->assembled_tris;
+	delete[] this->assembled_tri_mesh;
+	delete[] this->assembled_tri_index;
+	delete[] this->assembled_tri_shade;
+	delete[] this->sorted_tris;
+	delete[] this->sorted_tri_mesh;
+	delete[] this->sorted_tri_index;
+	delete[] this->sorted_tri_shade;
+	this->assembled_tris = assembled_tris;
+	this->assembled_tri_mesh = assembled_tri_mesh;
+	this->assembled_tri_index = assembled_tri_index;
+	this->assembled_tri_shade = assembled_tri_shade;
+	this->sorted_tris = newBuffer<ScreenTri<Precision>>(this->allocation_count, capacity);
+	this->sorted_tri_mesh = newBuffer<U32>(this->allocation_count, capacity);
+	this->sorted_tri_index = newBuffer<U32>(this->allocation_count, capacity);
+	this->sorted_tri_shade = newBuffer<U32>(this->allocation_count, capacity);
+	this->tri_capacity = capacity;
+}
 
-	double s_roll_cam = sin(toRadian(-this->rotation.z));
-	double c_roll_cam = cos(toRadian(-this->rotation.z));
+template <class Precision>
+void BasicRender3DLayer<Precision>::reserveVertices(MeshCache& cache, size_t count) {
+	if (count <= cache.capacity)
+		return;
+	delete[] cache.vertex_x;
+	delete[] cache.vertex_y;
+	delete[] cache.vertex_z;
+	cache.vertex_x = newBuffer<Screen>(this->allocation_count, count);
+	cache.vertex_y = newBuffer<Screen>(this->allocation_count, count);
+	cache.vertex_z = newBuffer<Depth>(this->allocation_count, count);
+	cache.capacity = count;
+}
+
+template <class Precision>
+U64 BasicRender3DLayer<Precision>::getAllocationCount() const {
+	return this->allocation_count + this->arena.allocation_count;
+}
+
+template <class Precision>
+U32* BasicRender3DLayer<Precision>::swapRenderBuffer(U32* buffer) {
+	U32* ret = this->render_buffer;
+	this->render_buffer = buffer;
+	// The new buffer doesn't hold the last frame, so a held back clear can't be skipped anymore
+	this->buffers_hold_frame = false;
+	if (this->clear_pending)
+		this->clearBuffers(this->clear_color);
+	return ret;
+}
 
-	std::vector<SolidTri> solid_tris;
+template <class Precision>
+bool BasicRender3DLayer<Precision>::isFrameUnchanged() const {
+	return this->frame_unchanged;
+}
+
+template <class Precision>
+const U32* BasicRender3DLayer<Precision>::getVisibilityBuffer() const {
+	return this->ids_valid ? this->id_buffer : NULL;
+}
+
+template <class Precision>
+bool BasicRender3DLayer<Precision>::pick(U32 x, U32 y, PickResult& result) const {
+	if (!this->ids_valid || x >= this->width || y >= this->height)
+		return false;
+	size_t index = (size_t)y * this->width + x;
+	U32 id = this->id_buffer[index];
+	if (id == NO_TRIANGLE)
+		return false;
+	result.mesh = this->projected_tri_mesh[id];
+	result.tri = this->projected_tri_index[id];
+	result.lod = this->mesh_cache[result.mesh].lod;
+	this->dispatchDepth([&](const auto& format) {
+		typedef typename std::decay_t<decltype(format)>::Stored Stored;
+		result.depth = format.toDepth(((const Stored*)this->depth_buffer)[index]);
+	});
+	return true;
+}
+
+// Points the scene mesh at the attributes of the mesh or geometry, leaving it flat if its shading lacks any of them
+template <class Source>
+static void setShading(SceneMesh& scene_mesh, const Source& source) {
+	size_t vertex_count = source.vertices.size();
+	const Texture* texture = source.texture.get();
+	switch (source.shading) {
+	case Shading::Gouraud:
+		if (source.vertex_colors.size() < vertex_count)
+			return;
+		scene_mesh.vertex_colors = &source.vertex_colors;
+		break;
+	case Shading::TexturedNearest:
+	case Shading::TexturedBilinear:
+		if (source.vertex_uvs.size() < vertex_count || texture == NULL || texture->width == 0 || texture->height == 0 ||
+			texture->pixels.size() < (size_t)texture->width * texture->height)
+			return;
+		scene_mesh.vertex_uvs = &source.vertex_uvs;
+		scene_mesh.texture = texture;
+		break;
+	default:
+		return;
+	}
+	scene_mesh.shading = source.shading;
+}
+
+template <class Precision>
+void BasicRender3DLayer<Precision>::gatherScene() {
+	// Streams get this layer's view in their own space and hand out what they have loaded, which the scene then holds
+	this->streamed_geometry.clear();
+	this->streamed_end.resize(this->streamed_meshes.size());
+	if (!this->streamed_meshes.empty()) {
+		Transform3 screen_transform = this->getScreenTransform();
+		Plane3 view_planes[6];
+		this->getViewPlanes(view_planes);
+		for (size_t s = 0; s < this->streamed_meshes.size(); s++) {
+			const StreamedMesh& streamed = this->streamed_meshes[s];
+			if (streamed.stream != NULL) {
+				Transform3 model = combine(translation3D(streamed.position), rotation3D(streamed.rotation));
+				Transform3 projection = combine(screen_transform, model);
+				Plane3 local_planes[6];
+				for (U32 p = 0; p < 6; p++)
+					local_planes[p] = planeToLocal(projection, view_planes[p]);
+				// The model only rotates and moves, so its inverse rotates by the transpose
+				Point3 offset = Point3{ this->position.x - model.m[0][3], this->position.y - model.m[1][3], this->position.z - model.m[2][3] };
+				Point3 camera = Point3{ model.m[0][0] * offset.x + model.m[1][0] * offset.y + model.m[2][0] * offset.z,
+					model.m[0][1] * offset.x + model.m[1][1] * offset.y + model.m[2][1] * offset.z,
+					model.m[0][2] * offset.x + model.m[1][2] * offset.y + model.m[2][2] * offset.z };
+				streamed.stream->setView(local_planes, 6, camera);
+				streamed.stream->getResident(this->streamed_geometry);
+			}
+			this->streamed_end[s] = this->streamed_geometry.size();
+		}
+	}
+
+	size_t mesh_count = this->meshes.size() + this->indexed_meshes.size() + this->instances.size() + this->compact_meshes.size() +
+		this->streamed_geometry.size();
+	this->scene.resize(mesh_count);
+	this->scene_order.resize(mesh_count);
+
+	U32 mesh_index = 0;
 	for (Mesh& mesh : this->meshes) {
-		// Precalculate the offset from the mesh
-		Point3 position_offset = Point3{ mesh.position.x - this->position.x, 
-			mesh.position.y - this->position.y, 
-			mesh.position.z - this->position.z };
+		SceneMesh& scene_mesh = this->scene[mesh_index];
+		scene_mesh = SceneMesh();
+		scene_mesh.model = combine(translation3D(mesh.position), rotation3D(mesh.rotation));
+		scene_mesh.bounds = &mesh.getBounds();
+		scene_mesh.geometry_id = mesh.getGeometryId();
+		scene_mesh.cull_mode = mesh.cull_mode;
+		scene_mesh.solid_tris = &mesh.solid_tris;
+		scene_mesh.tri_count = mesh.solid_tris.size();
+		this->scene_order[mesh_index] = mesh_index;
+		mesh_index++;
+	}
+	for (IndexedMesh& mesh : this->indexed_meshes) {
+		SceneMesh& scene_mesh = this->scene[mesh_index];
+		scene_mesh = SceneMesh();
+		scene_mesh.model = combine(translation3D(mesh.position), rotation3D(mesh.rotation));
+		scene_mesh.bounds = &mesh.getBounds();
+		scene_mesh.geometry_id = mesh.getGeometryId();
+		scene_mesh.cull_mode = mesh.cull_mode;
+		scene_mesh.vertices = &mesh.vertices;
+		scene_mesh.tris = &mesh.tris;
+		scene_mesh.lods = &mesh.lods;
+		scene_mesh.tri_count = mesh.tris.size();
+		setShading(scene_mesh, mesh);
+		this->scene_order[mesh_index] = mesh_index;
+		mesh_index++;
+	}
 
-		// Precalculate the sine and cosine of the mesh's rotation 
-		double s_yaw = sin(toRadian(mesh.rotation.x));
-		double c_yaw = cos(toRadian(mesh.rotation.x));
+	// Instances are visited grouped by geometry, so a geometry's bounds are looked up once
+	// and its vertices are projected for all of its instances in a row while they're in the cache
+	U32 first_instance = mesh_index;
+	U32 instance_end = first_instance + (U32)this->instances.size();
+	// Ties keep the list's order, sorting by index too instead of a stable sort that would need a buffer every frame
+	for (U32 i = first_instance; i < instance_end; i++)
+		this->scene_order[i] = i;
+	std::sort(this->scene_order.begin() + first_instance, this->scene_order.begin() + instance_end, [&](U32 a, U32 b) {
+		MeshGeometry* geometry_a = this->instances[a - first_instance].geometry.get();
+		MeshGeometry* geometry_b = this->instances[b - first_instance].geometry.get();
+		return geometry_a != geometry_b ? std::less<MeshGeometry*>()(geometry_a, geometry_b) : a < b;
+	});
+	MeshGeometry* batch_geometry = NULL;
+	const Bounds3* batch_bounds = NULL;
+	U64 batch_id = 0;
+	for (U32 i = first_instance; i < instance_end; i++) {
+		MeshInstance& instance = this->instances[this->scene_order[i] - first_instance];
+		if (instance.geometry.get() != batch_geometry) {
+			batch_geometry = instance.geometry.get();
+			batch_bounds = batch_geometry != NULL ? &batch_geometry->getBounds() : NULL;
+			batch_id = batch_geometry != NULL ? batch_geometry->getGeometryId() : 0;
+		}
+		SceneMesh& scene_mesh = this->scene[this->scene_order[i]];
+		scene_mesh = SceneMesh();
+		scene_mesh.model = combine(translation3D(instance.position), rotation3D(instance.rotation));
+		scene_mesh.tint = instance.tint;
+		if (batch_geometry != NULL) {
+			scene_mesh.bounds = batch_bounds;
+			scene_mesh.geometry_id = batch_id;
+			scene_mesh.cull_mode = batch_geometry->cull_mode;
+			scene_mesh.vertices = &batch_geometry->vertices;
+			scene_mesh.tris = &batch_geometry->tris;
+			scene_mesh.lods = &batch_geometry->lods;
+			scene_mesh.tri_count = batch_geometry->tris.size();
+			setShading(scene_mesh, *batch_geometry);
+		}
+	}
 
-		double s_pitch = sin(toRadian(mesh.rotation.y));
-		double c_pitch = cos(toRadian(mesh.rotation.y));
+	mesh_index = instance_end;
+	for (CompactMesh& mesh : this->compact_meshes) {
+		SceneMesh& scene_mesh = this->scene[mesh_index];
+		scene_mesh = SceneMesh();
+		scene_mesh.model = combine(translation3D(mesh.position), rotation3D(mesh.rotation));
+		scene_mesh.bounds = &mesh.getBounds();
+		scene_mesh.geometry_id = mesh.getGeometryId();
+		scene_mesh.cull_mode = mesh.cull_mode;
+		scene_mesh.compact = &mesh;
+		scene_mesh.tri_count = mesh.getTriCount();
+		this->scene_order[mesh_index] = mesh_index;
+		mesh_index++;
+	}
 
-		double s_roll = sin(toRadian(mesh.rotation.z));
-		double c_roll = cos(toRadian(mesh.rotation.z));
+	// The loaders computed the clusters' bounds and ids, so they're only read here
+	for (size_t s = 0, g = 0; s < this->streamed_meshes.size(); s++) {
+		const StreamedMesh& streamed = this->streamed_meshes[s];
+		Transform3 model = combine(translation3D(streamed.position), rotation3D(streamed.rotation));
+		for (; g < this->streamed_end[s]; g++) {
+			MeshGeometry& geometry = *this->streamed_geometry[g];
+			SceneMesh& scene_mesh = this->scene[mesh_index];
+			scene_mesh = SceneMesh();
+			scene_mesh.model = model;
+			scene_mesh.bounds = &geometry.getBounds();
+			scene_mesh.geometry_id = geometry.getGeometryId();
+			scene_mesh.cull_mode = streamed.cull_mode;
+			scene_mesh.vertices = &geometry.vertices;
+			scene_mesh.tris = &geometry.tris;
+			scene_mesh.lods = &geometry.lods;
+			scene_mesh.tri_count = geometry.tris.size();
+			this->scene_order[mesh_index] = mesh_index;
+			mesh_index++;
+		}
+	}
+}
+
+template <class Precision>
+Transform3 BasicRender3DLayer<Precision>::getScreenTransform() const {
+	double max_ratio = std::max(this->width, this->height);
+	double converted_fov = toFov(this->fov) * max_ratio;
+	// Flips Y since the screen goes downwards
+	return combine(scale3D(Point3{ converted_fov, -converted_fov, 1 }),
+		combine(rotation3D(Point3{ -this->rotation.x, -this->rotation.y, -this->rotation.z }),
+			translation3D(Point3{ -this->position.x, -this->position.y, -this->position.z })));
+}
 
-		// Converts the triangles' positions relative to the camera
-		for (SolidTri absolute_tri : mesh.solid_tris) {
-			// Rotates the triangle's points by the mesh's rotation
-			absolute_tri.a = rotate3D(absolute_tri.a, s_yaw, c_yaw, s_pitch, c_pitch, s_roll, c_roll);
-			absolute_tri.b = rotate3D(absolute_tri.b, s_yaw, c_yaw, s_pitch, c_pitch, s_roll, c_roll);
-			absolute_tri.c = rotate3D(absolute_tri.c, s_yaw, c_yaw, s_pitch, c_pitch, s_roll, c_roll);
+template <class Precision>
+void BasicRender3DLayer<Precision>::getViewPlanes(Plane3* planes) const {
+	double center_x = this->width / 2, center_y = this->height / 2;
+	planes[0] = Plane3{ Point3{ 0, 0, 1 }, -this->near_clipping };
+	planes[1] = Plane3{ Point3{ 0, 0, -1 }, this->far_clipping };
+	planes[2] = Plane3{ Point3{ 1, 0, center_x }, 0 };
+	planes[3] = Plane3{ Point3{ -1, 0, this->width - center_x }, 0 };
+	planes[4] = Plane3{ Point3{ 0, 1, center_y }, 0 };
+	planes[5] = Plane3{ Point3{ 0, -1, this->height - center_y }, 0 };
+}
 
-			// Adds the offset
-			absolute_tri.a = Point3{ absolute_tri.a.x + position_offset.x,
-				absolute_tri.a.y + position_offset.y,
-				absolute_tri.a.z + position_offset.z, };
-			absolute_tri.b = Point3{ absolute_tri.b.x + position_offset.x,
-				absolute_tri.b.y + position_offset.y,
-				absolute_tri.b.z + position_offset.z, };
-			absolute_tri.c = Point3{ absolute_tri.c.x + position_offset.x,
-				absolute_tri.c.y + position_offset.y,
-				absolute_tri.c.z + position_offset.z, };
+// Corner of a polygon being clipped, in the projection's space before the divide
+struct ClipVertex {
+	double x, y, z;
+	I32 corner; // Corner of the triangle the polygon was cut from, -1 for a point the clipping made
+};
+
+// A triangle clipped by 5 planes gains at most a corner per plane
+static const U32 CLIP_MAX_VERTICES = 8;
+
+// Sutherland-Hodgman clipping of a convex polygon to where plane[0] * x + plane[1] * y + plane[2] * z + plane[3] >= 0,
+// writes the corners left into out and returns how many there are
+// An edge's crossing is computed from its inside end, so the triangles sharing the edge get the very same point
+static U32 clipPolygon(const ClipVertex* in, U32 count, const double* plane, ClipVertex* out) {
+	U32 out_count = 0;
+	for (U32 v = 0; v < count; v++) {
+		const ClipVertex& current = in[v];
+		const ClipVertex& next = in[v + 1 == count ? 0 : v + 1];
+		double current_distance = plane[0] * current.x + plane[1] * current.y + plane[2] * current.z + plane[3];
+		double next_distance = plane[0] * next.x + plane[1] * next.y + plane[2] * next.z + plane[3];
+		bool current_inside = current_distance >= 0;
+		if (current_inside)
+			out[out_count++] = current;
+		if (current_inside != (next_distance >= 0)) {
+			const ClipVertex& inside = current_inside ? current : next;
+			const ClipVertex& outside = current_inside ? next : current;
+			double inside_distance = current_inside ? current_distance : next_distance;
+			double t = inside_distance / (inside_distance - (current_inside ? next_distance : current_distance));
+			out[out_count++] = ClipVertex{ inside.x + (outside.x - inside.x) * t, inside.y + (outside.y - inside.y) * t,
+				inside.z + (outside.z - inside.z) * t, -1 };
+		}
+	}
+	return out_count;
+}
 
-			// Rotates the triangles as if the camera is rotated
-			absolute_tri.a = rotate3D(absolute_tri.a, s_yaw_cam, c_yaw_cam, s_pitch_cam, c_pitch_cam, s_roll_cam, c_roll_cam);
-			absolute_tri.b = rotate3D(absolute_tri.b, s_yaw_cam, c_yaw_cam, s_pitch_cam, c_pitch_cam, s_roll_cam, c_roll_cam);
-			absolute_tri.c = rotate3D(absolute_tri.c, s_yaw_cam, c_yaw_cam, s_pitch_cam, c_pitch_cam, s_roll_cam, c_roll_cam);
+// Sets up the shade of a triangle from its 3 points in the mesh's space and 4 values at each of them, see TriShade
+// The triangle's corners projected by the transform are the columns of a matrix, whose adjugate turns the ray through
+// a pixel into the weights of the corners where the ray meets the triangle, all scaled alike. Triangles seen edge on
+// or without an area get the values of their first corner everywhere
+static void setupShade(TriShade& shade, const Transform3& transform, double center_x, double center_y, const Point3* points,
+	const double (*values)[4]) {
+	double m[3][3];
+	for (U32 v = 0; v < 3; v++)
+		for (U32 row = 0; row < 3; row++)
+			m[row][v] = transform.m[row][0] * points[v].x + transform.m[row][1] * points[v].y + transform.m[row][2] * points[v].z + transform.m[row][3];
+	double adjugate[3][3] = {
+		{ m[1][1] * m[2][2] - m[1][2] * m[2][1], m[0][2] * m[2][1] - m[0][1] * m[2][2], m[0][1] * m[1][2] - m[0][2] * m[1][1] },
+		{ m[1][2] * m[2][0] - m[1][0] * m[2][2], m[0][0] * m[2][2] - m[0][2] * m[2][0], m[0][2] * m[1][0] - m[0][0] * m[1][2] },
+		{ m[1][0] * m[2][1] - m[1][1] * m[2][0], m[0][1] * m[2][0] - m[0][0] * m[2][1], m[0][0] * m[1][1] - m[0][1] * m[1][0] } };
+	double determinant = m[0][0] * adjugate[0][0] + m[0][1] * adjugate[1][0] + m[0][2] * adjugate[2][0];
 
-			absolute_tri.color = absolute_tri.color;
-			solid_tris.push_back(absolute_tri);
+	// Weight planes of the corners over the pixel indices, the ray of pixel x, y goes through its center
+	double weights[3][3];
+	for (U32 v = 0; v < 3; v++) {
+		if (determinant != 0) {
+			weights[v][0] = adjugate[v][0];
+			weights[v][1] = adjugate[v][1];
+			weights[v][2] = adjugate[v][0] * (0.5 - center_x) + adjugate[v][1] * (0.5 - center_y) + adjugate[v][2];
 		}
+		else {
+			weights[v][0] = weights[v][1] = 0;
+			weights[v][2] = v == 0;
+		}
+	}
+	for (U32 i = 0; i < 3; i++) {
+		shade.weight_sum[i] = weights[0][i] + weights[1][i] + weights[2][i];
+		for (U32 channel = 0; channel < 4; channel++)
+			shade.attributes[channel][i] = values[0][channel] * weights[0][i] + values[1][channel] * weights[1][i] + values[2][channel] * weights[2][i];
 	}
+}
+
+template <class Precision>
+double BasicRender3DLayer<Precision>::render(RenderStats* stats) {
+	U64 start = astd::getNanos();
+	this->gatherScene();
+	return this->renderScene(this->scene, this->scene_order, stats, start);
+}
+
+template <class Precision>
+double BasicRender3DLayer<Precision>::renderViews(BasicRender3DLayer* const* views, size_t view_count, RenderStats* view_stats) {
+	U64 start = astd::getNanos();
+	this->gatherScene();
+
+	U32 threads = (U32)std::min<size_t>(this->thread_count, view_count);
+#ifdef DEBUG_TEXT
+	threads = 1; // debug_text is shared, keep it to a single writer
+#endif
+	if (threads > 1 && (this->view_pool == NULL || this->view_pool->size() != threads)) {
+		delete this->view_pool;
+		this->view_pool = new astd::ThreadPool(threads);
+	}
+
+	// Views only read the scene, everything they write is their own
+	auto renderView = [&](U64 view) {
+		views[view]->renderScene(this->scene, this->scene_order, view_stats != NULL ? &view_stats[view] : NULL, astd::getNanos());
+	};
+	if (threads > 1)
+		this->view_pool->parallelFor(view_count, renderView);
+	else
+		for (size_t view = 0; view < view_count; view++)
+			renderView(view);
+	return (astd::getNanos() - start) / 1e9;
+}
 
-	// TRANSLATIONS ON PROJECTION AND SCREEN COORDINATES //
+template <class Precision>
+double BasicRender3DLayer<Precision>::renderScene(const CountedVector<SceneMesh>& scene, const CountedVector<U32>& scene_order,
+	RenderStats* stats, U64 start) {
+	IF_RENDER_STATS(RenderStats frame_stats);
+	IF_RENDER_STATS(U64 stage_start = start);
 
-	std::vector<SolidTri> projected_solid_tris;
-	std::vector<SolidTri> passed_solid_tris;
+	// Everything the previous frame took from the arena is free again
+	this->arena.reset();
+
+	// TRANSLATIONS RELATIVE TO THE CAMERA AND PROJECTION //
 
 	double max_ratio;
 	if (this->width > this->height)
 		max_ratio = this->width;
 	else
 		max_ratio = this->height;
-
 	double converted_fov = toFov(this->fov) * max_ratio;
-	for (SolidTri tri : solid_tris) {
-		// Eliminate triangles that are behind the near clipping or farther than the far clipping
-		if (tri.a.z <= this->near_clipping && tri.b.z <= this->near_clipping && tri.c.z <= this->near_clipping)
-			continue;
-		if (tri.a.z >= this->far_clipping && tri.b.z >= this->far_clipping && tri.c.z >= this->far_clipping)
-			continue;
 
-		// Avoid high division values later on
-		if (tri.a.z < 0.01 && tri.a.z > -0.01) tri.a.z = 0.01;
-		if (tri.b.z < 0.01 && tri.b.z > -0.01) tri.b.z = 0.01;
-		if (tri.c.z < 0.01 && tri.c.z > -0.01) tri.c.z = 0.01;
+	Transform3 screen_transform = this->getScreenTransform();
+
+	// Rotates the points by the mesh's rotation and moves them to the mesh's position before the screen transform,
+	// so each vertex takes a single matrix to get to the screen
+	auto meshProjection = [&](const Transform3& model) -> ProjectionTransform {
+		ProjectionTransform projection;
+		projection.transform = combine(screen_transform, model);
+		projection.center_x = this->width / 2;
+		projection.center_y = this->height / 2;
+		return projection;
+	};
+
+	// FRUSTUM CULLING //
+
+	// The view in the space the screen transform maps into, where a point is on screen at center + X / Z
+	double center_x = this->width / 2, center_y = this->height / 2;
+	Plane3 view_planes[6];
+	this->getViewPlanes(view_planes);
+	// The side planes only hold where the divide does, in front of the camera and of the 0.01 depth clamp
+	Plane3 front_plane = Plane3{ Point3{ 0, 0, 1 }, -std::max(this->near_clipping, 0.01) };
+
+	// Tests a mesh's local bounds against the view moved into its local space, so none of its vertices are touched
+	// Triangles of a culled mesh would all have been rejected by the per-triangle tests
+	auto isMeshVisible = [&](const Bounds3& bounds, const ProjectionTransform& projection) -> bool {
+		Plane3 local[4];
+		for (U32 p = 0; p < 2; p++)
+			local[p] = planeToLocal(projection.transform, view_planes[p]);
+		if (testBounds(bounds, local, 2) == PlaneSide::Outside)
+			return false;
+		local[0] = planeToLocal(projection.transform, front_plane);
+		if (testBounds(bounds, local, 1) != PlaneSide::Inside)
+			return true;
+		for (U32 p = 0; p < 4; p++)
+			local[p] = planeToLocal(projection.transform, view_planes[2 + p]);
+		return testBounds(bounds, local, 4) != PlaneSide::Outside;
+	};
+
+	size_t mesh_count = scene.size();
+	ProjectionTransform* mesh_projections = this->arena.alloc<ProjectionTransform>(mesh_count);
+	U8* mesh_visible = this->arena.alloc<U8>(mesh_count);
+	U32* mesh_lod = this->arena.alloc<U32>(mesh_count);
+
+	// Coarsest level of detail whose error stays under lod_pixel_error where the mesh's bounds come nearest,
+	// a level's error shrinks on screen with the depth like the rest of the mesh
+	auto pickLod = [&](const std::vector<MeshLod>& lods, const Bounds3& bounds, const ProjectionTransform& projection) -> U32 {
+		if (lods.empty() || this->lod_pixel_error <= 0)
+			return 0;
+		const double* depth_row = projection.transform.m[2];
+		double nearest = depth_row[0] * bounds.center.x + depth_row[1] * bounds.center.y + depth_row[2] * bounds.center.z + depth_row[3] - bounds.radius;
+		if (nearest <= this->near_clipping)
+			return 0;
+		double max_error = this->lod_pixel_error * nearest / converted_fov;
+		U32 lod = 0;
+		while (lod < lods.size() && lods[lod].error <= max_error)
+			lod++;
+		return lod;
+	};
+
+	// The triangles of the last frame stay valid until a mesh, its projection or a setting they depend on changes
+	GeometryKey geometry_key = GeometryKey{ this->width, this->height, this->near_clipping, this->far_clipping, this->front_to_back };
+	bool geometry_changed = !this->geometry_cached || this->mesh_cache.size() != mesh_count ||
+		geometry_key.width != this->geometry_key.width || geometry_key.height != this->geometry_key.height ||
+		geometry_key.near_clipping != this->geometry_key.near_clipping || geometry_key.far_clipping != this->geometry_key.far_clipping ||
+		geometry_key.front_to_back != this->geometry_key.front_to_back;
+
+	// Soup meshes take 3 vertices per triangle, indexed meshes share theirs between triangles
+	size_t total_tris = 0;
+	for (const SceneMesh& mesh : scene)
+		total_tris += mesh.tri_count;
+	this->reserveFrame(mesh_count, total_tris);
+
+	// Forgets the mesh's projected vertices if they were projected differently or from other geometry
+	auto checkCache = [&](U32 mesh_index, const SceneMesh& mesh) {
+		MeshCache& cache = this->mesh_cache[mesh_index];
+		if (cache.geometry_id != mesh.geometry_id || cache.lod != mesh_lod[mesh_index] || !isSameProjection(cache.projection, mesh_projections[mesh_index])) {
+			cache.geometry_id = mesh.geometry_id;
+			cache.lod = mesh_lod[mesh_index];
+			cache.projection = mesh_projections[mesh_index];
+			cache.projected = false;
+			geometry_changed = true;
+		}
+		const U32* vertex_colors = mesh.vertex_colors != NULL ? mesh.vertex_colors->data() : NULL;
+		const Point2* vertex_uvs = mesh.vertex_uvs != NULL ? mesh.vertex_uvs->data() : NULL;
+		if (cache.cull_mode != mesh.cull_mode || cache.tint != mesh.tint || cache.shading != mesh.shading || cache.vertex_colors != vertex_colors ||
+			cache.vertex_uvs != vertex_uvs || cache.texture != mesh.texture) {
+			cache.cull_mode = mesh.cull_mode;
+			cache.tint = mesh.tint;
+			cache.shading = mesh.shading;
+			cache.vertex_colors = vertex_colors;
+			cache.vertex_uvs = vertex_uvs;
+			cache.texture = mesh.texture;
+			geometry_changed = true;
+		}
+	};
+
+#if RENDER_STATS
+	// Counts the triangles of the level of detail the mesh is drawn at
+	auto countLod = [&](const SceneMesh& mesh, U32 lod) {
+		size_t lod_tris = lod == 0 ? mesh.tri_count : (*mesh.lods)[lod - 1].tris.size();
+		frame_stats.tris_in += lod_tris;
+		frame_stats.meshes_lod_reduced += lod != 0;
+		frame_stats.tris_lod_removed += mesh.tri_count - lod_tris;
+	};
+#endif
+
+	for (U32 mesh_index = 0; mesh_index < (U32)mesh_count; mesh_index++) {
+		const SceneMesh& mesh = scene[mesh_index];
+		mesh_projections[mesh_index] = meshProjection(mesh.model);
+		mesh_visible[mesh_index] = mesh.bounds != NULL && isMeshVisible(*mesh.bounds, mesh_projections[mesh_index]);
+		mesh_lod[mesh_index] = mesh_visible[mesh_index] && mesh.lods != NULL && mesh.shading == Shading::Flat ?
+			pickLod(*mesh.lods, *mesh.bounds, mesh_projections[mesh_index]) : 0;
+		checkCache(mesh_index, mesh);
+		this->mesh_shading[mesh_index] = mesh.shading;
+		if (!mesh_visible[mesh_index] && mesh.bounds != NULL) {
+			IF_RENDER_STATS(frame_stats.meshes_frustum_culled++);
+			IF_RENDER_STATS(frame_stats.tris_frustum_culled += mesh.tri_count);
+		}
+		IF_RENDER_STATS(if (mesh.bounds != NULL) countLod(mesh, mesh_lod[mesh_index]));
+	}
+
+	IF_RENDER_STATS(U64 now = astd::getNanos(); frame_stats.cull_ns += now - stage_start; stage_start = now);
+
+	if (geometry_changed) {
+		// TRANSFORM //
+
+		// Every vertex is projected once into separate screen X, Y and depth arrays kept by the mesh's cache,
+		// meshes whose projection and geometry are the same as when they were last projected keep theirs
+		auto measureMesh = [&](MeshCache& cache, size_t vertex_count) {
+			ScreenBounds bounds = ScreenBounds{ INF, INF, -INF, -INF, INF, true };
+			for (size_t v = 0; v < vertex_count; v++) {
+				double x = Precision::toPixels(cache.vertex_x[v]), y = Precision::toPixels(cache.vertex_y[v]);
+				bounds.min_x = std::min(bounds.min_x, x);
+				bounds.min_y = std::min(bounds.min_y, y);
+				bounds.max_x = std::max(bounds.max_x, x);
+				bounds.max_y = std::max(bounds.max_y, y);
+				bounds.nearest = std::min(bounds.nearest, (double)cache.vertex_z[v]);
+			}
+			bounds.cullable = bounds.nearest > this->near_clipping;
+			cache.bounds = bounds;
+			cache.projected = true;
+			IF_RENDER_STATS(frame_stats.meshes_projected++);
+		};
+
+		// In the scene's order, which keeps the instances of a geometry together
+		for (U32 mesh_index : scene_order) {
+			const SceneMesh& mesh = scene[mesh_index];
+			MeshCache& cache = this->mesh_cache[mesh_index];
+			if (mesh_visible[mesh_index] && !cache.projected) {
+				if (mesh.solid_tris != NULL) {
+					// Lay the corners out as a vertex array for the projection kernel
+					const std::vector<SolidTri>& solid_tris = *mesh.solid_tris;
+					size_t vertex_count = solid_tris.size() * 3;
+					Point3* corners = this->arena.alloc<Point3>(vertex_count);
+					for (size_t t = 0; t < solid_tris.size(); t++) {
+						const SolidTri& absolute_tri = solid_tris[t];
+						corners[t * 3] = absolute_tri.a;
+						corners[t * 3 + 1] = absolute_tri.b;
+						corners[t * 3 + 2] = absolute_tri.c;
+					}
+					this->reserveVertices(cache, vertex_count);
+					projectVertices<Precision>(cache.projection, corners, vertex_count, cache.vertex_x, cache.vertex_y, cache.vertex_z);
+					measureMesh(cache, vertex_count);
+				}
+				else if (mesh.compact != NULL) {
+					const CompactMesh& compact = *mesh.compact;
+					this->reserveVertices(cache, compact.corners.size());
+					projectQuantized<Precision>(cache.projection, compact.origin, compact.step, compact.corners.data(), compact.corners.size(),
+						cache.vertex_x, cache.vertex_y, cache.vertex_z);
+					measureMesh(cache, compact.corners.size());
+				}
+				else {
+					const std::vector<Point3>& vertices = cache.lod == 0 ? *mesh.vertices : (*mesh.lods)[cache.lod - 1].vertices;
+					this->reserveVertices(cache, vertices.size());
+					projectVertices<Precision>(cache.projection, vertices.data(), vertices.size(), cache.vertex_x, cache.vertex_y, cache.vertex_z);
+					measureMesh(cache, vertices.size());
+				}
+			}
+			this->mesh_bounds[mesh_index] = mesh_visible[mesh_index] ? cache.bounds : ScreenBounds{ 0, 0, 0, 0, INF, false };
+		}
+
+		// TRIANGLE ASSEMBLY //
+
+		IF_RENDER_STATS(now = astd::getNanos(); frame_stats.transform_ns += now - stage_start; stage_start = now);
+
+		// The right and bottom screen edges in screen coordinates
+		Screen screen_width = Precision::toScreen(this->width), screen_height = Precision::toScreen(this->height);
+		U32 projected_tri_count = 0;
+
+		// Triangles crossing the near clipping or reaching past the guard band around the screen are clipped against them
+		// before the divide, so every assembled vertex is in front of the camera and the rasterizers need no near test
+		// Those planes in the projection's space, where a point is inside if x * [0] + y * [1] + z * [2] + [3] >= 0
+		double clip_depth = std::max(this->near_clipping, 0.01);
+		const double clip_planes[5][4] = {
+			{ 0, 0, 1, -clip_depth },
+			{ 1, 0, center_x + GUARD_BAND, 0 },
+			{ -1, 0, this->width + GUARD_BAND - center_x, 0 },
+			{ 0, 1, center_y + GUARD_BAND, 0 },
+			{ 0, -1, this->height + GUARD_BAND - center_y, 0 } };
+		Screen guard_min_x = Precision::toScreen(-GUARD_BAND), guard_min_y = Precision::toScreen(-GUARD_BAND);
+		Screen guard_max_x = Precision::toScreen(this->width + GUARD_BAND), guard_max_y = Precision::toScreen(this->height + GUARD_BAND);
+
+		auto screenPoint = [&](const MeshCache& cache, U32 v) -> ScreenVertex<Precision> {
+			return ScreenVertex<Precision>{ cache.vertex_x[v], cache.vertex_y[v], cache.vertex_z[v] };
+		};
 
-		SolidTri original_tri = tri;
+		// Triangles completely outside the viewport
+		auto isOffScreen = [&](const ScreenTri<Precision>& tri) -> bool {
+			return (tri.a.x < 0 && tri.b.x < 0 && tri.c.x < 0) ||
+				(tri.a.x >= screen_width && tri.b.x >= screen_width && tri.c.x >= screen_width) ||
+				(tri.a.y < 0 && tri.b.y < 0 && tri.c.y < 0) ||
+				(tri.a.y >= screen_height && tri.b.y >= screen_height && tri.c.y >= screen_height);
+		};
 
-		// Transforming stuff
-		tri.a.x = (tri.a.x / tri.a.z) * converted_fov + (this->width / 2);
-		tri.a.y = -(tri.a.y / tri.a.z) * converted_fov + (this->height / 2);
-		tri.b.x = (tri.b.x / tri.b.z) * converted_fov + (this->width / 2);
-		tri.b.y = -(tri.b.y / tri.b.z) * converted_fov + (this->height / 2);
-		tri.c.x = (tri.c.x / tri.c.z) * converted_fov + (this->width / 2);
-		tri.c.y = -(tri.c.y / tri.c.z) * converted_fov + (this->height / 2);
+		auto appendTri = [&](U32 mesh, U32 index, const ScreenTri<Precision>& tri, U32 shade) {
+			// Clipping can make more triangles than the meshes have
+			if (projected_tri_count == this->tri_capacity)
+				this->growAssembled(projected_tri_count + 1, projected_tri_count);
+			this->assembled_tri_mesh[projected_tri_count] = mesh;
+			this->assembled_tri_index[projected_tri_count] = index;
+			this->assembled_tri_shade[projected_tri_count] = shade;
+			this->assembled_tris[projected_tri_count++] = tri;
+		};
 
-		// Ignore triangles that are completely outside the viewport
-		if (tri.a.x < 0 && tri.b.x < 0 && tri.c.x < 0) continue;
-		if (tri.a.x >= this->width && tri.b.x >= this->width && tri.c.x >= this->width) continue;
-		if (tri.a.y < 0 && tri.b.y < 0 && tri.c.y < 0) continue;
-		if (tri.a.y >= this->height && tri.b.y >= this->height && tri.c.y >= this->height) continue;
+		// Clips a triangle of the mesh's 3 local points and appends the fan of the polygon left,
+		// corners of the triangle that are kept use their projected vertex
+		auto clipTri = [&](U32 mesh, U32 index, const MeshCache& cache, const U32* corners, const Point3* points, U32 color, const auto& makeShade) {
+			IF_RENDER_STATS(frame_stats.tris_clipped++);
+			const Transform3& transform = cache.projection.transform;
+			ClipVertex polygon[2][CLIP_MAX_VERTICES];
+			for (U32 v = 0; v < 3; v++) {
+				const Point3& point = points[v];
+				double projected[3];
+				for (U32 row = 0; row < 3; row++)
+					projected[row] = transform.m[row][0] * point.x + transform.m[row][1] * point.y + transform.m[row][2] * point.z + transform.m[row][3];
+				polygon[0][v] = ClipVertex{ projected[0], projected[1], projected[2], (I32)v };
+			}
+
+			// The triangle is clockwise on screen where the determinant of its corners is negative,
+			// which holds for the whole triangle before any corner is cut off
+			if (cache.cull_mode != CullMode::None) {
+				const ClipVertex* c = polygon[0];
+				double determinant = c[0].x * (c[1].y * c[2].z - c[1].z * c[2].y) - c[0].y * (c[1].x * c[2].z - c[1].z * c[2].x) +
+					c[0].z * (c[1].x * c[2].y - c[1].y * c[2].x);
+				if ((determinant < 0) == (cache.cull_mode == CullMode::Back)) {
+					IF_RENDER_STATS(frame_stats.tris_backface_culled++);
+					return;
+				}
+			}
+
+			U32 count = 3, current = 0, plane = 0;
+			for (; plane < 5 && count >= 3; plane++) {
+				count = clipPolygon(polygon[current], count, clip_planes[plane], polygon[current ^ 1]);
+				current ^= 1;
+			}
+			if (count < 3) {
+				IF_RENDER_STATS(if (plane == 1) frame_stats.tris_near_far_culled++; else frame_stats.tris_viewport_culled++);
+				return;
+			}
+
+			ScreenVertex<Precision> screen[CLIP_MAX_VERTICES];
+			for (U32 v = 0; v < count; v++) {
+				const ClipVertex& vertex = polygon[current][v];
+				if (vertex.corner >= 0)
+					screen[v] = screenPoint(cache, corners[vertex.corner]);
+				else
+					screen[v] = ScreenVertex<Precision>{ Precision::toScreen(vertex.x / vertex.z + center_x),
+						Precision::toScreen(vertex.y / vertex.z + center_y), (Depth)std::max(vertex.z, clip_depth) };
+			}
+			// Every piece of the fan keeps the triangle's winding, those left off screen are dropped
+			// The pieces share the shade, which is only set up once one of them is kept
+			U32 shade = NO_SHADE;
+			bool shaded = false;
+			for (U32 v = 2; v < count; v++) {
+				ScreenTri<Precision> piece = ScreenTri<Precision>{ screen[0], screen[v - 1], screen[v], color };
+				if (isOffScreen(piece))
+					continue;
+				if (!shaded) {
+					shade = makeShade(points);
+					shaded = true;
+				}
+				appendTri(mesh, index, piece, shade);
+			}
+		};
+
+		// Culls a triangle of the mesh's cached vertices or appends it to the assembled triangles,
+		// getPoints fills an array with its 3 corners in the mesh's space, only called when it needs clipping or shading
+		// makeShade sets up the shade of a triangle of those points once it's kept, and returns its index or NO_SHADE
+		auto assembleTri = [&](U32 mesh, U32 index, const MeshCache& cache, U32 a, U32 b, U32 c, const auto& getPoints, U32 color,
+			const auto& makeShade) {
+			// Eliminate triangles that are behind the near clipping or farther than the far clipping
+			Depth za = cache.vertex_z[a], zb = cache.vertex_z[b], zc = cache.vertex_z[c];
+			if ((za <= this->near_clipping && zb <= this->near_clipping && zc <= this->near_clipping) ||
+				(za >= this->far_clipping && zb >= this->far_clipping && zc >= this->far_clipping)) {
+				IF_RENDER_STATS(frame_stats.tris_near_far_culled++);
+				return;
+			}
+
+			// A vertex too near the camera was divided by a clamped depth, the triangle's screen points can't be trusted before clipping
+			U32 corners[3] = { a, b, c };
+			if (za < clip_depth || zb < clip_depth || zc < clip_depth) {
+				Point3 points[3];
+				getPoints(points);
+				clipTri(mesh, index, cache, corners, points, color, makeShade);
+				return;
+			}
+
+			ScreenTri<Precision> projected_tri = ScreenTri<Precision>{ screenPoint(cache, a), screenPoint(cache, b), screenPoint(cache, c), color };
+			if (isOffScreen(projected_tri)) {
+				IF_RENDER_STATS(frame_stats.tris_viewport_culled++);
+				return;
+			}
+			if (std::min({ projected_tri.a.x, projected_tri.b.x, projected_tri.c.x }) < guard_min_x ||
+				std::max({ projected_tri.a.x, projected_tri.b.x, projected_tri.c.x }) > guard_max_x ||
+				std::min({ projected_tri.a.y, projected_tri.b.y, projected_tri.c.y }) < guard_min_y ||
+				std::max({ projected_tri.a.y, projected_tri.b.y, projected_tri.c.y }) > guard_max_y) {
+				Point3 points[3];
+				getPoints(points);
+				clipTri(mesh, index, cache, corners, points, color, makeShade);
+				return;
+			}
+
+			// Skip the faces the mesh doesn't want
+			if (cache.cull_mode != CullMode::None) {
+				bool clockwise = isClockwise(Point2{ Precision::toPixels(projected_tri.a.x), Precision::toPixels(projected_tri.a.y) },
+					Point2{ Precision::toPixels(projected_tri.b.x), Precision::toPixels(projected_tri.b.y) },
+					Point2{ Precision::toPixels(projected_tri.c.x), Precision::toPixels(projected_tri.c.y) });
+				if (clockwise == (cache.cull_mode == CullMode::Back)) {
+					IF_RENDER_STATS(frame_stats.tris_backface_culled++);
+					return;
+				}
+			}
+
+			U32 shade = NO_SHADE;
+			if (cache.shading != Shading::Flat) {
+				Point3 points[3];
+				getPoints(points);
+				shade = makeShade(points);
+			}
+			appendTri(mesh, index, projected_tri, shade);
+		};
+
+		// Flat triangles only need their color
+		auto noShade = [](const Point3*) -> U32 { return NO_SHADE; };
+
+		// In the order of the list, so the triangles are drawn in the same order as if every instance was a mesh
+		this->tri_shades.clear();
+		for (U32 mesh_index = 0; mesh_index < (U32)mesh_count; mesh_index++) {
+			if (!mesh_visible[mesh_index])
+				continue;
+			const SceneMesh& mesh = scene[mesh_index];
+			const MeshCache& cache = this->mesh_cache[mesh_index];
+			if (mesh.solid_tris != NULL) {
+				const std::vector<SolidTri>& solid_tris = *mesh.solid_tris;
+				for (U32 t = 0; t < (U32)solid_tris.size(); t++) {
+					const SolidTri& tri = solid_tris[t];
+					auto getPoints = [&](Point3* points) {
+						points[0] = tri.a;
+						points[1] = tri.b;
+						points[2] = tri.c;
+					};
+					assembleTri(mesh_index, t, cache, t * 3, t * 3 + 1, t * 3 + 2, getPoints, tri.color, noShade);
+				}
+			}
+			else if (mesh.compact != NULL) {
+				const CompactMesh& compact = *mesh.compact;
+				for (U32 t = 0; t < (U32)compact.getTriCount(); t++) {
+					auto getPoints = [&](Point3* points) {
+						for (U32 c = 0; c < 3; c++)
+							points[c] = compact.getCorner(t * 3 + c);
+					};
+					assembleTri(mesh_index, t, cache, t * 3, t * 3 + 1, t * 3 + 2, getPoints, compact.getColor(t), noShade);
+				}
+			}
+			else {
+				const std::vector<Point3>& vertices = cache.lod == 0 ? *mesh.vertices : (*mesh.lods)[cache.lod - 1].vertices;
+				const std::vector<IndexedTri>& tris = cache.lod == 0 ? *mesh.tris : (*mesh.lods)[cache.lod - 1].tris;
+				for (U32 t = 0; t < (U32)tris.size(); t++) {
+					const IndexedTri& tri = tris[t];
+					auto getPoints = [&](Point3* points) {
+						points[0] = vertices[tri.a];
+						points[1] = vertices[tri.b];
+						points[2] = vertices[tri.c];
+					};
+					// Shaded meshes are drawn in full, so the triangle's corners index their attributes
+					auto makeShade = [&](const Point3* points) -> U32 {
+						if (cache.shading == Shading::Flat)
+							return NO_SHADE;
+						U32 corners[3] = { tri.a, tri.b, tri.c };
+						double values[3][4] = {};
+						for (U32 v = 0; v < 3; v++) {
+							if (cache.shading == Shading::Gouraud) {
+								U32 color = tintColor(cache.vertex_colors[corners[v]], cache.tint);
+								for (U32 channel = 0; channel < 4; channel++)
+									values[v][channel] = (color >> (channel * 8)) & 0xFF;
+							}
+							else {
+								values[v][0] = cache.vertex_uvs[corners[v]].x * cache.texture->width;
+								values[v][1] = cache.vertex_uvs[corners[v]].y * cache.texture->height;
+							}
+						}
+						TriShade shade;
+						shade.shading = cache.shading;
+						shade.texture = cache.texture;
+						setupShade(shade, cache.projection.transform, center_x, center_y, points, values);
+						this->tri_shades.push_back(shade);
+						return (U32)this->tri_shades.size() - 1;
+					};
+					assembleTri(mesh_index, t, cache, tri.a, tri.b, tri.c, getPoints, tintColor(tri.color, cache.tint), makeShade);
+				}
+			}
+		}
+		this->projected_tris = this->assembled_tris;
+		this->projected_tri_mesh = this->assembled_tri_mesh;
+		this->projected_tri_index = this->assembled_tri_index;
+		this->projected_tri_shade = this->assembled_tri_shade;
+		this->projected_tri_count = projected_tri_count;
+
+		// FRONT TO BACK ORDERING //
 
-		projected_solid_tris.push_back(tri);
-		passed_solid_tris.push_back(original_tri);
+		IF_RENDER_STATS(now = astd::getNanos(); frame_stats.cull_ns += now - stage_start; stage_start = now);
+
+		if (this->front_to_back && projected_tri_count != 0) {
+			// Depth range of every mesh's triangles, from their nearest vertices
+			double* mesh_near = this->arena.alloc<double>(mesh_count);
+			double* mesh_far = this->arena.alloc<double>(mesh_count);
+			for (size_t m = 0; m < mesh_count; m++) {
+				mesh_near[m] = INF;
+				mesh_far[m] = -INF;
+			}
+			double* tri_depth = this->arena.alloc<double>(projected_tri_count);
+			for (U32 i = 0; i < projected_tri_count; i++) {
+				const ScreenTri<Precision>& tri = this->assembled_tris[i];
+				U32 mesh = this->assembled_tri_mesh[i];
+				tri_depth[i] = std::max((double)std::min({ tri.a.z, tri.b.z, tri.c.z }), this->near_clipping);
+				mesh_near[mesh] = std::min(mesh_near[mesh], tri_depth[i]);
+				mesh_far[mesh] = std::max(mesh_far[mesh], tri_depth[i]);
+			}
+
+			// Nearest mesh first, meshes left without triangles sort last and ties keep the scene's order
+			U32* mesh_order = this->arena.alloc<U32>(mesh_count);
+			for (U32 m = 0; m < mesh_count; m++)
+				mesh_order[m] = m;
+			std::sort(mesh_order, mesh_order + mesh_count, [&](U32 a, U32 b) {
+				return mesh_near[a] != mesh_near[b] ? mesh_near[a] < mesh_near[b] : a < b;
+			});
+			U32* mesh_rank = this->arena.alloc<U32>(mesh_count);
+			for (U32 r = 0; r < mesh_count; r++)
+				mesh_rank[mesh_order[r]] = r;
+
+			// Counting sort on the mesh's rank and the triangle's bucket inside the mesh's depth range,
+			// the triangles of a mesh stay together for the occlusion test and keep their order inside a bucket
+			size_t bucket_count = mesh_count * TRI_DEPTH_BUCKETS;
+			U32* bucket_start = this->arena.alloc<U32>(bucket_count + 1);
+			for (size_t b = 0; b <= bucket_count; b++)
+				bucket_start[b] = 0;
+			U32* tri_bucket = this->arena.alloc<U32>(projected_tri_count);
+			for (U32 i = 0; i < projected_tri_count; i++) {
+				U32 mesh = this->assembled_tri_mesh[i];
+				double range = mesh_far[mesh] - mesh_near[mesh];
+				U32 bucket = range > 0 ? (U32)((tri_depth[i] - mesh_near[mesh]) / range * TRI_DEPTH_BUCKETS) : 0;
+				tri_bucket[i] = mesh_rank[mesh] * TRI_DEPTH_BUCKETS + std::min(bucket, TRI_DEPTH_BUCKETS - 1);
+				bucket_start[tri_bucket[i] + 1]++;
+			}
+			for (size_t b = 0; b < bucket_count; b++)
+				bucket_start[b + 1] += bucket_start[b];
+
+			for (U32 i = 0; i < projected_tri_count; i++) {
+				U32 slot = bucket_start[tri_bucket[i]]++;
+				this->sorted_tris[slot] = this->assembled_tris[i];
+				this->sorted_tri_mesh[slot] = this->assembled_tri_mesh[i];
+				this->sorted_tri_index[slot] = this->assembled_tri_index[i];
+				this->sorted_tri_shade[slot] = this->assembled_tri_shade[i];
+			}
+			this->projected_tris = this->sorted_tris;
+			this->projected_tri_mesh = this->sorted_tri_mesh;
+			this->projected_tri_index = this->sorted_tri_index;
+			this->projected_tri_shade = this->sorted_tri_shade;
+		}
+
+		this->geometry_key = geometry_key;
+		this->geometry_cached = true;
+	}
+	else {
+		// Same triangles as the last frame, along with what culled the others
+		IF_RENDER_STATS(frame_stats.geometry_reused = true);
+		IF_RENDER_STATS(frame_stats.tris_near_far_culled = this->last_stats.tris_near_far_culled);
+		IF_RENDER_STATS(frame_stats.tris_viewport_culled = this->last_stats.tris_viewport_culled);
+		IF_RENDER_STATS(frame_stats.tris_backface_culled = this->last_stats.tris_backface_culled);
+		IF_RENDER_STATS(frame_stats.tris_clipped = this->last_stats.tris_clipped);
 	}
+	U32 projected_tri_count = this->projected_tri_count;
 
 	// RENDERING //
 
-	// Create depth buffer and set it all to infinity
-	size_t buffer_size = (size_t)this->width * (size_t)this->height;
-	double* depth_buffer = new double[buffer_size];
-	for (size_t pix = 0; pix < buffer_size; pix++)
-		depth_buffer[pix] = INF;
+	U32 threads = this->thread_count;
+#ifdef DEBUG_TEXT
+	threads = 1; // debug_text is shared, keep it to a single writer
+#endif
+	bool tiled = threads > 1 && this->tile_size != 0;
+
+	// Tiles that don't line up with the 8x8 cells would share them between threads
+	this->hiz_active = this->occlusion_culling && (!tiled || this->tile_size % (1 << HIZ_BLOCK_BITS) == 0);
+
+	// A held back clear is only done if the buffers don't already hold this frame
+	RasterKey raster_key = RasterKey{ this->raster_mode, this->occlusion_culling, threads, this->tile_size, this->visibility_buffer, this->buffer_format };
+	bool raster_changed = geometry_changed || raster_key.raster_mode != this->raster_key.raster_mode ||
+		raster_key.occlusion_culling != this->raster_key.occlusion_culling || raster_key.threads != this->raster_key.threads ||
+		raster_key.tile_size != this->raster_key.tile_size || raster_key.visibility_buffer != this->raster_key.visibility_buffer ||
+		raster_key.depth_format != this->raster_key.depth_format;
+	this->raster_key = raster_key;
+	if (this->clear_pending) {
+		if (!raster_changed) {
+			this->clear_pending = false;
+			this->frame_unchanged = true;
+#if RENDER_STATS
+			if (stats != NULL) {
+				// Same pixels as the last frame, so the same raster counters
+				frame_stats.raster_skipped = true;
+				frame_stats.meshes_occlusion_culled = this->last_stats.meshes_occlusion_culled;
+				frame_stats.tris_occlusion_culled = this->last_stats.tris_occlusion_culled;
+				frame_stats.tris_rasterized = this->last_stats.tris_rasterized;
+				frame_stats.pixels_tested = this->last_stats.pixels_tested;
+				frame_stats.pixels_written = this->last_stats.pixels_written;
+				frame_stats.pixels_covered = this->last_stats.pixels_covered;
+				frame_stats.collected = true;
+				frame_stats.total_ns = astd::getNanos() - start;
+				*stats = frame_stats;
+			}
+#endif
+			return (astd::getNanos() - start) / 1e9;
+		}
+		this->clearBuffers(this->clear_color);
+	}
+	bool on_clear = this->buffers_cleared;
+	this->frame_unchanged = !raster_changed && on_clear && this->last_frame_on_clear && this->clear_color == this->last_frame_color;
+
+	// Ids only mean something for the triangles of this frame, so pixels drawn by an earlier render() can't have one
+	bool write_ids = this->visibility_buffer && on_clear;
+	if (write_ids && this->id_buffer == NULL) {
+		size_t size = (size_t)this->width * (size_t)this->height;
+		this->id_buffer = newBuffer<U32>(this->allocation_count, size);
+		for (size_t p = 0; p < size; p++)
+			this->id_buffer[p] = NO_TRIANGLE;
+	}
+	U32* target = write_ids ? this->id_buffer : this->render_buffer;
+
+	// What happened to each binned triangle, gathered into stats at the end
+	IF_RENDER_STATS(U32* entry_tris = NULL); // Triangle of each entry, NULL when the entries are the triangles themselves
+	IF_RENDER_STATS(U32 entry_count = projected_tri_count);
+	U8* outcome = NULL;
+	IF_RENDER_STATS(U64 pixels_tested = 0, pixels_written = 0);
+
+	if (!tiled) {
+		RasterRegion region;
+		region.min_x = 0;
+		region.min_y = 0;
+		region.max_x = this->width;
+		region.max_y = this->height;
+		region.hiz_levels = HIZ_LEVELS;
+		region.dirty_blocks = this->arena.alloc<U32>((size_t)this->hiz_width[0] * this->hiz_height[0]);
+		region.target = target;
+		region.write_ids = write_ids;
+
+		outcome = this->arena.alloc<U8>(projected_tri_count);
+		IF_RENDER_STATS(now = astd::getNanos(); frame_stats.setup_ns += now - stage_start; stage_start = now);
+		this->dispatchDepth([&](const auto& format) { this->rasterizeRegion(format, region, NULL, projected_tri_count, outcome); });
+		IF_RENDER_STATS(pixels_tested = region.pixels_tested; pixels_written = region.pixels_written);
+	}
+	else {
+		if (this->thread_pool == NULL || this->thread_pool->size() != threads) {
+			delete this->thread_pool;
+			this->thread_pool = new astd::ThreadPool(threads);
+		}
+
+		U32 tiles_x = (this->width + this->tile_size - 1) / this->tile_size;
+		U32 tiles_y = (this->height + this->tile_size - 1) / this->tile_size;
+		size_t tile_count = (size_t)tiles_x * tiles_y;
+
+		// Get the range of tiles that the triangle's scanlines can touch, returns false if it covers none
+		auto pixel = [](Screen value) -> I64 { return (I64)Precision::toPixels(value); };
+		auto tileRange = [&](const ScreenTri<Precision>& tri, I64& tx0, I64& ty0, I64& tx1, I64& ty1) -> bool {
+			I64 min_x = std::min({ pixel(tri.a.x), pixel(tri.b.x), pixel(tri.c.x) });
+			I64 max_x = std::max({ pixel(tri.a.x), pixel(tri.b.x), pixel(tri.c.x) });
+			I64 min_y = std::min({ pixel(tri.a.y), pixel(tri.b.y), pixel(tri.c.y) });
+			I64 max_y = std::max({ pixel(tri.a.y), pixel(tri.b.y), pixel(tri.c.y) });
+			if (max_x < 0 || max_y < 0 || min_x >= this->width || min_y >= this->height)
+				return false;
+			tx0 = std::max<I64>(min_x, 0) / this->tile_size;
+			ty0 = std::max<I64>(min_y, 0) / this->tile_size;
+			tx1 = std::min<I64>(max_x, this->width - 1) / this->tile_size;
+			ty1 = std::min<I64>(max_y, this->height - 1) / this->tile_size;
+			return true;
+		};
+
+		// Bin the triangles into the tiles with a counting sort, which keeps the submission order inside each tile
+		U32* bin_start = this->arena.alloc<U32>(tile_count + 1);
+		for (size_t tile = 0; tile <= tile_count; tile++)
+			bin_start[tile] = 0;
+		for (U32 i = 0; i < projected_tri_count; i++) {
+			I64 tx0, ty0, tx1, ty1;
+			if (!tileRange(this->projected_tris[i], tx0, ty0, tx1, ty1))
+				continue;
+			for (I64 ty = ty0; ty <= ty1; ty++)
+				for (I64 tx = tx0; tx <= tx1; tx++)
+					bin_start[ty * tiles_x + tx + 1]++;
+		}
+		for (size_t tile = 0; tile < tile_count; tile++)
+			bin_start[tile + 1] += bin_start[tile];
+
+		U32* bin_fill = this->arena.alloc<U32>(tile_count);
+		for (size_t tile = 0; tile < tile_count; tile++)
+			bin_fill[tile] = bin_start[tile];
+		U32* bins = this->arena.alloc<U32>(bin_start[tile_count]);
+		for (U32 i = 0; i < projected_tri_count; i++) {
+			I64 tx0, ty0, tx1, ty1;
+			if (!tileRange(this->projected_tris[i], tx0, ty0, tx1, ty1))
+				continue;
+			for (I64 ty = ty0; ty <= ty1; ty++)
+				for (I64 tx = tx0; tx <= tx1; tx++)
+					bins[bin_fill[ty * tiles_x + tx]++] = i;
+		}
+
+		IF_RENDER_STATS(entry_tris = bins; entry_count = bin_start[tile_count]);
+		outcome = this->arena.alloc<U8>(bin_start[tile_count]);
+
+		// The levels of the pyramid a tile can refresh by itself, the ones above stay as they were during the pass
+		U32 tile_hiz_levels = 0;
+		while (tile_hiz_levels < HIZ_LEVELS && this->tile_size % (1 << (HIZ_BLOCK_BITS + tile_hiz_levels)) == 0)
+			tile_hiz_levels++;
+		size_t tile_blocks = ((size_t)this->tile_size >> HIZ_BLOCK_BITS) * ((size_t)this->tile_size >> HIZ_BLOCK_BITS);
+		U32* dirty_blocks = this->hiz_active ? this->arena.alloc<U32>(tile_blocks * tile_count) : NULL;
+		IF_RENDER_STATS(U64* tile_pixels_tested = this->arena.alloc<U64>(tile_count));
+		IF_RENDER_STATS(U64* tile_pixels_written = this->arena.alloc<U64>(tile_count));
+		IF_RENDER_STATS(now = astd::getNanos(); frame_stats.setup_ns += now - stage_start; stage_start = now);
+
+		// Each tile owns its own pixels of render_buffer, the depth buffer and the pyramid, so tiles never share writes
+		this->thread_pool->parallelFor(tile_count, [&](U64 tile) {
+			RasterRegion region;
+			region.min_x = (I64)(tile % tiles_x) * this->tile_size;
+			region.min_y = (I64)(tile / tiles_x) * this->tile_size;
+			region.max_x = std::min<I64>(region.min_x + this->tile_size, this->width);
+			region.max_y = std::min<I64>(region.min_y + this->tile_size, this->height);
+			region.hiz_levels = tile_hiz_levels;
+			region.dirty_blocks = this->hiz_active ? dirty_blocks + tile_blocks * tile : NULL;
+			region.target = target;
+			region.write_ids = write_ids;
+			this->dispatchDepth([&](const auto& format) {
+				this->rasterizeRegion(format, region, bins + bin_start[tile], bin_start[tile + 1] - bin_start[tile], outcome + bin_start[tile]);
+			});
+			IF_RENDER_STATS(tile_pixels_tested[tile] = region.pixels_tested; tile_pixels_written[tile] = region.pixels_written);
+		});
+		IF_RENDER_STATS(for (size_t tile = 0; tile < tile_count; tile++) {
+			pixels_tested += tile_pixels_tested[tile];
+			pixels_written += tile_pixels_written[tile];
+		});
+
+		// Bring the levels the tiles couldn't refresh up to date
+		if (this->hiz_active) {
+			this->dispatchDepth([&](const auto& format) {
+				typedef typename std::decay_t<decltype(format)>::Stored Stored;
+				for (U32 level = tile_hiz_levels == 0 ? 1 : tile_hiz_levels; level < HIZ_LEVELS; level++) {
+					Stored* cells = (Stored*)this->hiz + this->hiz_offset[level];
+					const Stored* children = (const Stored*)this->hiz + this->hiz_offset[level - 1];
+					for (U32 cy = 0; cy < this->hiz_height[level]; cy++) {
+						for (U32 cx = 0; cx < this->hiz_width[level]; cx++) {
+							Stored farthest = format.nearestLimit();
+							for (U32 child_y = cy * 2; child_y < std::min(cy * 2 + 2, this->hiz_height[level - 1]); child_y++)
+								for (U32 child_x = cx * 2; child_x < std::min(cx * 2 + 2, this->hiz_width[level - 1]); child_x++)
+									farthest = format.farther(farthest, children[(size_t)child_y * this->hiz_width[level - 1] + child_x]);
+							cells[(size_t)cy * this->hiz_width[level] + cx] = farthest;
+						}
+					}
+				}
+			});
+		}
+	}
+
+	IF_RENDER_STATS(now = astd::getNanos(); frame_stats.raster_ns += now - stage_start; stage_start = now);
+
+	// RESOLVE //
+
+	if (write_ids) {
+		// Colors in an array of their own, neighbouring pixels mostly show the same few triangles
+		U32* tri_colors = this->arena.alloc<U32>(projected_tri_count);
+		for (U32 i = 0; i < projected_tri_count; i++)
+			tri_colors[i] = this->projected_tris[i].color;
+
+		// Every pixel is colored once whatever the overdraw was, in bands of lines when there are threads for it
+		bool shaded = !this->tri_shades.empty();
+		auto resolve = [&](U32 first_line, U32 end_line) {
+			if (shaded)
+				this->template resolveLines<true>(tri_colors, first_line, end_line);
+			else
+				this->template resolveLines<false>(tri_colors, first_line, end_line);
+		};
+		if (tiled) {
+			U32 band_height = this->tile_size;
+			U32 band_count = (this->height + band_height - 1) / band_height;
+			this->thread_pool->parallelFor(band_count, [&](U64 band) {
+				resolve((U32)band * band_height, std::min((U32)(band + 1) * band_height, this->height));
+			});
+		}
+		else
+			resolve(0, this->height);
+		IF_RENDER_STATS(now = astd::getNanos(); frame_stats.resolve_ns += now - stage_start);
+	}
+	this->ids_valid = write_ids;
+
+#if RENDER_STATS
+	if (stats != NULL) {
+		// A triangle or a mesh only counts as culled if every tile it was binned into culled it
+		U8* tri_drawn = this->arena.alloc<U8>(projected_tri_count);
+		U8* tri_binned = this->arena.alloc<U8>(projected_tri_count);
+		U8* mesh_state = this->arena.alloc<U8>(mesh_count); // Bit 0: binned, bit 1: not culled as a whole somewhere
+		for (U32 i = 0; i < projected_tri_count; i++)
+			tri_drawn[i] = tri_binned[i] = 0;
+		for (size_t m = 0; m < mesh_count; m++)
+			mesh_state[m] = 0;
+
+		for (U32 e = 0; e < entry_count; e++) {
+			U32 tri = entry_tris != NULL ? entry_tris[e] : e;
+			U32 mesh = this->projected_tri_mesh[tri];
+			tri_binned[tri] = 1;
+			tri_drawn[tri] |= outcome[e] == RASTER_DRAWN;
+			mesh_state[mesh] |= outcome[e] == RASTER_MESH_CULLED ? 1 : 3;
+		}
+
+		for (U32 i = 0; i < projected_tri_count; i++) {
+			frame_stats.tris_occlusion_culled += tri_binned[i] && !tri_drawn[i];
+			frame_stats.tris_rasterized += tri_drawn[i];
+		}
+		for (size_t m = 0; m < mesh_count; m++)
+			frame_stats.meshes_occlusion_culled += mesh_state[m] == 1;
+
+		frame_stats.pixels_tested = pixels_tested;
+		frame_stats.pixels_written = pixels_written;
+		size_t size = (size_t)this->width * (size_t)this->height;
+		this->dispatchDepth([&](const auto& format) {
+			typedef typename std::decay_t<decltype(format)>::Stored Stored;
+			for (size_t p = 0; p < size; p++)
+				frame_stats.pixels_covered += ((const Stored*)this->depth_buffer)[p] != format.clearValue();
+		});
+
+		frame_stats.collected = true;
+		frame_stats.total_ns = astd::getNanos() - start;
+		*stats = frame_stats;
+	}
+	this->last_stats = frame_stats;
+#else
+	(void)stats;
+#endif
+
+	// Only a frame drawn on freshly cleared buffers can be reproduced by clearing to the same color
+	this->buffers_hold_frame = on_clear;
+	this->buffers_cleared = false;
+	this->last_frame_on_clear = on_clear;
+	this->last_frame_color = this->clear_color;
+
+	return (astd::getNanos() - start) / 1e9;
+}
+
+template <class Precision>
+template <class Format>
+void BasicRender3DLayer<Precision>::rasterizeRegion(const Format& format, RasterRegion& region, const U32* tri_indices, U32 count, U8* outcome) {
+	RegionState state;
+	// Ids are written alike whatever the shading, the resolve shades what's left visible
+	if (region.write_ids)
+		this->template rasterizeRun<Format, FlatShader>(format, region, tri_indices, 0, count, outcome, state);
+	else {
+		auto shadingAt = [&](U32 n) -> Shading { return this->mesh_shading[this->projected_tri_mesh[tri_indices != NULL ? tri_indices[n] : n]]; };
+		for (U32 first = 0, end; first < count; first = end) {
+			Shading shading = shadingAt(first);
+			for (end = first + 1; end < count && shadingAt(end) == shading; end++);
+			switch (shading) {
+			case Shading::Gouraud:
+				this->template rasterizeRun<Format, GouraudShader>(format, region, tri_indices, first, end, outcome, state);
+				break;
+			case Shading::TexturedNearest:
+				this->template rasterizeRun<Format, TexturedShader<false>>(format, region, tri_indices, first, end, outcome, state);
+				break;
+			case Shading::TexturedBilinear:
+				this->template rasterizeRun<Format, TexturedShader<true>>(format, region, tri_indices, first, end, outcome, state);
+				break;
+			default:
+				this->template rasterizeRun<Format, FlatShader>(format, region, tri_indices, first, end, outcome, state);
+			}
+		}
+	}
+
+	if (this->hiz_active)
+		this->refreshHiZ(format, region);
+}
+
+template <class Precision>
+template <class Format, class Shader>
+void BasicRender3DLayer<Precision>::rasterizeRun(const Format& format, RasterRegion& region, const U32* tri_indices, U32 first, U32 end,
+	U8* outcome, RegionState& state) {
+	for (U32 n = first; n < end; n++) {
+		U32 i = tri_indices != NULL ? tri_indices[n] : n;
+		const ScreenTri<Precision>& tri = this->projected_tris[i];
+
+		if (this->hiz_active) {
+			// Test the whole mesh once when its triangles start, after catching up with what the previous ones drew
+			U32 mesh = this->projected_tri_mesh[i];
+			if (mesh != state.current_mesh) {
+				state.current_mesh = mesh;
+				this->refreshHiZ(format, region);
+				state.since_refresh = 0;
+				const ScreenBounds& bounds = this->mesh_bounds[mesh];
+				state.mesh_hidden = bounds.cullable && this->isOccluded(format, region, (I64)std::floor(bounds.min_x), (I64)std::floor(bounds.min_y),
+					(I64)std::floor(bounds.max_x), (I64)std::floor(bounds.max_y), bounds.nearest);
+			}
+			if (state.mesh_hidden) {
+				outcome[n] = RASTER_MESH_CULLED;
+				continue;
+			}
+
+			if (++state.since_refresh >= HIZ_REFRESH_INTERVAL) {
+				this->refreshHiZ(format, region);
+				state.since_refresh = 0;
+			}
+
+			// The interpolated depths stay between the vertices', so the nearest point is one of the vertices
+			double nearest = std::min({ tri.a.z, tri.b.z, tri.c.z });
+			auto pixel = [](Screen value) -> I64 { return (I64)std::floor(Precision::toPixels(value)); };
+			if (this->isOccluded(format, region, pixel(std::min({ tri.a.x, tri.b.x, tri.c.x })), pixel(std::min({ tri.a.y, tri.b.y, tri.c.y })),
+				pixel(std::max({ tri.a.x, tri.b.x, tri.c.x })), pixel(std::max({ tri.a.y, tri.b.y, tri.c.y })), nearest)) {
+				outcome[n] = RASTER_TRI_CULLED;
+				continue;
+			}
+		}
+
+		outcome[n] = RASTER_DRAWN;
+		// The rasterizers interpolate the format's values instead of the camera depths
+		ScreenTri<Precision> value_tri = tri;
+		value_tri.a.z = format.toValue(tri.a.z);
+		value_tri.b.z = format.toValue(tri.b.z);
+		value_tri.c.z = format.toValue(tri.c.z);
+		// Only the shaders of shaded runs look at the triangle's shade
+		Shader shader(Shader::CONSTANT ? NULL : &this->tri_shades[this->projected_tri_shade[i]], region.write_ids ? i : tri.color);
+		this->rasterizeTri(format, value_tri, shader, region);
+	}
+}
+
+template <class Precision>
+template <class Format>
+bool BasicRender3DLayer<Precision>::isOccluded(const Format& format, const RasterRegion& region, I64 min_x, I64 min_y, I64 max_x, I64 max_y,
+	double nearest) const {
+	// Only the pixels of the region matter to it
+	min_x = std::max(min_x, region.min_x);
+	min_y = std::max(min_y, region.min_y);
+	max_x = std::min(max_x, region.max_x - 1);
+	max_y = std::min(max_y, region.max_y - 1);
+	if (min_x > max_x || min_y > max_y)
+		return true;
+
+	// Use the finest level where the box spans at most 2x2 cells, or the coarsest the region keeps up to date
+	U32 level = 0;
+	while (level + 1 < region.hiz_levels) {
+		U32 cell_bits = HIZ_BLOCK_BITS + level;
+		if ((max_x >> cell_bits) - (min_x >> cell_bits) <= 1 && (max_y >> cell_bits) - (min_y >> cell_bits) <= 1)
+			break;
+		level++;
+	}
+
+	U32 cell_bits = HIZ_BLOCK_BITS + level;
+	const typename Format::Stored* cells = (const typename Format::Stored*)this->hiz + this->hiz_offset[level];
+	for (I64 cy = min_y >> cell_bits; cy <= (max_y >> cell_bits); cy++)
+		for (I64 cx = min_x >> cell_bits; cx <= (max_x >> cell_bits); cx++)
+			if (format.mayPass(nearest, cells[cy * this->hiz_width[level] + cx])) // Something there might be farther than the nearest point
+				return false;
+	return true;
+}
+
+template <class Precision>
+void BasicRender3DLayer<Precision>::markWritten(RasterRegion& region, I64 x_first, I64 x_last, I64 line) {
+	if (!this->hiz_active)
+		return;
+	size_t row = (size_t)(line >> HIZ_BLOCK_BITS) * this->hiz_width[0];
+	for (I64 block = x_first >> HIZ_BLOCK_BITS; block <= (x_last >> HIZ_BLOCK_BITS); block++) {
+		if (!this->hiz_dirty[row + block]) {
+			this->hiz_dirty[row + block] = 1;
+			region.dirty_blocks[region.dirty_count++] = (U32)(row + block);
+		}
+	}
+}
+
+template <class Precision>
+template <class Format>
+void BasicRender3DLayer<Precision>::refreshHiZ(const Format& format, RasterRegion& region) {
+	typedef typename Format::Stored Stored;
+	Stored* hiz = (Stored*)this->hiz;
+	for (U32 d = 0; d < region.dirty_count; d++) {
+		U32 cell = region.dirty_blocks[d];
+		this->hiz_dirty[cell] = 0;
+
+		// Farthest depth of the block's pixels
+		U32 cx = cell % this->hiz_width[0];
+		U32 cy = cell / this->hiz_width[0];
+		U32 x_end = std::min((cx + 1) << HIZ_BLOCK_BITS, this->width);
+		U32 y_end = std::min((cy + 1) << HIZ_BLOCK_BITS, this->height);
+		Stored farthest = format.nearestLimit();
+		for (U32 y = cy << HIZ_BLOCK_BITS; y < y_end; y++) {
+			const Stored* depth_row = (const Stored*)this->depth_buffer + (size_t)y * this->width;
+			for (U32 x = cx << HIZ_BLOCK_BITS; x < x_end; x++)
+				farthest = format.farther(farthest, depth_row[x]);
+		}
+		hiz[cell] = farthest;
+
+		// Carry it up through the levels the region owns
+		for (U32 level = 1; level < region.hiz_levels; level++) {
+			cx >>= 1;
+			cy >>= 1;
+			const Stored* children = hiz + this->hiz_offset[level - 1];
+			farthest = format.nearestLimit();
+			for (U32 child_y = cy * 2; child_y < std::min(cy * 2 + 2, this->hiz_height[level - 1]); child_y++)
+				for (U32 child_x = cx * 2; child_x < std::min(cx * 2 + 2, this->hiz_width[level - 1]); child_x++)
+					farthest = format.farther(farthest, children[(size_t)child_y * this->hiz_width[level - 1] + child_x]);
+			hiz[this->hiz_offset[level] + (size_t)cy * this->hiz_width[level] + cx] = farthest;
+		}
+	}
+	region.dirty_count = 0;
+}
+
+template <class Precision>
+template <class Format, class Shader>
+void BasicRender3DLayer<Precision>::rasterizeTri(const Format& format, const ScreenTri<Precision>& value_tri, const Shader& shader, RasterRegion& region) {
+	if (this->raster_mode == RasterMode::EdgeFunction)
+		this->rasterizeTriEdges(format, value_tri, shader, region);
+	else
+		this->rasterizeTriScanline(format, value_tri, shader, region);
+}
+
+template <class Precision>
+template <bool SHADED>
+void BasicRender3DLayer<Precision>::resolveLines(const U32* tri_colors, U32 first_line, U32 end_line) {
+	// Pixels without a triangle keep the color they were cleared to
+	for (size_t line = first_line; line < end_line; line++) {
+		size_t p = line * this->width;
+		for (U32 x = 0; x < this->width; x++, p++) {
+			U32 id = this->id_buffer[p];
+			if (id == NO_TRIANGLE)
+				continue;
+			if constexpr (SHADED) {
+				U32 shade = this->projected_tri_shade[id];
+				this->render_buffer[p] = shade == NO_SHADE ? tri_colors[id] : shadePixel(this->tri_shades[shade], tri_colors[id], x, (I64)line);
+			}
+			else
+				this->render_buffer[p] = tri_colors[id];
+		}
+	}
+}
+
+// Scanline rasterizes a projected triangle, only touching the pixels inside the region
+template <class Precision>
+template <class Format, class Shader>
+void BasicRender3DLayer<Precision>::rasterizeTriScanline(const Format& format, const ScreenTri<Precision>& screen_tri, const Shader& shader,
+	RasterRegion& region) {
+	// Walked in pixels with the depth type as the number type
+	typedef BasicPoint3<Depth> LinePoint;
+	struct LineTri {
+		LinePoint a, b, c;
+	} projected_tri;
+	auto toLinePoint = [](const ScreenVertex<Precision>& vertex) -> LinePoint {
+		return LinePoint{ (Depth)Precision::toPixels(vertex.x), (Depth)Precision::toPixels(vertex.y), vertex.z };
+	};
+	projected_tri.a = toLinePoint(screen_tri.a);
+	projected_tri.b = toLinePoint(screen_tri.b);
+	projected_tri.c = toLinePoint(screen_tri.c);
 
 	// Lambda function for checking if a number is in a 1D line
 	auto inRange = [](I64 point, I64 a, I64 b) -> bool {
@@ -147,154 +1754,184 @@ double Render3DLayer::render() {
 		return false;
 	};
 
-	// For each triangle
-	for (U64 i = 0; i < projected_solid_tris.size(); i++) {
-		SolidTri& projected_tri = projected_solid_tris[i];
-		SolidTri& original_tri = passed_solid_tris[i];
-
 #ifdef DEBUG_TEXT
-		debug_text = 
-			"XYZ: " + std::to_string(this->position.x) + ", " + std::to_string(this->position.y) + ", " + std::to_string(this->position.z) + '\n' +
-			"YPR: " + std::to_string(this->rotation.x) + ", " + std::to_string(this->rotation.y) + ", " + std::to_string(this->rotation.z) + '\n' +
+	debug_text = 
+		"XYZ: " + std::to_string(this->position.x) + ", " + std::to_string(this->position.y) + ", " + std::to_string(this->position.z) + '\n' +
+		"YPR: " + std::to_string(this->rotation.x) + ", " + std::to_string(this->rotation.y) + ", " + std::to_string(this->rotation.z) + '\n' +
 
-			"ABC A... X:" + std::to_string(projected_tri.a.x) +
-			" Y:" + std::to_string(projected_tri.a.y) +
-			" Z:" + std::to_string(projected_tri.a.z) + '\n' +
+		"ABC A... X:" + std::to_string(projected_tri.a.x) +
+		" Y:" + std::to_string(projected_tri.a.y) +
+		" Z:" + std::to_string(projected_tri.a.z) + '\n' +
 
-			"ABC B... X:" + std::to_string(projected_tri.b.x) +
-			" Y:" + std::to_string(projected_tri.b.y) +
-			" Z:" + std::to_string(projected_tri.b.z) + '\n' + 
+		"ABC B... X:" + std::to_string(projected_tri.b.x) +
+		" Y:" + std::to_string(projected_tri.b.y) +
+		" Z:" + std::to_string(projected_tri.b.z) + '\n' + 
 
-			"ABC C... X:" + std::to_string(projected_tri.c.x) +
-			" Y:" + std::to_string(projected_tri.c.y) +
-			" Z:" + std::to_string(projected_tri.c.z) + '\n';
+		"ABC C... X:" + std::to_string(projected_tri.c.x) +
+		" Y:" + std::to_string(projected_tri.c.y) +
+		" Z:" + std::to_string(projected_tri.c.z) + '\n';
 #endif
 
-		// Get the highest and lowest Y line in the triangle
-		I64 top_line = projected_tri.a.y;
-		I64 bottom_line = projected_tri.c.y;
-		if (projected_tri.b.y < top_line)
-			top_line = projected_tri.b.y;
-		if (projected_tri.c.y < top_line)
-			top_line = projected_tri.c.y;
-		if (projected_tri.a.y > bottom_line)
-			bottom_line = projected_tri.a.y;
-		if (projected_tri.b.y > bottom_line)
-			bottom_line = projected_tri.b.y;
+	// Get the highest and lowest Y line in the triangle
+	I64 top_line = projected_tri.a.y;
+	I64 bottom_line = projected_tri.c.y;
+	if (projected_tri.b.y < top_line)
+		top_line = projected_tri.b.y;
+	if (projected_tri.c.y < top_line)
+		top_line = projected_tri.c.y;
+	if (projected_tri.a.y > bottom_line)
+		bottom_line = projected_tri.a.y;
+	if (projected_tri.b.y > bottom_line)
+		bottom_line = projected_tri.b.y;
 
 #ifdef DEBUG_TEXT
-		debug_text +=
-			"bottom_line: " + std::to_string(bottom_line) + '\n' +
-			"top_line: " + std::to_string(top_line) + "\n\n";
+	debug_text +=
+		"bottom_line: " + std::to_string(bottom_line) + '\n' +
+		"top_line: " + std::to_string(top_line) + "\n\n";
 #endif
 
-		// Iterate in the range of the lines
-		for (I64 line = top_line; line < bottom_line; line++) {
-			if (line < 0) {
-				line = -1;
-				continue;
-			}
-			if (line >= this->height)
-				break;
+	// Clip the lines to the region
+	if (top_line < region.min_y)
+		top_line = region.min_y;
+	if (bottom_line > region.max_y)
+		bottom_line = region.max_y;
 
-			// Get triangle lines' intersection with the scanning line
-			std::vector<Point3> line_points;
+	// The reversed formats' values are exact across the screen, so they're taken from their plane at the pixel centers
+	// instead of along the edges between truncated vertices. Spans can reach a little past the triangle, where the plane
+	// is kept from getting nearer than the nearest vertex so the occlusion test stays exact
+	double dzdx = 0, dzdy = 0, z_origin = projected_tri.a.z, z_max = 0;
+	if constexpr (Format::REVERSED) {
+		double ux = projected_tri.b.x - projected_tri.a.x, uy = projected_tri.b.y - projected_tri.a.y, uz = projected_tri.b.z - projected_tri.a.z;
+		double vx = projected_tri.c.x - projected_tri.a.x, vy = projected_tri.c.y - projected_tri.a.y, vz = projected_tri.c.z - projected_tri.a.z;
+		double det = ux * vy - uy * vx;
+		if (det != 0) {
+			dzdx = (uz * vy - vz * uy) / det;
+			dzdy = (vz * ux - uz * vx) / det;
+			z_origin = projected_tri.a.z + dzdx * (0.5 - projected_tri.a.x) + dzdy * (0.5 - projected_tri.a.y);
+		}
+		z_max = std::max({ projected_tri.a.z, projected_tri.b.z, projected_tri.c.z });
+	}
+	auto planeValue = [&](I64 x, I64 y) -> Depth { return (Depth)std::min(z_origin + dzdx * x + dzdy * y, z_max); };
 
-			if (inRange(line, projected_tri.a.y, projected_tri.b.y)) {
-				line_points.push_back(projected_tri.a);
-				line_points.push_back(projected_tri.b);
-			}
-			if (inRange(line, projected_tri.b.y, projected_tri.c.y)) {
-				line_points.push_back(projected_tri.b);
-				line_points.push_back(projected_tri.c);
-			}
-			if (inRange(line, projected_tri.c.y, projected_tri.a.y)) {
-				line_points.push_back(projected_tri.c);
-				line_points.push_back(projected_tri.a);
-			}
-			if (line_points.size() < 4)
-				continue;
+	// Iterate in the range of the lines
+	for (I64 line = top_line; line < bottom_line; line++) {
+		// Get triangle lines' intersection with the scanning line, at most 3 edges so it fits on the stack
+		LinePoint line_points[6];
+		U32 line_point_count = 0;
 
-			Point3& a1 = line_points[0];
-			Point3& a2 = line_points[1];
-			Point3& b1 = line_points[2];
-			Point3& b2 = line_points[3];
-
-			// Map to get the X coordinate of the scanned line
-			I64 ax = remap(line, (I64)a1.y, (I64)a2.y, (I64)a1.x, (I64)a2.x);
-			I64 bx = remap(line, (I64)b1.y, (I64)b2.y, (I64)b1.x, (I64)b2.x);
-
-			// Also... depth/z
-			double az = remap(line, (I64)a1.y, (I64)a2.y, a1.z, a2.z);
-			double bz = remap(line, (I64)b1.y, (I64)b2.y, b1.z, b2.z);
-
-			// Swap if ax is greater than bx
-			if (ax > bx) {
-				I64 cx = ax;
-				double cz = az;
-				ax = bx;
-				az = bz;
-				bx = cx;
-				bz = cz;
-			}
+		if (inRange(line, projected_tri.a.y, projected_tri.b.y)) {
+			line_points[line_point_count++] = projected_tri.a;
+			line_points[line_point_count++] = projected_tri.b;
+		}
+		if (inRange(line, projected_tri.b.y, projected_tri.c.y)) {
+			line_points[line_point_count++] = projected_tri.b;
+			line_points[line_point_count++] = projected_tri.c;
+		}
+		if (inRange(line, projected_tri.c.y, projected_tri.a.y)) {
+			line_points[line_point_count++] = projected_tri.c;
+			line_points[line_point_count++] = projected_tri.a;
+		}
+		if (line_point_count < 4)
+			continue;
 
-			// Calculate depth step in each pixel of the line
-			double step = 0;
-			if (bx - ax != 0)
-				step = (double)(bz - az) / (double)(bx - ax);
-			double depth_steps = az - step;
-			U64 line_dry = line * this->width;
+		LinePoint& a1 = line_points[0];
+		LinePoint& a2 = line_points[1];
+		LinePoint& b1 = line_points[2];
+		LinePoint& b2 = line_points[3];
+
+		// Map to get the X coordinate of the scanned line
+		I64 ax = remap(line, (I64)a1.y, (I64)a2.y, (I64)a1.x, (I64)a2.x);
+		I64 bx = remap(line, (I64)b1.y, (I64)b2.y, (I64)b1.x, (I64)b2.x);
+
+		// Also... depth/z
+		Depth az, bz;
+		if constexpr (Format::REVERSED) {
+			az = planeValue(ax, line);
+			bz = planeValue(bx, line);
+		}
+		else {
+			az = (Depth)remap(line, (I64)a1.y, (I64)a2.y, a1.z, a2.z);
+			bz = (Depth)remap(line, (I64)b1.y, (I64)b2.y, b1.z, b2.z);
+		}
+
+		// Swap if ax is greater than bx
+		if (ax > bx) {
+			I64 cx = ax;
+			Depth cz = az;
+			ax = bx;
+			az = bz;
+			bx = cx;
+			bz = cz;
+		}
+
+		// Calculate depth step in each pixel of the line
+		Depth step = 0;
+		if (bx - ax != 0)
+			step = (bz - az) / (Depth)(bx - ax);
+		U64 line_dry = line * this->width;
+		typename Format::Stored* depth_buffer = (typename Format::Stored*)this->depth_buffer;
 
 #ifdef DEBUG_TEXT
-			debug_text +=
-				"line: " + std::to_string(line) + '\n' +
-				"ax: " + std::to_string(ax) + '\n' +
-				"bx: " + std::to_string(bx) + '\n' +
-				"az: " + std::to_string(az) + '\n' +
-				"bz: " + std::to_string(bz) + '\n' +
-				"step: " + std::to_string(step) + '\n';
+		debug_text +=
+			"line: " + std::to_string(line) + '\n' +
+			"ax: " + std::to_string(ax) + '\n' +
+			"bx: " + std::to_string(bx) + '\n' +
+			"az: " + std::to_string(az) + '\n' +
+			"bz: " + std::to_string(bz) + '\n' +
+			"step: " + std::to_string(step) + '\n';
 #endif
 
+		// Clip the span to the region, pixels outside of it belong to another tile or are off screen
+		I64 start_x = ax < region.min_x ? region.min_x : ax;
+		I64 end_x = bx > region.max_x ? region.max_x : bx;
 
-			U64 am = 0;
-			// Each pixel of the scanned line
-			for (I64 x = ax; x < bx; x++) {
-				// Add the depth step
-				depth_steps += step;
+		U64 am = 0;
+		I64 first_written = end_x, last_written = start_x;
+		// Each pixel of the scanned line
+		for (I64 x = start_x; x < end_x; x++) {
+			// The depth is evaluated from the start of the span instead of being accumulated,
+			// so a pixel gets the same depth no matter which region rasterizes it
+			Depth depth_steps = az + step * (Depth)(x - ax);
 
-				if (x < 0) { // The pixel is to the left of the screen, skip to the X 0
-					depth_steps += step * -x;
-					x = -1;
-					continue;
-				}
-				if (x >= this->width) // The pixel is to the right, skip to the next line
-					break;
-
-				if (depth_steps <= this->near_clipping) {
-					if (step <= 0)
-						break;
-					else {
-						double skip = this->near_clipping - depth_steps;
-						depth_steps += skip;
-						x += skip / step;
-						continue;
-					}
-				}
-
-				// If it's in front of the previous pixel's depth, render it
-				if (depth_buffer[x + line_dry] >= depth_steps) {
-					depth_buffer[x + line_dry] = depth_steps;
-					this->render_buffer[x + line_dry] = projected_tri.color;
-					am++;
-				}
+			// If it's in front of the previous pixel's depth, render it
+			IF_RENDER_STATS(region.pixels_tested++);
+			typename Format::Stored stored = format.encode(depth_steps);
+			if (Format::passes(stored, depth_buffer[x + line_dry])) {
+				depth_buffer[x + line_dry] = stored;
+				region.target[x + line_dry] = shader.shade(x, line);
+				am++;
+				if (x < first_written)
+					first_written = x;
+				last_written = x;
 			}
+		}
+		if (am != 0)
+			this->markWritten(region, first_written, last_written, line);
+		IF_RENDER_STATS(region.pixels_written += am);
 
 #ifdef DEBUG_TEXT
-			debug_text += "am: " + std::to_string(am) + "\n\n";
+		debug_text += "am: " + std::to_string(am) + "\n\n";
 #endif
-		}
 	}
-
-	delete[] depth_buffer;
-	return astd::getTime() - start;
 }
+
+template class BasicRender3DLayer<DoublePrecision>;
+template class BasicRender3DLayer<FloatPrecision>;
+template class BasicRender3DLayer<FixedPrecision>;
+
+// The edge rasterizer falls back to the scanline one for every format and shader
+#define INSTANTIATE_SCANLINE(Precision, Format, Shader) \
+	template void BasicRender3DLayer<Precision>::rasterizeTriScanline(const Format<Precision::Depth>&, const ScreenTri<Precision>&, const Shader&, RasterRegion&);
+#define INSTANTIATE_SCANLINE_SHADERS(Precision, Format) \
+	INSTANTIATE_SCANLINE(Precision, Format, FlatShader) \
+	INSTANTIATE_SCANLINE(Precision, Format, GouraudShader) \
+	INSTANTIATE_SCANLINE(Precision, Format, TexturedShader<false>) \
+	INSTANTIATE_SCANLINE(Precision, Format, TexturedShader<true>)
+#define INSTANTIATE_SCANLINE_FORMATS(Precision) \
+	INSTANTIATE_SCANLINE_SHADERS(Precision, LinearDepth) \
+	INSTANTIATE_SCANLINE_SHADERS(Precision, ReversedFloatDepth) \
+	INSTANTIATE_SCANLINE_SHADERS(Precision, Unorm24Depth) \
+	INSTANTIATE_SCANLINE_SHADERS(Precision, Unorm16Depth)
+INSTANTIATE_SCANLINE_FORMATS(DoublePrecision)
+INSTANTIATE_SCANLINE_FORMATS(FloatPrecision)
+INSTANTIATE_SCANLINE_FORMATS(FixedPrecision)
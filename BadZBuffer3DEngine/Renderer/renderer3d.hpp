@@ -1,6 +1,11 @@
 #pragma once
 #include "../astd.hpp"
 #include "math.hpp"
+#include "vertex_transform.hpp"
+#include "bounds.hpp"
+#include "precision.hpp"
+#include "depth_format.hpp"
+#include "shading.hpp"
 
 extern sf::String debug_text;
 
@@ -9,12 +14,362 @@ struct SolidTri {
 	U32 color = 0xFFFFFFFF;
 };
 
+// Which triangles of a mesh are skipped by their winding on screen
+// Front faces are the ones isClockwise() sees as counter-clockwise, which is the outside of OBJ models as they're loaded
+enum class CullMode {
+	None,
+	Back,
+	Front
+};
+
+// Bounds of a mesh's local geometry and the id layers know its geometry by, shared by every kind of mesh
+// Changes to the geometry are tracked by a generation that invalidate() bumps, every edit in place and every replacement
+// of the buffers needs it: a copy of the same size can reuse the old buffer, which then looks unchanged
+// Buffers that were resized or moved elsewhere are caught without it, so the bounds never cover a buffer that's gone
+struct GeometryState {
+	Bounds3 bounds;
+	// Version of the geometry, new after every change refresh() saw. Layers key the projected vertices they keep
+	// and the frames reuse_unchanged_frames keeps on it, so geometry changed without invalidate() draws as it was
+	U64 id = 0;
+
+	// Gives a new id when the generation or the buffers changed since the last call. Returns true when the caller has
+	// to compute the bounds again, which the triangles alone don't need since the bounds only cover the points
+	bool refresh(const void* points, size_t point_count, const void* tris = NULL, size_t tri_count = 0);
+	void invalidate() { this->generation++; }
+
+private:
+	U64 generation = 1;
+	U64 refreshed_generation = 0; // generation at the last refresh
+	const void* points = NULL;
+	size_t point_count = 0;
+	const void* tris = NULL;
+	size_t tri_count = 0;
+};
+
 struct Mesh {
 	Point3 position, rotation;
 	std::vector<SolidTri> solid_tris;
+	CullMode cull_mode = CullMode::None;
+
+	// Local space bounds of solid_tris and their geometry id, see GeometryState
+	const Bounds3& getBounds();
+	U64 getGeometryId();
+	// Needed after every change to solid_tris, colors included, unless it was resized
+	void invalidateGeometry();
+
+private:
+	GeometryState geometry;
+};
+
+// Mesh stored in a quarter of the memory, 20 bytes a triangle against the 80 of a SolidTri, made by compressMesh()
+// Every corner is quantized to 16 bits an axis across the bounds, so it's at origin + corner * step in local space,
+// and the colors are indices in a palette. The projection dequantizes the corners as it reads them
+// A corner is at most half a step off on each axis, so getErrorBound() is half a step's diagonal: the bounds' diagonal / 131070
+// On screen it's the bound times the fov scale over the depth, under a pixel while the diagonal spans fewer than 131070 pixels
+struct CompactMesh {
+	Point3 position, rotation;
+	CullMode cull_mode = CullMode::None;
+	Point3 origin, step;
+	std::vector<QuantizedPoint> corners; // 3 a triangle
+	std::vector<U16> color_indices; // In palette, one a triangle, empty when colors holds them
+	std::vector<U32> palette;
+	std::vector<U32> colors; // The triangles' colors as they are, only when they don't fit in a palette of 65536
+
+	U32 getColor(size_t tri) const {
+		return this->color_indices.empty() ? this->colors[tri] : this->palette[this->color_indices[tri]];
+	}
+	Point3 getCorner(size_t corner) const {
+		const QuantizedPoint& point = this->corners[corner];
+		return Point3{ this->origin.x + point.x * this->step.x, this->origin.y + point.y * this->step.y, this->origin.z + point.z * this->step.z };
+	}
+	size_t getTriCount() const { return this->corners.size() / 3; }
+	// Farthest a corner may be from where it was in the source mesh, in local units
+	double getErrorBound() const;
+	// Bytes of the corners and colors
+	size_t getMemorySize() const;
+
+	// Local space bounds of the dequantized corners and their geometry id, see GeometryState
+	const Bounds3& getBounds();
+	U64 getGeometryId();
+	// Needed after every change to the corners, colors or palette, unless corners was resized
+	void invalidateGeometry();
+
+private:
+	GeometryState geometry;
+};
+
+// Quantizes the mesh's triangles into a compact mesh with the same placement and cull mode
+CompactMesh compressMesh(const Mesh& mesh);
+
+// Triangle referring to the vertices of an IndexedMesh
+struct IndexedTri {
+	U32 a, b, c;
+	U32 color = 0xFFFFFFFF;
+};
+
+// Simplified copy of a mesh's vertices and triangles, see buildLods()
+struct MeshLod {
+	std::vector<Point3> vertices;
+	std::vector<IndexedTri> tris;
+	double error = 0; // Root of the largest quadric error of the collapses, about how far the surface moved in local units
+};
+
+// Mesh whose triangles share vertices, each vertex is only converted once per frame
+struct IndexedMesh {
+	Point3 position, rotation;
+	std::vector<Point3> vertices;
+	std::vector<IndexedTri> tris;
+	CullMode cull_mode = CullMode::None;
+	// Coarser and coarser levels of detail, the layer draws the coarsest whose error is small enough on screen
+	// They have to be rebuilt after editing the mesh, and need invalidateGeometry() when replaced
+	// Shaded meshes are always drawn in full, their levels don't carry the vertex attributes
+	std::vector<MeshLod> lods;
+	// Drawn flat unless the attributes the shading needs are there, one per vertex: vertex_colors for Gouraud,
+	// vertex_uvs and a texture for the textured shadings, whose texels are multiplied by the triangles' colors
+	// Changed attributes need invalidateGeometry(), the texture shouldn't be edited while a layer renders it
+	Shading shading = Shading::Flat;
+	std::vector<U32> vertex_colors;
+	std::vector<Point2> vertex_uvs;
+	std::shared_ptr<const Texture> texture;
+
+	// Local space bounds of vertices and the geometry id of vertices and tris, see GeometryState
+	const Bounds3& getBounds();
+	U64 getGeometryId();
+	// Needed after every change to vertices, tris or the vertex attributes, unless vertices or tris was resized
+	void invalidateGeometry();
+
+private:
+	GeometryState geometry;
+};
+
+// Indexed geometry shared by any number of MeshInstances, which keep it alive through their references
+// Its bounds are computed once for all of them, so it shouldn't be edited while a layer renders it, and it needs
+// invalidateGeometry() after changes the same as an IndexedMesh
+struct MeshGeometry {
+	std::vector<Point3> vertices;
+	std::vector<IndexedTri> tris;
+	CullMode cull_mode = CullMode::None;
+	std::vector<MeshLod> lods; // Same as IndexedMesh::lods
+	// Same as those of IndexedMesh, instances tint the vertex colors and the texels
+	Shading shading = Shading::Flat;
+	std::vector<U32> vertex_colors;
+	std::vector<Point2> vertex_uvs;
+	std::shared_ptr<const Texture> texture;
+
+	// Same as those of IndexedMesh
+	const Bounds3& getBounds();
+	U64 getGeometryId();
+	void invalidateGeometry();
+
+private:
+	GeometryState geometry;
+};
+
+// Moves the mesh's vertices, triangles and levels of detail into a new geometry that instances can share
+std::shared_ptr<MeshGeometry> shareGeometry(IndexedMesh&& mesh);
+
+// Placement of a shared geometry, only the transform and the tint are stored per instance
+struct MeshInstance {
+	std::shared_ptr<MeshGeometry> geometry;
+	Point3 position, rotation;
+	U32 tint = 0xFFFFFFFF; // Multiplies every channel of the triangle colors, white keeps them as they are
+};
+
+class ClusterStream;
+
+// Placement of a cluster stream (see cluster_stream.hpp), a layer draws whichever of its clusters are loaded
+// when it renders and steers the stream's loaders with its camera
+struct StreamedMesh {
+	std::shared_ptr<ClusterStream> stream;
+	Point3 position, rotation;
+	CullMode cull_mode = CullMode::None;
+};
+
+// A mesh of any kind as render() sees it, gathered once per frame and shared by every view rendering it
+// Everything points into the layer's meshes, which can't change until the views are rendered
+struct SceneMesh {
+	Transform3 model; // Local space to world space
+	const Bounds3* bounds = NULL; // NULL for an instance without geometry, which draws nothing
+	U64 geometry_id = 0;
+	CullMode cull_mode = CullMode::None;
+	U32 tint = 0xFFFFFFFF;
+	const std::vector<SolidTri>* solid_tris = NULL; // Set for a Mesh, whose triangles have corners of their own
+	const CompactMesh* compact = NULL; // Set for a CompactMesh, whose triangles also have corners of their own
+	const std::vector<Point3>* vertices = NULL; // Set for indexed meshes and instances
+	const std::vector<IndexedTri>* tris = NULL;
+	const std::vector<MeshLod>* lods = NULL;
+	size_t tri_count = 0; // Triangles of the full mesh
+	// Flat unless the mesh has everything its shading needs
+	Shading shading = Shading::Flat;
+	const std::vector<U32>* vertex_colors = NULL;
+	const std::vector<Point2>* vertex_uvs = NULL;
+	const Texture* texture = NULL;
+};
+
+// Allocator of the vectors a layer keeps across frames, counting every allocation into counter for getAllocationCount()
+template <class T>
+struct CountingAllocator {
+	typedef T value_type;
+	U64* counter = NULL;
+
+	CountingAllocator() = default;
+	explicit CountingAllocator(U64* counter) : counter(counter) {}
+	template <class U>
+	CountingAllocator(const CountingAllocator<U>& other) : counter(other.counter) {}
+
+	T* allocate(size_t count) {
+		if (this->counter != NULL)
+			(*this->counter)++;
+		return std::allocator<T>().allocate(count);
+	}
+	void deallocate(T* ptr, size_t count) { std::allocator<T>().deallocate(ptr, count); }
+
+	template <class U>
+	bool operator==(const CountingAllocator<U>& other) const { return this->counter == other.counter; }
+	template <class U>
+	bool operator!=(const CountingAllocator<U>& other) const { return this->counter != other.counter; }
+};
+
+template <class T>
+using CountedVector = std::vector<T, CountingAllocator<T>>;
+
+// Bump allocator for the data a frame needs, everything it hands out is released at once by reset()
+// Once it has grown to the frame's peak usage, later frames are served without touching the heap
+class FrameArena {
+public:
+	U64 allocation_count = 0; // Heap allocations made by the arena so far
+
+	FrameArena() = default;
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+	~FrameArena();
+
+	// Releases everything handed out, merges the blocks into one if the frame overflowed
+	void reset();
+
+	// Uninitialized storage for count elements of a trivially copyable type, 64 bytes aligned
+	template <class T>
+	T* alloc(size_t count) {
+		static_assert(std::is_trivially_copyable<T>::value, "FrameArena never runs constructors or destructors");
+		return (T*)this->allocBytes(count * sizeof(T));
+	}
+
+private:
+	U8* block = NULL;
+	size_t capacity = 0;
+	size_t used = 0;
+	size_t overflow_used = 0; // Bytes served by overflow blocks this frame
+	CountedVector<std::pair<U8*, size_t>> overflow{ CountingAllocator<U8>(&this->allocation_count) };
+
+	void* allocBytes(size_t size);
+	U8* newBlock(size_t size);
+};
+
+// Render statistics are collected unless built with NDEBUG, RENDER_STATS set to 1 or 0 overrides it
+// Without them every counter and timer is compiled out and render() leaves the stats untouched
+#ifndef RENDER_STATS
+#ifdef NDEBUG
+#define RENDER_STATS 0
+#else
+#define RENDER_STATS 1
+#endif
+#endif
+
+// Keeps the statement only in builds that collect render statistics
+#if RENDER_STATS
+#define IF_RENDER_STATS(...) __VA_ARGS__
+#else
+#define IF_RENDER_STATS(...)
+#endif
+
+// Timings and counters of a render() call
+struct RenderStats {
+	bool collected = false; // Set by render() when the build collects statistics
+
+	// Nanoseconds spent in each stage, from a monotonic clock
+	U64 transform_ns = 0; // Projecting the vertices of the meshes left after frustum culling
+	U64 cull_ns = 0; // Frustum culling the meshes and assembling, culling and clipping the projected triangles
+	U64 setup_ns = 0; // Ordering the triangles front to back and binning them into tiles
+	U64 raster_ns = 0; // Rasterizing, along with the occlusion tests
+	U64 resolve_ns = 0; // Coloring the visible pixels from the visibility buffer, see BasicRender3DLayer::visibility_buffer
+	U64 total_ns = 0;
+
+	U64 tris_in = 0; // Triangles of every mesh at the level of detail it was drawn at
+	U64 meshes_lod_reduced = 0; // Meshes drawn at one of their simplified levels of detail
+	U64 tris_lod_removed = 0; // Triangles the simplified levels had less than their full meshes
+	U64 meshes_frustum_culled = 0; // Meshes whose bounds were outside the view, skipped before transforming anything
+	U64 tris_frustum_culled = 0; // Triangles of those meshes
+	U64 tris_near_far_culled = 0; // Triangles entirely in front of the near clipping or behind the far clipping
+	U64 tris_viewport_culled = 0; // Triangles entirely on one side outside the screen
+	U64 tris_backface_culled = 0; // Triangles skipped by their mesh's cull_mode
+	U64 tris_clipped = 0; // Triangles crossing the near clipping or the guard band, cut into the pieces that were kept
+	U64 meshes_occlusion_culled = 0; // Meshes whose screen bounds were hidden, skipped without looking at their triangles
+	U64 tris_occlusion_culled = 0; // Triangles skipped because the hierarchical depth showed them hidden, including those of culled meshes
+	U64 tris_rasterized = 0; // Triangles handed to the rasterizer
+
+	U64 meshes_projected = 0; // Meshes whose vertices were projected, the others reused their projection from an earlier frame
+	bool geometry_reused = false; // Nothing the triangles depend on changed, the last frame's were rasterized again
+	bool raster_skipped = false; // The buffers already held this frame, see reuse_unchanged_frames
+
+	U64 pixels_tested = 0; // Pixels covered by a triangle that went through the depth test
+	U64 pixels_written = 0; // Pixels that passed the depth test, a pixel covered several times counts every time
+	U64 pixels_covered = 0; // Pixels of the depth buffer holding a depth after rendering
+
+	// Times an on-screen pixel was written on average, 1 means nothing was drawn over anything
+	double getOverdraw() const {
+		return this->pixels_covered == 0 ? 0 : (double)this->pixels_written / this->pixels_covered;
+	}
+};
+
+// Part of the screen rasterized by one thread, along with the occlusion state only it updates
+struct RasterRegion {
+	I64 min_x, min_y, max_x, max_y;
+	U32 hiz_levels = 0; // Pyramid levels whose cells lie entirely inside the region, which the region keeps up to date
+	U32* dirty_blocks = NULL; // Level 0 cells written since the last refresh
+	U32 dirty_count = 0;
+	U32* target; // render_buffer, or the visibility buffer when write_ids
+	bool write_ids = false; // Pixels get the index of their triangle in the frame's triangles instead of its color
+	U64 pixels_tested = 0, pixels_written = 0;
+};
+
+// What a pixel of the visibility buffer shows
+struct PickResult {
+	U32 mesh; // Index in the layer's order: meshes first, then indexed meshes, instances, compact meshes and the loaded clusters of streamed meshes
+	U32 tri; // Index in the triangles of the level of detail the mesh was drawn at
+	U32 lod; // 0 for the full mesh, otherwise its level of detail lods[lod - 1]
+	double depth; // Depth of the pixel
+};
+
+// Projected bounds of a mesh for occlusion tests
+struct ScreenBounds {
+	double min_x, min_y, max_x, max_y;
+	double nearest;
+	bool cullable; // Only if every vertex is in front of the near clipping, otherwise the projection can't be trusted
+};
+
+// Vertex of a projected triangle in the precision's screen coordinates, z is the depth
+template <class Precision>
+struct ScreenVertex {
+	typename Precision::Screen x, y;
+	typename Precision::Depth z;
+};
+
+template <class Precision>
+struct ScreenTri {
+	ScreenVertex<Precision> a, b, c;
+	U32 color;
 };
 
-class Render3DLayer {
+// How triangles are turned into pixels
+enum class RasterMode {
+	Scanline, // Walks the triangle line by line, interpolating the edges
+	EdgeFunction // Tests pixels against the triangle's edge functions in 8x8 blocks, 4 pixels at a time
+};
+
+// Precision picks the number types of everything after the projection, see precision.hpp
+// Render3DLayer is the double precision layer, the others trade accuracy for speed
+template <class Precision>
+class BasicRender3DLayer {
 public:
 	U32 width, height;
 	U32* render_buffer;
@@ -22,9 +377,262 @@ public:
 	Point3 position = Point3{ 0, 0, 0 };
 	Point3 rotation = Point3{ 0, 0, 0 };
 	std::vector<Mesh> meshes;
+	std::vector<IndexedMesh> indexed_meshes;
+	// Instances are grouped by geometry, so the vertices of a geometry are read by its instances one after another
+	std::vector<MeshInstance> instances;
+	std::vector<CompactMesh> compact_meshes;
+	// Drawn after the compact meshes, with the clusters their streams have loaded by the time render() starts
+	// The streams plan their loads for this layer's camera, renderViews() steers them with the camera of the layer it's called on
+	std::vector<StreamedMesh> streamed_meshes;
+
+	// Number of threads used to rasterize, above 1 the screen is split in tiles that are rasterized in parallel
+	U32 thread_count = 1;
+	// Width and height in pixels of a tile when rasterizing with more than one thread
+	U32 tile_size = 64;
+	// Rasterizer used by render(), can be switched between frames
+	RasterMode raster_mode = RasterMode::Scanline;
+	// Skips triangles and meshes that the hierarchical depth shows are hidden, never changes the output
+	// With more than one thread it needs tile_size to be a multiple of 8
+	bool occlusion_culling = true;
+	// Draws the meshes nearest first and the triangles of each mesh in coarse depth buckets nearest first,
+	// so the depth test rejects more of the hidden pixels before they're written
+	bool front_to_back = true;
+	// When nothing changed since the last frame, clear() leaves the buffers as they are and render() doesn't rasterize,
+	// which only holds if nothing else writes into render_buffer between frames. Meshes are seen as changed by their
+	// geometry ids, so one edited without invalidateGeometry() shows the previous frame
+	bool reuse_unchanged_frames = false;
+	// Largest error in pixels a level of detail may have where its mesh is nearest to the camera, 0 draws every mesh fully
+	double lod_pixel_error = 1;
+	// Rasterizes only the depths and the ids of the triangles, then colors each visible pixel once from its triangle,
+	// so overdrawn pixels never pay for shading. Only a render() right after clear() can use it, others write colors directly
+	bool visibility_buffer = false;
+	// How the depth buffer stores depths, see depth_format.hpp. Takes effect at the next clear(), which reallocates the buffer
+	// The reversed formats interpolate 1 / depth, which is exact across the screen, in 4 or 2 bytes a pixel
+	// Unorm24 and Unorm16 spread their steps between the clippings, so they should be set before the frame is cleared
+	DepthFormat depth_format = DepthFormat::Linear;
 
-	Render3DLayer(U32 w, U32 h, double camera_fov, double far_clip, double near_clip);
-	~Render3DLayer();
+	BasicRender3DLayer(U32 w, U32 h, double camera_fov, double far_clip, double near_clip);
+	~BasicRender3DLayer();
+	// Reallocates render_buffer and the depth buffer if the size changed, their content is undefined until clear()
+	void resize(U32 w, U32 h);
+	// Clears render_buffer to the color and the depth buffer to the farthest depth, returns the seconds it took
+	// With reuse_unchanged_frames the clear is held back until render() knows if the frame changed
 	double clear(U32 color = 0xFF000000);
-	double render();
-};
\ No newline at end of file
+	// Renders the meshes on top of the current buffers, returns the seconds it took
+	// stats is filled when the build collects statistics, see RENDER_STATS
+	double render(RenderStats* stats = NULL);
+	// Renders the meshes of this layer through every view, for stereo, split screen or the faces of a cubemap
+	// Each view is a layer of its own with its camera, size, settings and buffers, its own meshes are ignored
+	// The meshes, their bounds and world transforms are gathered once, then the views are rendered in parallel
+	// on up to thread_count threads, each still tiling with its own thread_count. This layer may be one of the views
+	// view_stats is NULL or has one RenderStats per view, the shared gathering isn't part of any of them
+	// Returns the seconds it took
+	double renderViews(BasicRender3DLayer* const* views, size_t view_count, RenderStats* view_stats = NULL);
+	// Total heap allocations done by the layer's buffers, vectors and frame arena, stays the same across frames of an unchanged scene
+	U64 getAllocationCount() const;
+	// Replaces render_buffer with another width * height buffer allocated with new[] and returns the old one,
+	// so a finished frame can be shown while the next one is rendered. The layer frees whichever buffer it holds
+	U32* swapRenderBuffer(U32* buffer);
+	// The last render() drew the same frame as the one before it, clearing to the same color first
+	bool isFrameUnchanged() const;
+	// Ids of the triangles seen at every pixel of the last render(), NULL unless it used visibility_buffer
+	// The ids are only meaningful to pick(), they change whenever the frame's triangles do
+	const U32* getVisibilityBuffer() const;
+	// Finds what the last render() drew at the pixel from the visibility buffer, false if nothing or if it didn't use one
+	bool pick(U32 x, U32 y, PickResult& result) const;
+
+private:
+	typedef typename Precision::Screen Screen;
+	typedef typename Precision::Depth Depth;
+
+	// Hierarchical depth, level 0 cells cover 8x8 pixels and every level doubles the cell size
+	static const U32 HIZ_BLOCK_BITS = 3;
+	static const U32 HIZ_LEVELS = 4;
+	// Triangles a region draws between refreshes of the pyramid, besides the refresh at the start of every mesh
+	static const U32 HIZ_REFRESH_INTERVAL = 32;
+	// What happened to a binned triangle
+	static const U8 RASTER_DRAWN = 0;
+	static const U8 RASTER_TRI_CULLED = 1;
+	static const U8 RASTER_MESH_CULLED = 2;
+	// Depth buckets every mesh's triangles are sorted into when drawing front to back
+	static const U32 TRI_DEPTH_BUCKETS = 16;
+	// Id of the pixels of the visibility buffer no triangle covers
+	static const U32 NO_TRIANGLE = 0xFFFFFFFF;
+	// Shade of the triangles of flat meshes, which only need their color
+	static const U32 NO_SHADE = 0xFFFFFFFF;
+	// Pixels the screen is extended by on every side before triangles get clipped to its sides,
+	// only triangles reaching this far off screen are clipped, the rasterizers skip the rest of what's off screen
+	static constexpr double GUARD_BAND = 4096;
+
+	// Projected vertices of a mesh kept across frames, projected again only once its projection or geometry id changed
+	struct MeshCache {
+		ProjectionTransform projection;
+		U64 geometry_id = 0;
+		CullMode cull_mode = CullMode::None;
+		U32 tint = 0xFFFFFFFF;
+		U32 lod = 0; // 0 for the full mesh, otherwise the level of detail lods[lod - 1]
+		// What the triangles' shades were set up from
+		Shading shading = Shading::Flat;
+		const U32* vertex_colors = NULL;
+		const Point2* vertex_uvs = NULL;
+		const Texture* texture = NULL;
+		bool projected = false; // The vertices hold geometry_id seen through projection
+		Screen* vertex_x = NULL;
+		Screen* vertex_y = NULL;
+		Depth* vertex_z = NULL;
+		size_t capacity = 0;
+		ScreenBounds bounds;
+	};
+
+	// Occlusion state of a region carried from one run of triangles to the next, see rasterizeRegion()
+	struct RegionState {
+		U32 current_mesh = 0xFFFFFFFF;
+		bool mesh_hidden = false;
+		U32 since_refresh = 0;
+	};
+
+	// Settings the assembled triangles depend on besides the meshes
+	struct GeometryKey {
+		U32 width, height;
+		double near_clipping, far_clipping;
+		bool front_to_back;
+	};
+
+	// Settings the rasterized pixels and their statistics depend on besides the triangles
+	struct RasterKey {
+		RasterMode raster_mode;
+		bool occlusion_culling;
+		U32 threads, tile_size;
+		bool visibility_buffer;
+		DepthFormat depth_format;
+	};
+
+	U8* depth_buffer = NULL; // width * height depths of buffer_format's Stored type
+	DepthFormat buffer_format = DepthFormat::Linear; // Format of depth_buffer and hiz, depth_format as of the last clear
+	U32* id_buffer = NULL; // Allocated once visibility_buffer is used
+	bool ids_valid = false; // id_buffer holds the ids of the current triangles
+	U8* hiz = NULL; // Farthest depth of every cell of every level, may be farther than the real one but never nearer
+	U8* hiz_dirty = NULL; // Level 0 cells waiting in a region's dirty_blocks
+	U32 hiz_width[HIZ_LEVELS], hiz_height[HIZ_LEVELS];
+	size_t hiz_offset[HIZ_LEVELS];
+	bool hiz_active = false;
+
+	FrameArena arena;
+	U64 allocation_count = 0;
+	astd::ThreadPool* thread_pool = NULL;
+	astd::ThreadPool* view_pool = NULL; // Renders the views of renderViews(), apart from the pools the views tile with
+
+	// Meshes of the frame, and the order their vertices are projected in, which groups instances by geometry
+	CountedVector<SceneMesh> scene{ CountingAllocator<U8>(&this->allocation_count) };
+	CountedVector<U32> scene_order{ CountingAllocator<U8>(&this->allocation_count) };
+
+	CountedVector<MeshCache> mesh_cache{ CountingAllocator<U8>(&this->allocation_count) }; // One per mesh of the scene rendered last
+	// Loaded clusters of the streamed meshes the scene points into, kept alive until the next gathering
+	CountedVector<std::shared_ptr<MeshGeometry>> streamed_geometry{ CountingAllocator<U8>(&this->allocation_count) };
+	CountedVector<size_t> streamed_end{ CountingAllocator<U8>(&this->allocation_count) }; // End of each streamed mesh's clusters in streamed_geometry
+
+	// Triangles of the last frame in drawing order, kept until a mesh, the camera or the geometry settings change
+	ScreenTri<Precision>* projected_tris = NULL; // Points into assembled_tris or sorted_tris
+	U32* projected_tri_mesh = NULL;
+	U32* projected_tri_index = NULL; // Index of the triangle in its mesh, for pick()
+	U32* projected_tri_shade = NULL; // Index of the triangle's shade in tri_shades, NO_SHADE for flat meshes
+	U32 projected_tri_count = 0;
+	ScreenBounds* mesh_bounds = NULL;
+	Shading* mesh_shading = NULL; // Shading of every mesh's triangles
+	ScreenTri<Precision>* assembled_tris = NULL;
+	U32* assembled_tri_mesh = NULL;
+	U32* assembled_tri_index = NULL;
+	U32* assembled_tri_shade = NULL;
+	ScreenTri<Precision>* sorted_tris = NULL;
+	U32* sorted_tri_mesh = NULL;
+	U32* sorted_tri_index = NULL;
+	U32* sorted_tri_shade = NULL;
+	CountedVector<TriShade> tri_shades{ CountingAllocator<U8>(&this->allocation_count) }; // Of the shaded triangles, a clipped triangle's pieces share one
+	size_t tri_capacity = 0, mesh_capacity = 0;
+	bool geometry_cached = false;
+	GeometryKey geometry_key;
+
+	// State of the buffers for reuse_unchanged_frames
+	bool buffers_cleared = false; // Nothing was rendered since the last clear
+	bool buffers_hold_frame = false; // The buffers hold the last frame, rendered right after a clear to clear_color
+	bool clear_pending = false; // clear() was held back
+	U32 clear_color = 0;
+	RasterKey raster_key;
+	bool frame_unchanged = false;
+	bool last_frame_on_clear = false; // The last frame was drawn right after a clear to last_frame_color
+	U32 last_frame_color = 0;
+	IF_RENDER_STATS(RenderStats last_stats); // Statistics of the last frame, for the counters of a frame that reuses it
+
+	// Gathers the meshes into scene and scene_order, bringing their bounds and geometry ids up to date
+	void gatherScene();
+	// Moves world space points relative to the camera, rotates them as if the camera is rotated and scales them by the fov,
+	// into the space where a point is on screen at the center + X / Z
+	Transform3 getScreenTransform() const;
+	// Near, far, left, right, top and bottom planes of the view in the space of getScreenTransform(), inside on their positive side
+	void getViewPlanes(Plane3* planes) const;
+	// Renders the gathered meshes of a layer from this layer's camera, start is when the frame's work began
+	double renderScene(const CountedVector<SceneMesh>& scene, const CountedVector<U32>& scene_order, RenderStats* stats, U64 start);
+	// Clears the buffers and the pyramid, reallocating the depth buffer and the pyramid if depth_format changed
+	void clearBuffers(U32 color);
+	// Allocates the depth buffer and the pyramid in buffer_format, filling the pyramid with the farthest depth
+	void allocateDepth();
+	// Calls the function with the depth format of buffer_format, see depth_format.hpp
+	template <class Function>
+	void dispatchDepth(Function&& function) const {
+		switch (this->buffer_format) {
+		case DepthFormat::ReversedFloat:
+			function(ReversedFloatDepth<Depth>{ this->near_clipping });
+			break;
+		case DepthFormat::Unorm24:
+			function(Unorm24Depth<Depth>(this->near_clipping, this->far_clipping));
+			break;
+		case DepthFormat::Unorm16:
+			function(Unorm16Depth<Depth>(this->near_clipping, this->far_clipping));
+			break;
+		default:
+			function(LinearDepth<Depth>{ this->near_clipping });
+		}
+	}
+	// Makes a cache exist for every mesh and the triangle buffers hold at least tri_count triangles
+	void reserveFrame(size_t mesh_count, size_t tri_count);
+	// Grows the triangle buffers to hold at least tri_count triangles, keeping the first kept assembled triangles
+	void growAssembled(size_t tri_count, size_t kept);
+	// Makes the cached vertex arrays hold at least count vertices
+	void reserveVertices(MeshCache& cache, size_t count);
+
+	// Rasterizes the projected triangles tri_indices[0 ... count - 1] (or the first count without indices) in order,
+	// outcome receives what happened to each of them
+	// A mesh's triangles stay together, so they're handed to rasterizeRun() in runs of the same shading
+	template <class Format>
+	void rasterizeRegion(const Format& format, RasterRegion& region, const U32* tri_indices, U32 count, U8* outcome);
+	// Rasterizes the entries from first to end (exclusive) of rasterizeRegion() with the shader of their shading
+	template <class Format, class Shader>
+	void rasterizeRun(const Format& format, RasterRegion& region, const U32* tri_indices, U32 first, U32 end, U8* outcome, RegionState& state);
+	// Rasterizes with the current raster_mode, only touching the pixels inside the region
+	// The depths of the triangle are the format's values, the shader's color goes into region.target at every pixel passing
+	// the depth test, a FlatShader gives the triangle's color or its id
+	template <class Format, class Shader>
+	void rasterizeTri(const Format& format, const ScreenTri<Precision>& value_tri, const Shader& shader, RasterRegion& region);
+	template <class Format, class Shader>
+	void rasterizeTriScanline(const Format& format, const ScreenTri<Precision>& value_tri, const Shader& shader, RasterRegion& region);
+	template <class Format, class Shader>
+	void rasterizeTriEdges(const Format& format, const ScreenTri<Precision>& value_tri, const Shader& shader, RasterRegion& region);
+	// Colors the pixels of the lines from first_line to end_line (exclusive) that the visibility buffer shows a triangle at
+	// Only SHADED looks at the triangles' shades, which frames without shaded triangles skip
+	template <bool SHADED>
+	void resolveLines(const U32* tri_colors, U32 first_line, U32 end_line);
+
+	// Checks if everything inside the pixel box (inclusive) and the region is farther than the nearest camera depth
+	template <class Format>
+	bool isOccluded(const Format& format, const RasterRegion& region, I64 min_x, I64 min_y, I64 max_x, I64 max_y, double nearest) const;
+	// Marks the level 0 cells of the pixels from x_first to x_last on the line as written
+	void markWritten(RasterRegion& region, I64 x_first, I64 x_last, I64 line);
+	// Recomputes the written cells of the region and their parents
+	template <class Format>
+	void refreshHiZ(const Format& format, RasterRegion& region);
+};
+
+// The instantiations compiled into the renderer
+typedef BasicRender3DLayer<DoublePrecision> Render3DLayer;
+typedef BasicRender3DLayer<FloatPrecision> Render3DLayerFloat;
+typedef BasicRender3DLayer<FixedPrecision> Render3DLayerFixed;
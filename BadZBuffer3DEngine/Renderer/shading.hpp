@@ -0,0 +1,136 @@
+#pragma once
+#include "../astd.hpp"
+#include "math.hpp"
+
+// How the pixels of a mesh's triangles get their colors
+enum class Shading : U8 {
+	Flat, // The triangle's color everywhere
+	Gouraud, // The colors of its vertices, interpolated across the triangle
+	TexturedNearest, // The texel under the pixel, multiplied by the triangle's color
+	TexturedBilinear // The 4 texels around the pixel, blended by their distance
+};
+
+// Pixels in the layout of render_buffer, row after row. Texture coordinates repeat past 0 and 1
+struct Texture {
+	U32 width = 0, height = 0;
+	std::vector<U32> pixels;
+};
+
+// What a shaded triangle interpolates, set up once per triangle when it's assembled
+// Every value is the ratio of two planes over the pixel indices, the attribute's divided by weight_sum's,
+// which makes them perspective correct. Pieces of a clipped triangle share the record of the whole triangle
+struct TriShade {
+	Shading shading = Shading::Flat;
+	double weight_sum[3]; // x, y and constant factors
+	double attributes[4][3]; // Channels from the lowest byte for Gouraud, u and v in texels for the textured shadings
+	const Texture* texture = NULL;
+};
+
+// The shaders below give the color of a pixel of a triangle from its shade and its color, one is picked at compile time
+// for every run of triangles that shade alike, so the rasterizers' loops carry nothing for what a triangle doesn't use
+// CONSTANT shaders give every pixel the same color, which the rasterizers write without calling shade() per pixel
+
+struct FlatShader {
+	static const bool CONSTANT = true;
+	U32 color;
+
+	FlatShader(const TriShade*, U32 value) : color(value) {}
+	U32 shade(I64, I64) const { return this->color; }
+};
+
+struct GouraudShader {
+	static const bool CONSTANT = false;
+	const TriShade* tri;
+
+	GouraudShader(const TriShade* shade, U32) : tri(shade) {}
+	U32 shade(I64 x, I64 y) const {
+		const TriShade& tri = *this->tri;
+		double inverse = 1 / (tri.weight_sum[0] * x + tri.weight_sum[1] * y + tri.weight_sum[2]);
+		U32 color = 0;
+		for (U32 c = 0; c < 4; c++) {
+			double channel = (tri.attributes[c][0] * x + tri.attributes[c][1] * y + tri.attributes[c][2]) * inverse + 0.5;
+			// Pixels a little outside the triangle extrapolate, NaN ends up at 0
+			color |= (U32)(channel > 0 ? (channel < 255 ? channel : 255) : 0) << (c * 8);
+		}
+		return color;
+	}
+};
+
+// Blends two colors channel by channel, weight 0 gives a and 256 gives b
+inline U32 lerpColor(U32 a, U32 b, U32 weight) {
+	U32 low = (((a & 0x00FF00FF) * (256 - weight) + (b & 0x00FF00FF) * weight) >> 8) & 0x00FF00FF;
+	U32 high = (((a >> 8) & 0x00FF00FF) * (256 - weight) + ((b >> 8) & 0x00FF00FF) * weight) & 0xFF00FF00;
+	return low | high;
+}
+
+// Multiplies every channel of the color by the tint's, 0xFF keeps a channel as it is
+inline U32 tintColor(U32 color, U32 tint) {
+	if (tint == 0xFFFFFFFF)
+		return color;
+	U32 result = 0;
+	for (U32 shift = 0; shift < 32; shift += 8)
+		result |= ((((color >> shift) & 0xFF) * (((tint >> shift) & 0xFF) + 1)) >> 8) << shift;
+	return result;
+}
+
+template <bool BILINEAR>
+struct TexturedShader {
+	static const bool CONSTANT = false;
+	// Texture coordinates are kept within this many texels, so they stay exact integers after flooring
+	static constexpr double TEXEL_LIMIT = 1 << 30;
+	const TriShade* tri;
+	U32 color; // Multiplies the texels
+	const U32* pixels;
+	I64 width, height;
+
+	TexturedShader(const TriShade* shade, U32 value) : tri(shade), color(value), pixels(shade->texture->pixels.data()),
+		width(shade->texture->width), height(shade->texture->height) {}
+
+	U32 shade(I64 x, I64 y) const {
+		const TriShade& tri = *this->tri;
+		double inverse = 1 / (tri.weight_sum[0] * x + tri.weight_sum[1] * y + tri.weight_sum[2]);
+		double u = (tri.attributes[0][0] * x + tri.attributes[0][1] * y + tri.attributes[0][2]) * inverse;
+		double v = (tri.attributes[1][0] * x + tri.attributes[1][1] * y + tri.attributes[1][2]) * inverse;
+		// Texel centers are at half texels, so bilinear sampling blends from the one up and left of the point
+		if constexpr (BILINEAR) {
+			u -= 0.5;
+			v -= 0.5;
+		}
+		// NaN ends up at the lower limit
+		u = std::min(std::max(-TEXEL_LIMIT, u), TEXEL_LIMIT);
+		v = std::min(std::max(-TEXEL_LIMIT, v), TEXEL_LIMIT);
+		double floor_u = std::floor(u), floor_v = std::floor(v);
+		I64 tx = wrap((I64)floor_u, this->width), ty = wrap((I64)floor_v, this->height);
+
+		U32 texel;
+		if constexpr (BILINEAR) {
+			I64 next_x = tx + 1 == this->width ? 0 : tx + 1;
+			const U32* row = this->pixels + ty * this->width;
+			const U32* next_row = this->pixels + (ty + 1 == this->height ? 0 : ty + 1) * this->width;
+			U32 weight_x = (U32)((u - floor_u) * 256), weight_y = (U32)((v - floor_v) * 256);
+			texel = lerpColor(lerpColor(row[tx], row[next_x], weight_x), lerpColor(next_row[tx], next_row[next_x], weight_x), weight_y);
+		}
+		else
+			texel = this->pixels[ty * this->width + tx];
+		return tintColor(texel, this->color);
+	}
+
+	static I64 wrap(I64 coordinate, I64 size) {
+		I64 wrapped = coordinate % size;
+		return wrapped < 0 ? wrapped + size : wrapped;
+	}
+};
+
+// Color of a pixel of the triangle with the shader of its shading, for passes that meet every shading pixel by pixel
+inline U32 shadePixel(const TriShade& shade, U32 color, I64 x, I64 y) {
+	switch (shade.shading) {
+	case Shading::Gouraud:
+		return GouraudShader(&shade, color).shade(x, y);
+	case Shading::TexturedNearest:
+		return TexturedShader<false>(&shade, color).shade(x, y);
+	case Shading::TexturedBilinear:
+		return TexturedShader<true>(&shade, color).shade(x, y);
+	default:
+		return color;
+	}
+}
@@ -0,0 +1,332 @@
+#include "simplify.hpp"
+
+// Fraction of the edges, cheapest first, that a pass of collapses looks at
+static const size_t PASS_FRACTION = 4;
+
+// Sum of squared distances to a set of planes as a symmetric 4x4 matrix, only the upper half is stored:
+// aa ab ac ad bb bc bd cc cd dd for planes a x + b y + c z + d = 0
+struct Quadric {
+	double q[10] = {};
+
+	void addPlane(const Point3& normal, double offset) {
+		double a = normal.x, b = normal.y, c = normal.z, d = offset;
+		this->q[0] += a * a; this->q[1] += a * b; this->q[2] += a * c; this->q[3] += a * d;
+		this->q[4] += b * b; this->q[5] += b * c; this->q[6] += b * d;
+		this->q[7] += c * c; this->q[8] += c * d;
+		this->q[9] += d * d;
+	}
+
+	void add(const Quadric& other) {
+		for (U32 i = 0; i < 10; i++)
+			this->q[i] += other.q[i];
+	}
+
+	double evaluate(const Point3& p) const {
+		return this->q[0] * p.x * p.x + 2 * this->q[1] * p.x * p.y + 2 * this->q[2] * p.x * p.z + 2 * this->q[3] * p.x +
+			this->q[4] * p.y * p.y + 2 * this->q[5] * p.y * p.z + 2 * this->q[6] * p.y +
+			this->q[7] * p.z * p.z + 2 * this->q[8] * p.z + this->q[9];
+	}
+
+	// Point with the smallest error, false if the planes don't pin one down
+	bool minimum(Point3& p) const {
+		const double* m = this->q;
+		double det = m[0] * (m[4] * m[7] - m[5] * m[5]) - m[1] * (m[1] * m[7] - m[5] * m[2]) + m[2] * (m[1] * m[5] - m[4] * m[2]);
+		if (det == 0 || std::abs(det) <= 1e-10 * std::abs(m[0] * m[4] * m[7]))
+			return false;
+		// Cramer's rule on the 3x3 part against -(ad, bd, cd)
+		double rx = -m[3], ry = -m[6], rz = -m[8];
+		p.x = (rx * (m[4] * m[7] - m[5] * m[5]) - m[1] * (ry * m[7] - m[5] * rz) + m[2] * (ry * m[5] - m[4] * rz)) / det;
+		p.y = (m[0] * (ry * m[7] - rz * m[5]) - rx * (m[1] * m[7] - m[5] * m[2]) + m[2] * (m[1] * rz - ry * m[2])) / det;
+		p.z = (m[0] * (m[4] * rz - m[5] * ry) - m[1] * (m[1] * rz - ry * m[2]) + rx * (m[1] * m[5] - m[4] * m[2])) / det;
+		return true;
+	}
+};
+
+// Edge that could be collapsed and the error it would add
+struct CollapseCandidate {
+	double cost;
+	U32 a, b;
+
+	// Cheapest first, ties broken by the vertices so the result doesn't depend on the sort
+	bool operator<(const CollapseCandidate& other) const {
+		if (this->cost != other.cost)
+			return this->cost < other.cost;
+		if (this->a != other.a)
+			return this->a < other.a;
+		return this->b < other.b;
+	}
+};
+
+// Working state of a simplification, the mesh as it is after the collapses so far
+struct Simplifier {
+	std::vector<Point3> positions;
+	std::vector<Quadric> quadrics;
+	std::vector<IndexedTri> tris;
+	std::vector<U8> tri_alive;
+	std::vector<std::vector<U32>> vertex_tris; // Triangles around every vertex, may still list removed ones
+	size_t live_tris = 0;
+	Bounds3 bounds;
+	double max_error = 0;
+};
+
+static Point3 triNormal(const Point3& a, const Point3& b, const Point3& c) {
+	return cross(Point3{ b.x - a.x, b.y - a.y, b.z - a.z }, Point3{ c.x - a.x, c.y - a.y, c.z - a.z });
+}
+
+// Inside both the box and the sphere, which the renderer's culling tests
+static bool insideBounds(const Bounds3& bounds, const Point3& p) {
+	Point3 offset = Point3{ p.x - bounds.center.x, p.y - bounds.center.y, p.z - bounds.center.z };
+	return p.x >= bounds.min.x && p.y >= bounds.min.y && p.z >= bounds.min.z &&
+		p.x <= bounds.max.x && p.y <= bounds.max.y && p.z <= bounds.max.z && dot(offset, offset) <= bounds.radius * bounds.radius;
+}
+
+// Where the vertices of the edge would merge and the error there, the quadrics' minimum if it's inside the bounds,
+// otherwise the best of the edge's ends and middle, which are inside them too
+static double findCollapse(const Simplifier& simplifier, U32 a, U32 b, Point3& position) {
+	Quadric quadric = simplifier.quadrics[a];
+	quadric.add(simplifier.quadrics[b]);
+	if (quadric.minimum(position) && insideBounds(simplifier.bounds, position))
+		return quadric.evaluate(position);
+
+	const Point3& pa = simplifier.positions[a];
+	const Point3& pb = simplifier.positions[b];
+	Point3 choices[3] = { pa, pb, Point3{ (pa.x + pb.x) / 2, (pa.y + pb.y) / 2, (pa.z + pb.z) / 2 } };
+	double best = INF;
+	for (const Point3& choice : choices) {
+		double cost = quadric.evaluate(choice);
+		if (cost < best) {
+			best = cost;
+			position = choice;
+		}
+	}
+	return best;
+}
+
+// Vertices sharing a live triangle with the vertex, sorted and unique
+static void collectNeighbors(const Simplifier& simplifier, U32 vertex, std::vector<U32>& neighbors) {
+	neighbors.clear();
+	for (U32 t : simplifier.vertex_tris[vertex]) {
+		if (!simplifier.tri_alive[t])
+			continue;
+		const IndexedTri& tri = simplifier.tris[t];
+		for (U32 v : { tri.a, tri.b, tri.c })
+			if (v != vertex)
+				neighbors.push_back(v);
+	}
+	std::sort(neighbors.begin(), neighbors.end());
+	neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+}
+
+static bool hasVertex(const IndexedTri& tri, U32 vertex) {
+	return tri.a == vertex || tri.b == vertex || tri.c == vertex;
+}
+
+// Checks that moving the vertex to the position turns none of its triangles that survive the collapse over
+static bool keepsOrientation(const Simplifier& simplifier, U32 vertex, U32 other, const Point3& position) {
+	for (U32 t : simplifier.vertex_tris[vertex]) {
+		if (!simplifier.tri_alive[t] || hasVertex(simplifier.tris[t], other))
+			continue;
+		const IndexedTri& tri = simplifier.tris[t];
+		Point3 corners[3] = { simplifier.positions[tri.a], simplifier.positions[tri.b], simplifier.positions[tri.c] };
+		Point3 before = triNormal(corners[0], corners[1], corners[2]);
+		corners[tri.a == vertex ? 0 : tri.b == vertex ? 1 : 2] = position;
+		Point3 after = triNormal(corners[0], corners[1], corners[2]);
+		if (dot(before, after) <= 0)
+			return false;
+	}
+	return true;
+}
+
+// Merges b into a at the position, returns false if it would fold the surface or pinch it into a non manifold
+static bool collapseEdge(Simplifier& simplifier, U32 a, U32 b, const Point3& position,
+	std::vector<U32>& neighbors_a, std::vector<U32>& neighbors_b) {
+	// The ends may only share the vertices opposite the edge, otherwise merging them glues two sheets together
+	collectNeighbors(simplifier, a, neighbors_a);
+	collectNeighbors(simplifier, b, neighbors_b);
+	size_t shared_tris = 0;
+	for (U32 t : simplifier.vertex_tris[a])
+		shared_tris += simplifier.tri_alive[t] && hasVertex(simplifier.tris[t], b);
+	size_t shared_vertices = 0;
+	for (size_t i = 0, j = 0; i < neighbors_a.size() && j < neighbors_b.size();) {
+		if (neighbors_a[i] < neighbors_b[j])
+			i++;
+		else if (neighbors_a[i] > neighbors_b[j])
+			j++;
+		else {
+			shared_vertices += neighbors_a[i] != a && neighbors_a[i] != b;
+			i++;
+			j++;
+		}
+	}
+	if (shared_vertices > shared_tris)
+		return false;
+	if (!keepsOrientation(simplifier, a, b, position) || !keepsOrientation(simplifier, b, a, position))
+		return false;
+
+	simplifier.positions[a] = position;
+	simplifier.quadrics[a].add(simplifier.quadrics[b]);
+	for (U32 t : simplifier.vertex_tris[b]) {
+		if (!simplifier.tri_alive[t])
+			continue;
+		IndexedTri& tri = simplifier.tris[t];
+		if (hasVertex(tri, a)) {
+			simplifier.tri_alive[t] = false;
+			simplifier.live_tris--;
+			continue;
+		}
+		if (tri.a == b) tri.a = a;
+		if (tri.b == b) tri.b = a;
+		if (tri.c == b) tri.c = a;
+		simplifier.vertex_tris[a].push_back(t);
+	}
+	std::vector<U32>().swap(simplifier.vertex_tris[b]);
+	std::vector<U32>& around = simplifier.vertex_tris[a];
+	around.erase(std::remove_if(around.begin(), around.end(), [&](U32 t) { return !simplifier.tri_alive[t]; }), around.end());
+	return true;
+}
+
+// Copies the live triangles and the vertices they use as a level of detail
+static MeshLod snapshot(const Simplifier& simplifier) {
+	MeshLod lod;
+	lod.error = simplifier.max_error;
+	std::vector<U32> remap(simplifier.positions.size(), 0xFFFFFFFF);
+	lod.tris.reserve(simplifier.live_tris);
+	for (size_t t = 0; t < simplifier.tris.size(); t++) {
+		if (!simplifier.tri_alive[t])
+			continue;
+		IndexedTri tri = simplifier.tris[t];
+		for (U32* v : { &tri.a, &tri.b, &tri.c }) {
+			if (remap[*v] == 0xFFFFFFFF) {
+				remap[*v] = (U32)lod.vertices.size();
+				lod.vertices.push_back(simplifier.positions[*v]);
+			}
+			*v = remap[*v];
+		}
+		lod.tris.push_back(tri);
+	}
+	return lod;
+}
+
+std::vector<MeshLod> buildLods(const std::vector<Point3>& vertices, const std::vector<IndexedTri>& tris,
+	U32 max_levels, double ratio, size_t min_tris) {
+	std::vector<MeshLod> ret;
+	if (max_levels == 0 || tris.size() <= min_tris || vertices.empty())
+		return ret;
+
+	Simplifier simplifier;
+	simplifier.positions = vertices;
+	simplifier.quadrics.resize(vertices.size());
+	simplifier.tris = tris;
+	simplifier.tri_alive.resize(tris.size(), false);
+	simplifier.vertex_tris.resize(vertices.size());
+	simplifier.bounds = computeBounds(vertices.data(), vertices.size());
+
+	// Every edge once as (smaller index, larger index, triangle), the planes of the triangles go to their corners
+	// Unit normals make the error a sum of squared distances, so its root is in the mesh's units
+	std::vector<std::pair<U64, U32>> edges;
+	edges.reserve(tris.size() * 3);
+	for (U32 t = 0; t < (U32)tris.size(); t++) {
+		const IndexedTri& tri = tris[t];
+		if (tri.a >= vertices.size() || tri.b >= vertices.size() || tri.c >= vertices.size() || tri.a == tri.b || tri.b == tri.c || tri.a == tri.c)
+			continue;
+		simplifier.tri_alive[t] = true;
+		simplifier.live_tris++;
+		for (U32 v : { tri.a, tri.b, tri.c })
+			simplifier.vertex_tris[v].push_back(t);
+
+		Point3 normal = triNormal(vertices[tri.a], vertices[tri.b], vertices[tri.c]);
+		double length = std::sqrt(dot(normal, normal));
+		if (length > 0) {
+			normal = Point3{ normal.x / length, normal.y / length, normal.z / length };
+			double offset = -dot(normal, vertices[tri.a]);
+			for (U32 v : { tri.a, tri.b, tri.c })
+				simplifier.quadrics[v].addPlane(normal, offset);
+		}
+		U32 corners[3] = { tri.a, tri.b, tri.c };
+		for (U32 e = 0; e < 3; e++) {
+			U32 a = std::min(corners[e], corners[(e + 1) % 3]), b = std::max(corners[e], corners[(e + 1) % 3]);
+			edges.push_back({ ((U64)a << 32) | b, t });
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+
+	// Edges of a single triangle are borders, a plane through them perpendicular to the triangle keeps them in place
+	for (size_t e = 0; e < edges.size();) {
+		size_t end = e + 1;
+		while (end < edges.size() && edges[end].first == edges[e].first)
+			end++;
+		U32 a = (U32)(edges[e].first >> 32), b = (U32)edges[e].first;
+		if (end - e == 1) {
+			const IndexedTri& tri = tris[edges[e].second];
+			Point3 face = triNormal(vertices[tri.a], vertices[tri.b], vertices[tri.c]);
+			Point3 direction = Point3{ vertices[b].x - vertices[a].x, vertices[b].y - vertices[a].y, vertices[b].z - vertices[a].z };
+			Point3 normal = cross(direction, face);
+			double length = std::sqrt(dot(normal, normal));
+			if (length > 0) {
+				normal = Point3{ normal.x / length, normal.y / length, normal.z / length };
+				double offset = -dot(normal, vertices[a]);
+				simplifier.quadrics[a].addPlane(normal, offset);
+				simplifier.quadrics[b].addPlane(normal, offset);
+			}
+		}
+		e = end;
+	}
+	std::vector<std::pair<U64, U32>>().swap(edges);
+
+	// Collapses go in passes over the cheapest edges in order, a collapse locks its vertex until the next pass
+	// since the costs of its edges changed, the cost of an edge only depends on its own vertices
+	std::vector<CollapseCandidate> candidates;
+	std::vector<U8> locked(vertices.size());
+	std::vector<U32> neighbors_a, neighbors_b;
+	size_t previous_tris = simplifier.live_tris;
+	double target = previous_tris * ratio;
+	bool stuck = false;
+	while (ret.size() < max_levels && target >= min_tris && !stuck) {
+		while (simplifier.live_tris > target) {
+			// Every edge once, from its end with the smaller index
+			candidates.clear();
+			for (U32 a = 0; a < (U32)vertices.size(); a++) {
+				if (simplifier.vertex_tris[a].empty())
+					continue;
+				collectNeighbors(simplifier, a, neighbors_a);
+				for (U32 b : neighbors_a) {
+					Point3 position;
+					if (b > a)
+						candidates.push_back(CollapseCandidate{ findCollapse(simplifier, a, b, position), a, b });
+				}
+			}
+			size_t pass_end = std::max<size_t>(candidates.size() / PASS_FRACTION, 1);
+			std::nth_element(candidates.begin(), candidates.begin() + std::min(pass_end, candidates.size()), candidates.end());
+			std::sort(candidates.begin(), candidates.begin() + std::min(pass_end, candidates.size()));
+
+			std::fill(locked.begin(), locked.end(), 0);
+			size_t collapsed = 0;
+			for (size_t c = 0; c < pass_end && c < candidates.size() && simplifier.live_tris > target; c++) {
+				const CollapseCandidate& candidate = candidates[c];
+				U32 a = candidate.a, b = candidate.b;
+				if (locked[a] || locked[b])
+					continue;
+				Point3 position;
+				findCollapse(simplifier, a, b, position);
+				if (!collapseEdge(simplifier, a, b, position, neighbors_a, neighbors_b))
+					continue;
+				simplifier.max_error = std::max(simplifier.max_error, std::sqrt(std::max(candidate.cost, 0.0)));
+				locked[a] = true;
+				locked[b] = true;
+				collapsed++;
+			}
+			// Every edge left would fold or pinch the surface
+			if (collapsed == 0) {
+				stuck = true;
+				break;
+			}
+		}
+
+		if (simplifier.live_tris > previous_tris * 0.9)
+			break;
+		ret.push_back(snapshot(simplifier));
+		previous_tris = simplifier.live_tris;
+		target = previous_tris * ratio;
+	}
+	return ret;
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include "../astd.hpp"
+#include "renderer3d.hpp"
+
+// Simplifies a mesh by quadric error edge collapses into a chain of levels of detail, each keeping about ratio times
+// the triangles of the previous one, until max_levels are built or a level would have fewer than min_tris
+// Collapsed vertices stay inside the mesh's bounds, so the full mesh's bounds hold for every level
+// Triangles keep their colors, a level is only kept if it removed at least a tenth of the previous one's triangles
+std::vector<MeshLod> buildLods(const std::vector<Point3>& vertices, const std::vector<IndexedTri>& tris,
+	U32 max_levels = 6, double ratio = 0.5, size_t min_tris = 64);
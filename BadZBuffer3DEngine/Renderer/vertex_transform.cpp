@@ -0,0 +1,315 @@
+#include "vertex_transform.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define VERTEX_TRANSFORM_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+// Projects a single point into the outputs at index i
+template <class Precision>
+static inline void projectPoint(const ProjectionTransform& projection, double px, double py, double pz, size_t i,
+	typename Precision::Screen* out_x, typename Precision::Screen* out_y, typename Precision::Depth* out_z) {
+	const double(*m)[4] = projection.transform.m;
+	double x = m[0][0] * px + m[0][1] * py + m[0][2] * pz + m[0][3];
+	double y = m[1][0] * px + m[1][1] * py + m[1][2] * pz + m[1][3];
+	double z = m[2][0] * px + m[2][1] * py + m[2][2] * pz + m[2][3];
+
+	// Avoid high division values later on
+	double divisor = z;
+	if (divisor < 0.01 && divisor > -0.01) divisor = 0.01;
+
+	out_x[i] = Precision::toScreen(x / divisor + projection.center_x);
+	out_y[i] = Precision::toScreen(y / divisor + projection.center_y);
+	out_z[i] = (typename Precision::Depth)z;
+}
+
+// One vertex at a time, also finishes the leftovers of the vector kernels
+template <class Precision>
+static void projectScalar(const ProjectionTransform& projection, const Point3* points, size_t count,
+	typename Precision::Screen* out_x, typename Precision::Screen* out_y, typename Precision::Depth* out_z) {
+	for (size_t i = 0; i < count; i++)
+		projectPoint<Precision>(projection, points[i].x, points[i].y, points[i].z, i, out_x, out_y, out_z);
+}
+
+template <class Precision>
+static void projectQuantizedScalar(const ProjectionTransform& projection, const QuantizedPoint* points, size_t count,
+	typename Precision::Screen* out_x, typename Precision::Screen* out_y, typename Precision::Depth* out_z) {
+	for (size_t i = 0; i < count; i++)
+		projectPoint<Precision>(projection, points[i].x, points[i].y, points[i].z, i, out_x, out_y, out_z);
+}
+
+#ifdef VERTEX_TRANSFORM_X86
+// Stores 2 lanes as the output type, I32 outputs are fixed point coordinates that were already scaled and clamped
+static inline void storeLanes(double* out, __m128d lanes) {
+	_mm_storeu_pd(out, lanes);
+}
+
+static inline void storeLanes(float* out, __m128d lanes) {
+	_mm_storel_pi((__m64*)out, _mm_cvtpd_ps(lanes));
+}
+
+static inline void storeLanes(I32* out, __m128d lanes) {
+	_mm_storel_epi64((__m128i*)out, _mm_cvtpd_epi32(lanes));
+}
+
+// Pixel coordinates to the precision's screen coordinates, ready for storeLanes
+template <class Precision>
+static inline __m128d screenLanes(__m128d pixels) {
+	if constexpr (Precision::SUBPIXEL_BITS != 0) {
+		pixels = _mm_min_pd(_mm_max_pd(pixels, _mm_set1_pd(-Precision::SCREEN_LIMIT)), _mm_set1_pd(Precision::SCREEN_LIMIT));
+		pixels = _mm_mul_pd(pixels, _mm_set1_pd(1 << Precision::SUBPIXEL_BITS));
+	}
+	return pixels;
+}
+
+// 2 vertices at a time, SSE2 is part of every x86-64 CPU
+template <class Precision>
+static void projectSSE2(const ProjectionTransform& projection, const Point3* points, size_t count,
+	typename Precision::Screen* out_x, typename Precision::Screen* out_y, typename Precision::Depth* out_z) {
+	const double(*m)[4] = projection.transform.m;
+	__m128d row[3][4];
+	for (U32 r = 0; r < 3; r++)
+		for (U32 c = 0; c < 4; c++)
+			row[r][c] = _mm_set1_pd(m[r][c]);
+	const __m128d center_x = _mm_set1_pd(projection.center_x);
+	const __m128d center_y = _mm_set1_pd(projection.center_y);
+	const __m128d min_depth = _mm_set1_pd(0.01);
+	const __m128d abs_mask = _mm_castsi128_pd(_mm_set1_epi64x(0x7FFFFFFFFFFFFFFF));
+
+	size_t i = 0;
+	for (; i + 2 <= count; i += 2) {
+		// Turn the 2 points into a batch of X, Y and Z
+		__m128d p0 = _mm_loadu_pd(&points[i].x); // x0 y0
+		__m128d p1 = _mm_loadu_pd(&points[i].z); // z0 x1
+		__m128d p2 = _mm_loadu_pd(&points[i + 1].y); // y1 z1
+		__m128d px = _mm_shuffle_pd(p0, p1, 0b10);
+		__m128d py = _mm_shuffle_pd(p0, p2, 0b01);
+		__m128d pz = _mm_shuffle_pd(p1, p2, 0b10);
+
+		__m128d x = _mm_add_pd(_mm_add_pd(_mm_mul_pd(row[0][0], px), _mm_mul_pd(row[0][1], py)), _mm_add_pd(_mm_mul_pd(row[0][2], pz), row[0][3]));
+		__m128d y = _mm_add_pd(_mm_add_pd(_mm_mul_pd(row[1][0], px), _mm_mul_pd(row[1][1], py)), _mm_add_pd(_mm_mul_pd(row[1][2], pz), row[1][3]));
+		__m128d z = _mm_add_pd(_mm_add_pd(_mm_mul_pd(row[2][0], px), _mm_mul_pd(row[2][1], py)), _mm_add_pd(_mm_mul_pd(row[2][2], pz), row[2][3]));
+
+		// Replace the depths too close to 0 with 0.01 for the divide
+		__m128d near_zero = _mm_cmplt_pd(_mm_and_pd(z, abs_mask), min_depth);
+		__m128d divisor = _mm_or_pd(_mm_and_pd(near_zero, min_depth), _mm_andnot_pd(near_zero, z));
+
+		storeLanes(out_x + i, screenLanes<Precision>(_mm_add_pd(_mm_div_pd(x, divisor), center_x)));
+		storeLanes(out_y + i, screenLanes<Precision>(_mm_add_pd(_mm_div_pd(y, divisor), center_y)));
+		storeLanes(out_z + i, z);
+	}
+	projectScalar<Precision>(projection, points + i, count - i, out_x + i, out_y + i, out_z + i);
+}
+
+TARGET_AVX2 static inline void storeLanes(double* out, __m256d lanes) {
+	_mm256_storeu_pd(out, lanes);
+}
+
+TARGET_AVX2 static inline void storeLanes(float* out, __m256d lanes) {
+	_mm_storeu_ps(out, _mm256_cvtpd_ps(lanes));
+}
+
+TARGET_AVX2 static inline void storeLanes(I32* out, __m256d lanes) {
+	_mm_storeu_si128((__m128i*)out, _mm256_cvtpd_epi32(lanes));
+}
+
+template <class Precision>
+TARGET_AVX2 static inline __m256d screenLanes(__m256d pixels) {
+	if constexpr (Precision::SUBPIXEL_BITS != 0) {
+		pixels = _mm256_min_pd(_mm256_max_pd(pixels, _mm256_set1_pd(-Precision::SCREEN_LIMIT)), _mm256_set1_pd(Precision::SCREEN_LIMIT));
+		pixels = _mm256_mul_pd(pixels, _mm256_set1_pd(1 << Precision::SUBPIXEL_BITS));
+	}
+	return pixels;
+}
+
+// Projects a batch of 4 points into the outputs from index i, with fused multiply adds
+template <class Precision>
+TARGET_AVX2 static inline void projectLanesAVX2(const __m256d (*row)[4], __m256d center_x, __m256d center_y, __m256d px, __m256d py, __m256d pz,
+	size_t i, typename Precision::Screen* out_x, typename Precision::Screen* out_y, typename Precision::Depth* out_z) {
+	const __m256d min_depth = _mm256_set1_pd(0.01);
+	const __m256d abs_mask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7FFFFFFFFFFFFFFF));
+	__m256d x = _mm256_fmadd_pd(row[0][0], px, _mm256_fmadd_pd(row[0][1], py, _mm256_fmadd_pd(row[0][2], pz, row[0][3])));
+	__m256d y = _mm256_fmadd_pd(row[1][0], px, _mm256_fmadd_pd(row[1][1], py, _mm256_fmadd_pd(row[1][2], pz, row[1][3])));
+	__m256d z = _mm256_fmadd_pd(row[2][0], px, _mm256_fmadd_pd(row[2][1], py, _mm256_fmadd_pd(row[2][2], pz, row[2][3])));
+
+	// Replace the depths too close to 0 with 0.01 for the divide
+	__m256d near_zero = _mm256_cmp_pd(_mm256_and_pd(z, abs_mask), min_depth, _CMP_LT_OQ);
+	__m256d divisor = _mm256_blendv_pd(z, min_depth, near_zero);
+
+	storeLanes(out_x + i, screenLanes<Precision>(_mm256_add_pd(_mm256_div_pd(x, divisor), center_x)));
+	storeLanes(out_y + i, screenLanes<Precision>(_mm256_add_pd(_mm256_div_pd(y, divisor), center_y)));
+	storeLanes(out_z + i, z);
+}
+
+// 4 vertices at a time
+template <class Precision>
+TARGET_AVX2 static void projectAVX2(const ProjectionTransform& projection, const Point3* points, size_t count,
+	typename Precision::Screen* out_x, typename Precision::Screen* out_y, typename Precision::Depth* out_z) {
+	const double(*m)[4] = projection.transform.m;
+	__m256d row[3][4];
+	for (U32 r = 0; r < 3; r++)
+		for (U32 c = 0; c < 4; c++)
+			row[r][c] = _mm256_set1_pd(m[r][c]);
+	const __m256d center_x = _mm256_set1_pd(projection.center_x);
+	const __m256d center_y = _mm256_set1_pd(projection.center_y);
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		// Turn the 4 points into a batch of X, Y and Z
+		const double* base = &points[i].x;
+		__m256d r0 = _mm256_loadu_pd(base); // x0 y0 z0 x1
+		__m256d r1 = _mm256_loadu_pd(base + 4); // y1 z1 x2 y2
+		__m256d r2 = _mm256_loadu_pd(base + 8); // z2 x3 y3 z3
+		__m256d lo = _mm256_permute2f128_pd(r0, r1, 0x30); // x0 y0 x2 y2
+		__m256d mid = _mm256_permute2f128_pd(r0, r2, 0x21); // z0 x1 z2 x3
+		__m256d hi = _mm256_permute2f128_pd(r1, r2, 0x30); // y1 z1 y3 z3
+		__m256d px = _mm256_shuffle_pd(lo, mid, 0b1010); // x0 x1 x2 x3
+		__m256d py = _mm256_shuffle_pd(lo, hi, 0b0101); // y0 y1 y2 y3
+		__m256d pz = _mm256_shuffle_pd(mid, hi, 0b1010); // z0 z1 z2 z3
+
+		projectLanesAVX2<Precision>(row, center_x, center_y, px, py, pz, i, out_x, out_y, out_z);
+	}
+	projectScalar<Precision>(projection, points + i, count - i, out_x + i, out_y + i, out_z + i);
+}
+
+// 4 quantized points at a time, the 24 bytes they take are read with 2 loads and spread into X, Y and Z by byte shuffles
+template <class Precision>
+TARGET_AVX2 static void projectQuantizedAVX2(const ProjectionTransform& projection, const QuantizedPoint* points, size_t count,
+	typename Precision::Screen* out_x, typename Precision::Screen* out_y, typename Precision::Depth* out_z) {
+	const double(*m)[4] = projection.transform.m;
+	__m256d row[3][4];
+	for (U32 r = 0; r < 3; r++)
+		for (U32 c = 0; c < 4; c++)
+			row[r][c] = _mm256_set1_pd(m[r][c]);
+	const __m256d center_x = _mm256_set1_pd(projection.center_x);
+	const __m256d center_y = _mm256_set1_pd(projection.center_y);
+	// Byte pairs of each axis in the first 16 bytes and in the last 8, -1 zeroes the lanes the other load fills
+	const __m128i low_x = _mm_setr_epi8(0, 1, 6, 7, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i high_x = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 3, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i low_y = _mm_setr_epi8(2, 3, 8, 9, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i high_y = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 4, 5, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i low_z = _mm_setr_epi8(4, 5, 10, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i high_z = _mm_setr_epi8(-1, -1, -1, -1, 0, 1, 6, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		const U8* base = (const U8*)(points + i);
+		__m128i low = _mm_loadu_si128((const __m128i*)base); // x0 y0 z0 x1 y1 z1 x2 y2
+		__m128i high = _mm_loadl_epi64((const __m128i*)(base + 16)); // z2 x3 y3 z3
+		__m256d px = _mm256_cvtepi32_pd(_mm_cvtepu16_epi32(_mm_or_si128(_mm_shuffle_epi8(low, low_x), _mm_shuffle_epi8(high, high_x))));
+		__m256d py = _mm256_cvtepi32_pd(_mm_cvtepu16_epi32(_mm_or_si128(_mm_shuffle_epi8(low, low_y), _mm_shuffle_epi8(high, high_y))));
+		__m256d pz = _mm256_cvtepi32_pd(_mm_cvtepu16_epi32(_mm_or_si128(_mm_shuffle_epi8(low, low_z), _mm_shuffle_epi8(high, high_z))));
+		projectLanesAVX2<Precision>(row, center_x, center_y, px, py, pz, i, out_x, out_y, out_z);
+	}
+	projectQuantizedScalar<Precision>(projection, points + i, count - i, out_x + i, out_y + i, out_z + i);
+}
+
+static bool cpuHasAVX2() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	__cpuid(info, 1);
+	bool fma = (info[2] & (1 << 12)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	if (!fma || !osxsave || (_xgetbv(0) & 6) != 6) // The OS has to save the YMM registers
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+#endif
+
+// Instruction sets the kernels can use, from the least to the most
+enum class ProjectKernelLevel {
+	Scalar,
+	SSE2,
+	AVX2
+};
+
+static ProjectKernelLevel pickProjectKernel() {
+#ifdef VERTEX_TRANSFORM_X86
+	if (cpuHasAVX2())
+		return ProjectKernelLevel::AVX2;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	return ProjectKernelLevel::SSE2;
+#endif
+#endif
+	return ProjectKernelLevel::Scalar;
+}
+
+// Picked once on the first use
+static ProjectKernelLevel projectKernel() {
+	static const ProjectKernelLevel level = pickProjectKernel();
+	return level;
+}
+
+template <class Precision>
+void projectVertices(const ProjectionTransform& projection, const Point3* points, size_t count,
+	typename Precision::Screen* out_x, typename Precision::Screen* out_y, typename Precision::Depth* out_z) {
+	switch (projectKernel()) {
+#ifdef VERTEX_TRANSFORM_X86
+	case ProjectKernelLevel::AVX2:
+		projectAVX2<Precision>(projection, points, count, out_x, out_y, out_z);
+		return;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	case ProjectKernelLevel::SSE2:
+		projectSSE2<Precision>(projection, points, count, out_x, out_y, out_z);
+		return;
+#endif
+#endif
+	default:
+		projectScalar<Precision>(projection, points, count, out_x, out_y, out_z);
+	}
+}
+
+template <class Precision>
+void projectQuantized(const ProjectionTransform& projection, Point3 origin, Point3 step, const QuantizedPoint* points, size_t count,
+	typename Precision::Screen* out_x, typename Precision::Screen* out_y, typename Precision::Depth* out_z) {
+	Transform3 dequantize;
+	dequantize.m[0][0] = step.x;
+	dequantize.m[1][1] = step.y;
+	dequantize.m[2][2] = step.z;
+	dequantize.m[0][3] = origin.x;
+	dequantize.m[1][3] = origin.y;
+	dequantize.m[2][3] = origin.z;
+	ProjectionTransform quantized = projection;
+	quantized.transform = combine(projection.transform, dequantize);
+
+	// SSE2 lacks the byte shuffles and widening the AVX2 kernel reads the points with
+#ifdef VERTEX_TRANSFORM_X86
+	if (projectKernel() == ProjectKernelLevel::AVX2) {
+		projectQuantizedAVX2<Precision>(quantized, points, count, out_x, out_y, out_z);
+		return;
+	}
+#endif
+	projectQuantizedScalar<Precision>(quantized, points, count, out_x, out_y, out_z);
+}
+
+template void projectVertices<DoublePrecision>(const ProjectionTransform&, const Point3*, size_t, double*, double*, double*);
+template void projectVertices<FloatPrecision>(const ProjectionTransform&, const Point3*, size_t, float*, float*, float*);
+template void projectVertices<FixedPrecision>(const ProjectionTransform&, const Point3*, size_t, I32*, I32*, float*);
+
+template void projectQuantized<DoublePrecision>(const ProjectionTransform&, Point3, Point3, const QuantizedPoint*, size_t, double*, double*, double*);
+template void projectQuantized<FloatPrecision>(const ProjectionTransform&, Point3, Point3, const QuantizedPoint*, size_t, float*, float*, float*);
+template void projectQuantized<FixedPrecision>(const ProjectionTransform&, Point3, Point3, const QuantizedPoint*, size_t, I32*, I32*, float*);
+
+const char* getProjectKernelName() {
+	switch (projectKernel()) {
+	case ProjectKernelLevel::AVX2:
+		return "avx2";
+	case ProjectKernelLevel::SSE2:
+		return "sse2";
+	default:
+		return "scalar";
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "../astd.hpp"
+#include "math.hpp"
+#include "precision.hpp"
+
+// Screen transform of a mesh, everything from its vertices to the pixel grid except the perspective divide
+// Rows 0 and 1 are the camera space X and Y already multiplied by the field of view (Y flipped), row 2 is the depth
+struct ProjectionTransform {
+	Transform3 transform;
+	double center_x = 0, center_y = 0;
+};
+
+// Checks if 2 projections map every point to the same place
+inline bool isSameProjection(const ProjectionTransform& a, const ProjectionTransform& b) {
+	for (U32 row = 0; row < 3; row++)
+		for (U32 col = 0; col < 4; col++)
+			if (a.transform.m[row][col] != b.transform.m[row][col])
+				return false;
+	return a.center_x == b.center_x && a.center_y == b.center_y;
+}
+
+// Transforms and projects count points into separate X, Y and depth arrays of the precision's types
+// out_x and out_y get the screen coordinates, out_z gets the unclamped camera space depth
+// Depths closer to 0 than 0.01 are divided as 0.01 to avoid huge screen coordinates
+// Everything is computed in double and only converted when stored, instantiated for the precisions of precision.hpp
+template <class Precision>
+void projectVertices(const ProjectionTransform& projection, const Point3* points, size_t count,
+	typename Precision::Screen* out_x, typename Precision::Screen* out_y, typename Precision::Depth* out_z);
+
+// Point of a compact mesh, each axis quantized to 16 bits across the mesh's bounds, see CompactMesh
+struct QuantizedPoint {
+	U16 x, y, z;
+};
+
+// Same as projectVertices for quantized points, which are at origin + point * step in the projection's source space
+// The dequantization is folded into the transform, so the points are only widened as they're read
+template <class Precision>
+void projectQuantized(const ProjectionTransform& projection, Point3 origin, Point3 step, const QuantizedPoint* points, size_t count,
+	typename Precision::Screen* out_x, typename Precision::Screen* out_y, typename Precision::Depth* out_z);
+
+// Name of the kernel projectVertices picked for this CPU ("avx2", "sse2" or "scalar")
+const char* getProjectKernelName();
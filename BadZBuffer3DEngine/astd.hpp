@@ -1,7 +1,9 @@
 #pragma once
 #include <iostream>
 #include <fcntl.h>
+#ifdef _WIN32
 #include <io.h>
+#endif
 #include <clocale>
 #include <vector>
 #include <string>
@@ -13,6 +15,12 @@
 #include <fstream>
 #include <cctype>
 #include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <memory>
 
 #include <SFML/System.hpp>
 #include <SFML/Graphics.hpp>
@@ -101,18 +109,25 @@ namespace astd {
 	}
 
 	// Get the time since 1970 in seconds as a floating point (double)
+	// The clock's tick length differs between platforms, so it's always converted through duration_cast
 	inline double getTime() {
-		return (double)std::chrono::system_clock::now().time_since_epoch().count() / 10000000;
+		return std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::system_clock::now().time_since_epoch()).count();
 	}
 
 	// Get the time as milliseconds as integer
 	inline U64 getMillis() {
-		return std::chrono::system_clock::now().time_since_epoch().count() / 10000;
+		return (U64)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
 	}
 
 	// Get the time as microseconds as integer
 	inline U64 getMicros() {
-		return std::chrono::system_clock::now().time_since_epoch().count() / 10;
+		return (U64)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	// Nanoseconds of a monotonic clock from an unspecified start, only meaningful as a difference of 2 calls
+	// Unlike getTime it never jumps with the system's clock, so it's the one to time things with
+	inline U64 getNanos() {
+		return (U64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 	}
 
 	// Sleeps the program in seconds
@@ -135,7 +150,7 @@ namespace astd {
 
 	// Writes a binary string to a file, returns if it went successful
 	inline bool writeToFile(const sf::String file_name, std::vector<U8> data) {
-		std::ofstream fout(file_name.toWideString(), std::ios::out | std::ios::binary);
+		std::ofstream fout(fs::path(file_name.toWideString()), std::ios::out | std::ios::binary);
 		if (fout.is_open()) {
 			fout.write((char*)(&data[0]), data.size());
 			fout.close();
@@ -146,16 +161,17 @@ namespace astd {
 
 	// Reads the binary content of a file and returns it, it'll return an empty vector if it didn't went well 
 	inline std::vector<U8> readFromFile(const sf::String file_name, bool* success = NULL) {
-		std::ifstream fin(file_name.toWideString(), std::ios::in | std::ios::binary);
+		std::ifstream fin(fs::path(file_name.toWideString()), std::ios::in | std::ios::binary);
 		std::vector<U8> content;
 		if (fin.is_open()) {
-			U32 it = 0;
-			while (1) {
-				char byte;
-				fin.read(&byte, 1);
-				if (fin.eof()) break;
-				content.push_back(byte);
-				it++;
+			// Read it in one go from its size
+			fin.seekg(0, std::ios::end);
+			std::streamoff size = fin.tellg();
+			fin.seekg(0, std::ios::beg);
+			if (size > 0) {
+				content.resize((size_t)size);
+				fin.read((char*)content.data(), size);
+				content.resize((size_t)fin.gcount());
 			}
 			if (success != NULL)
 				*success = true;
@@ -172,4 +188,112 @@ namespace astd {
 			vec.push_back(((U8*)data)[i]);
 		return vec;
 	}
+
+	// Pool of persistent worker threads, the thread calling parallelFor works alongside them
+	class ThreadPool {
+	public:
+		// thread_count includes the calling thread, so thread_count - 1 workers are spawned
+		ThreadPool(U32 thread_count) {
+			if (thread_count < 1)
+				thread_count = 1;
+			for (U32 t = 1; t < thread_count; t++)
+				this->workers.emplace_back([this] { this->work(); });
+		}
+
+		~ThreadPool() {
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				this->stopping = true;
+			}
+			this->wake.notify_all();
+			for (std::thread& worker : this->workers)
+				worker.join();
+		}
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		// Total threads taking part in a parallelFor, including the caller
+		U32 size() const {
+			return (U32)this->workers.size() + 1;
+		}
+
+		// Runs task(0) ... task(count - 1) across the pool and returns once all of them finished
+		// Takes the task by reference without copying it into a std::function, so dispatching never allocates
+		template <class Task>
+		void parallelFor(U64 count, const Task& task) {
+			this->run(count, [](const void* context, U64 i) { (*(const Task*)context)(i); }, &task);
+		}
+
+	private:
+		std::vector<std::thread> workers;
+		std::mutex mutex;
+		std::condition_variable wake, done;
+		void (*task)(const void*, U64) = NULL;
+		const void* task_context = NULL;
+		U64 task_count = 0;
+		U64 generation = 0;
+		std::atomic<U64> next{ 0 };
+		U32 active = 0;
+		bool stopping = false;
+
+		void run(U64 count, void (*task)(const void*, U64), const void* context) {
+			if (count == 0)
+				return;
+			if (this->workers.empty() || count == 1) {
+				for (U64 i = 0; i < count; i++)
+					task(context, i);
+				return;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				this->task = task;
+				this->task_context = context;
+				this->task_count = count;
+				this->next = 0;
+				this->active = (U32)this->workers.size();
+				this->generation++;
+			}
+			this->wake.notify_all();
+
+			this->runTasks(task, context, count);
+
+			// Wait for the workers to leave the job before the task goes out of scope
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->done.wait(lock, [this] { return this->active == 0; });
+			this->task = NULL;
+			this->task_context = NULL;
+		}
+
+		void runTasks(void (*task)(const void*, U64), const void* context, U64 count) {
+			for (U64 i = this->next++; i < count; i = this->next++)
+				task(context, i);
+		}
+
+		void work() {
+			U64 seen_generation = 0;
+			while (1) {
+				void (*task)(const void*, U64);
+				const void* context;
+				U64 count;
+				{
+					std::unique_lock<std::mutex> lock(this->mutex);
+					this->wake.wait(lock, [&] { return this->stopping || this->generation != seen_generation; });
+					if (this->stopping)
+						return;
+					seen_generation = this->generation;
+					task = this->task;
+					context = this->task_context;
+					count = this->task_count;
+				}
+
+				this->runTasks(task, context, count);
+
+				std::lock_guard<std::mutex> lock(this->mutex);
+				if (--this->active == 0)
+					this->done.notify_one();
+			}
+		}
+	};
 }
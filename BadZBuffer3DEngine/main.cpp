@@ -2,6 +2,7 @@
 #include "Renderer/math.hpp"
 #include "Renderer/renderer3d.hpp"
 #include "Renderer/construct.hpp"
+#include "Renderer/presenter.hpp"
 
 sf::String debug_text;
 
@@ -13,31 +14,49 @@ int entry(std::vector<sf::String> args) {
 	text.setFillColor(sf::Color(255, 0, 0, 255));
 	text.setCharacterSize(16);
 
-	sf::RenderWindow window(sf::VideoMode(800, 600), "Abstrac 3D test");
+	Render3DLayer aa = Render3DLayer(800, 600, 90, 50000, 0.1);
+	sf::RenderWindow window(sf::VideoMode(aa.width, aa.height), "Abstrac 3D test");
 	double prev = astd::getTime();
 
-	Render3DLayer aa = Render3DLayer(800, 600, 90, 50000, 0.1);
-	Mesh mesh;
-	mesh.solid_tris = loadFromObj("test.obj");
+	IndexedMesh mesh = loadIndexedFromObj("test.obj");
+	//Mesh mesh;
 	//mesh.solid_tris.push_back(SolidTri{ Point3{-1, 1, 5}, Point3{-1, -1, 5}, Point3{1, 0, 3}, 0xFF00FF00 });
 	//mesh.solid_tris.push_back(SolidTri{ Point3{-1, 0, 3}, Point3{1, 1, 5}, Point3{1, -1, 5}, 0xFFFF0000 });
-	aa.meshes.push_back(mesh);
+	std::wcout << "OBJ LOADED! " << mesh.tris.size() << " triangles, " << mesh.vertices.size() << " vertices, " << mesh.lods.size() << " levels of detail\n";
+	// Shared rather than copied into the layer, more instances of it wouldn't copy the triangles either
+	MeshInstance instance;
+	instance.geometry = shareGeometry(std::move(mesh));
+	aa.instances.push_back(instance);
 	aa.position = Point3{ 0, 0, -35000 };
-
-	std::wcout << "OBJ LOADED! " << mesh.solid_tris.size() << " triangles\n";
+	aa.reuse_unchanged_frames = true; // nothing moves unless a key is held
 
 	double speed = 5000;
 	double rot_speed = 33;
 
+	// Renders on a thread of its own, the first frame is started before the loop waits for it
+	FramePresenter<Render3DLayer> presenter(aa);
+	RenderStats stats;
+	sf::Vector2u new_size;
+	presenter.startFrame(0xFFFFFFFF, &stats);
+
 	while (window.isOpen()) {
 		double delta = astd::getTime() - prev;
 		prev = astd::getTime();
 		window.setTitle(sf::String("FPS: ") + (sf::String)std::to_string(1 / delta));
 
+		// The layer is being rendered, a new size waits until the frame is done
 		sf::Event event;
 		while (window.pollEvent(event)) {
 			if (event.type == sf::Event::Closed)
 				window.close();
+			if (event.type == sf::Event::Resized)
+				new_size = sf::Vector2u(event.size.width, event.size.height);
+		}
+
+		presenter.waitFrame();
+		if (new_size.x != 0 && new_size.y != 0 && (new_size.x != aa.width || new_size.y != aa.height)) {
+			aa.resize(new_size.x, new_size.y);
+			window.setView(sf::View(sf::FloatRect(0, 0, (float)new_size.x, (float)new_size.y)));
 		}
 
 		if (sf::Keyboard::isKeyPressed(sf::Keyboard::W))
@@ -62,20 +81,45 @@ int entry(std::vector<sf::String> args) {
 		if (sf::Keyboard::isKeyPressed(sf::Keyboard::Left))
 			aa.rotation.x -= rot_speed;
 
-		aa.clear(0xFFFFFFFF);
-		aa.render();
-
-		sf::Image buf;
-		buf.create(800, 600, (U8*)aa.render_buffer);
-		sf::Texture tex;
-		tex.loadFromImage(buf);
-		sf::Sprite sprite(tex);
-
+		if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num1))
+			aa.raster_mode = RasterMode::Scanline;
+		if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num2))
+			aa.raster_mode = RasterMode::EdgeFunction;
+
+		if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num3))
+			aa.occlusion_culling = true;
+		if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num4))
+			aa.occlusion_culling = false;
+
+		if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num5))
+			aa.visibility_buffer = true;
+		if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num6))
+			aa.visibility_buffer = false;
+
+		if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num7))
+			aa.depth_format = DepthFormat::Linear;
+		if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num8))
+			aa.depth_format = DepthFormat::ReversedFloat;
+		if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num9))
+			aa.depth_format = DepthFormat::Unorm24;
+		if (sf::Keyboard::isKeyPressed(sf::Keyboard::Num0))
+			aa.depth_format = DepthFormat::Unorm16;
+
+		// stats belong to the frame waitFrame() took until the next one starts
 		debug_text = "XYZ: " + std::to_string(aa.position.x) + ", " + std::to_string(aa.position.y) + ", " + std::to_string(aa.position.z) + '\n' +
-			"YPR: " + std::to_string(aa.rotation.x) + ", " + std::to_string(aa.rotation.y) + ", " + std::to_string(aa.rotation.z) + '\n';
+			"YPR: " + std::to_string(aa.rotation.x) + ", " + std::to_string(aa.rotation.y) + ", " + std::to_string(aa.rotation.z) + '\n' +
+			"Occluded: " + std::to_string(stats.tris_occlusion_culled) + " tris, " + std::to_string(stats.meshes_occlusion_culled) + " meshes\n" +
+			"Out of view: " + std::to_string(stats.tris_frustum_culled) + " tris, " + std::to_string(stats.meshes_frustum_culled) + " meshes\n" +
+			"Back faces: " + std::to_string(stats.tris_backface_culled) + ", clipped: " + std::to_string(stats.tris_clipped) + ", pixels written: " + std::to_string(stats.pixels_written) + '\n' +
+			"Rasterized: " + std::to_string(stats.tris_rasterized) + " of " + std::to_string(stats.tris_in) + " tris, overdraw " + std::to_string(stats.getOverdraw()) + '\n' +
+			"Transform " + std::to_string(stats.transform_ns / 1e6) + " ms, cull " + std::to_string(stats.cull_ns / 1e6) + " ms, setup " +
+			std::to_string(stats.setup_ns / 1e6) + " ms, raster " + std::to_string(stats.raster_ns / 1e6) + " ms, resolve " + std::to_string(stats.resolve_ns / 1e6) + " ms\n" +
+			"Projected: " + std::to_string(stats.meshes_projected) + " meshes, LOD removed " + std::to_string(stats.tris_lod_removed) + " tris" + (stats.raster_skipped ? ", frame reused\n" : stats.geometry_reused ? ", geometry reused\n" : "\n");
 		text.setString(debug_text);
-		
-		window.draw(sprite);
+
+		// The next frame renders while this one is uploaded and shown
+		presenter.startFrame(0xFFFFFFFF, &stats);
+		window.draw(presenter.getSprite());
 		window.draw(text);
 		window.display();
 	}
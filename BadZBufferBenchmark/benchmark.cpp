@@ -0,0 +1,694 @@
+// Headless benchmark, renders an OBJ along a camera path without a window and reports frame times as JSON
+//
+// benchmark <model.obj> [options]
+//   --frames N           Frames measured per resolution (default 200)
+//   --warmup N           Frames rendered before measuring (default 10)
+//   --resolution WxH     Resolution to measure, can be repeated (default 800x600)
+//   --threads N          Render3DLayer::thread_count (default 1)
+//   --tile N             Render3DLayer::tile_size (default 64)
+//   --raster NAME        scanline or edge (default scanline)
+//   --precision NAME     double, float or fixed, the layer instantiation to render with (default double)
+//   --depth NAME         linear, float, unorm24 or unorm16, Render3DLayer::depth_format (default linear)
+//   --path FILE          Camera keyframes, one "time x y z yaw pitch roll" per line, '#' starts a comment
+//                        Without it the camera circles the model at a distance fitting its bounds
+//   --fov DEGREES        Field of view (default 90)
+//   --lod-error PIXELS   Render3DLayer::lod_pixel_error, 0 always draws the full model (default 1)
+//   --views N            Renders N views per frame with renderViews(), turned 360 / N degrees of yaw apart like the faces of a
+//                        panorama, in parallel on the --threads threads with each view rasterized by one (default 1)
+//   --visibility         Render3DLayer::visibility_buffer, rasterizes triangle ids and colors the visible pixels afterwards
+//   --write DIR          Writes every measured frame into the directory as WxH_FRAME[_viewN].EXT, for offline renders
+//   --format NAME        ppm, png or raw, the format of the written frames (default ppm)
+//   --writers N          Threads writing the frames (default 2), the renderer only waits for them once 4 frames are queued
+//   --no-cache           Parse the OBJ without using or writing its binary cache
+//   --stream             Draws the model through a ClusterStream from MODEL.bzclusters, converted from the OBJ first if it's
+//                        missing or older, so every frame draws the clusters loaded by then and loading goes on during the path
+//   --budget MB          Memory the streamed clusters may take (default 512)
+//   --compact            Draws the model as a CompactMesh compressed from its triangles, without levels of detail or --stream
+//   --shading NAME       flat, gouraud, nearest or bilinear, the shading of the model (default flat), without --stream or --compact
+//                        Vertex colors follow the position within the bounds, texture coordinates map a checker across them
+//   --out FILE           Writes the JSON to the file instead of the standard output
+// Stage timings, pixel counts and overdraw need a build collecting render statistics, see RENDER_STATS
+#include "../BadZBuffer3DEngine/astd.hpp"
+#include "../BadZBuffer3DEngine/Renderer/math.hpp"
+#include "../BadZBuffer3DEngine/Renderer/renderer3d.hpp"
+#include "../BadZBuffer3DEngine/Renderer/construct.hpp"
+#include "../BadZBuffer3DEngine/Renderer/frame_writer.hpp"
+#include "../BadZBuffer3DEngine/Renderer/cluster_stream.hpp"
+#include <cstdio>
+#include <sstream>
+
+sf::String debug_text;
+
+struct Keyframe {
+	double time = 0;
+	Point3 position, rotation;
+};
+
+struct Resolution {
+	U32 width, height;
+};
+
+struct BenchmarkOptions {
+	sf::String model;
+	U32 frames = 200;
+	U32 warmup = 10;
+	std::vector<Resolution> resolutions;
+	U32 threads = 1;
+	U32 tile_size = 64;
+	RasterMode raster_mode = RasterMode::Scanline;
+	std::string precision = "double";
+	DepthFormat depth_format = DepthFormat::Linear;
+	std::string depth_name = "linear";
+	sf::String path_file;
+	double fov = 90;
+	double lod_pixel_error = 1;
+	bool use_cache = true;
+	bool stream = false;
+	bool compact = false;
+	Shading shading = Shading::Flat;
+	std::string shading_name = "flat";
+	size_t budget_mb = 512;
+	bool visibility_buffer = false;
+	U32 views = 1;
+	sf::String write_dir;
+	FrameFormat write_format = FrameFormat::PPM;
+	U32 writers = 2;
+	sf::String out_file;
+};
+
+// Frame times and summed stage statistics of one resolution
+struct ResolutionResult {
+	std::vector<double> frame_ms;
+	U64 tris_rendered = 0, pixels_written = 0;
+	RenderStats stage_totals; // Sums of the measured frames' stage timings and counters
+	U64 frames_written = 0, write_failures = 0;
+	double write_wait_ms = 0; // Time the renderer waited for the frame writers
+	double first_frame_ms = 0; // The very first frame, warmup included, drawn right after opening the stream when streaming
+	size_t peak_resident_bytes = 0, resident_clusters = 0; // Streamed clusters, the count after the last frame
+	U64 clusters_loaded = 0, clusters_evicted = 0;
+	bool failed = false; // The resolution couldn't be measured, the reason was printed
+};
+
+// Reads the keyframes of a path file sorted by time, returns false if it couldn't be read or has none
+static bool loadPath(sf::String file_name, std::vector<Keyframe>& keyframes) {
+	bool success = false;
+	std::vector<U8> file = astd::readFromFile(file_name, &success);
+	if (!success)
+		return false;
+
+	std::istringstream text(std::string(file.begin(), file.end()));
+	std::string line;
+	while (std::getline(text, line)) {
+		line = line.substr(0, line.find('#'));
+		std::istringstream fields(line);
+		Keyframe keyframe;
+		if (fields >> keyframe.time >> keyframe.position.x >> keyframe.position.y >> keyframe.position.z
+			>> keyframe.rotation.x >> keyframe.rotation.y >> keyframe.rotation.z)
+			keyframes.push_back(keyframe);
+	}
+	std::stable_sort(keyframes.begin(), keyframes.end(), [](const Keyframe& a, const Keyframe& b) { return a.time < b.time; });
+	return !keyframes.empty();
+}
+
+// A circle around the model looking at its center, far enough that the whole model fits in the view
+static std::vector<Keyframe> orbitPath(const Bounds3& bounds, double fov) {
+	std::vector<Keyframe> keyframes;
+	double distance = bounds.radius / std::sin(toRadian(fov / 2)) + bounds.radius * 0.1;
+	for (U32 step = 0; step <= 8; step++) {
+		double yaw = 360.0 * step / 8;
+		Keyframe keyframe;
+		keyframe.time = step;
+		// The renderer's yaw turns the view towards +X, so the camera sits behind the center along its view direction
+		keyframe.position = Point3{ bounds.center.x - distance * std::sin(toRadian(yaw)), bounds.center.y,
+			bounds.center.z - distance * std::cos(toRadian(yaw)) };
+		keyframe.rotation = Point3{ yaw, 0, 0 };
+		keyframes.push_back(keyframe);
+	}
+	return keyframes;
+}
+
+// Camera of a frame, interpolated linearly between the keyframes around it, frames spread evenly over the path
+static Keyframe sampleFrame(const std::vector<Keyframe>& keyframes, U32 frame, U32 frame_count) {
+	double start = keyframes.front().time, end = keyframes.back().time;
+	double time = frame_count > 1 ? start + (end - start) * frame / (frame_count - 1) : start;
+	size_t next = 1;
+	while (next < keyframes.size() && keyframes[next].time < time)
+		next++;
+	if (next >= keyframes.size())
+		return keyframes.back();
+
+	const Keyframe& a = keyframes[next - 1];
+	const Keyframe& b = keyframes[next];
+	Keyframe ret;
+	ret.time = time;
+	ret.position = Point3{ remap(time, a.time, b.time, a.position.x, b.position.x), remap(time, a.time, b.time, a.position.y, b.position.y),
+		remap(time, a.time, b.time, a.position.z, b.position.z) };
+	ret.rotation = Point3{ remap(time, a.time, b.time, a.rotation.x, b.rotation.x), remap(time, a.time, b.time, a.rotation.y, b.rotation.y),
+		remap(time, a.time, b.time, a.rotation.z, b.rotation.z) };
+	return ret;
+}
+
+// Quotes a string for JSON, Windows paths are full of backslashes
+static std::string jsonString(const std::string& str) {
+	std::string ret = "\"";
+	for (char chr : str) {
+		if (chr == '"' || chr == '\\')
+			ret += '\\';
+		if ((U8)chr < 0x20) {
+			char escaped[8];
+			std::snprintf(escaped, sizeof(escaped), "\\u%04x", (U32)(U8)chr);
+			ret += escaped;
+		}
+		else
+			ret += chr;
+	}
+	return ret + '"';
+}
+
+// Value below which the given fraction of the sorted samples lie, picking the nearest sample
+static double percentile(const std::vector<double>& sorted, double fraction) {
+	size_t index = (size_t)std::ceil(fraction * sorted.size());
+	return sorted[std::min(index == 0 ? 0 : index - 1, sorted.size() - 1)];
+}
+
+static bool parseOptions(const std::vector<sf::String>& args, BenchmarkOptions& options) {
+	for (size_t a = 1; a < args.size(); a++) {
+		std::string arg = args[a].toAnsiString();
+		bool has_value = a + 1 < args.size();
+		std::string value = has_value ? args[a + 1].toAnsiString() : "";
+
+		if (arg == "--no-cache")
+			options.use_cache = false;
+		else if (arg == "--visibility")
+			options.visibility_buffer = true;
+		else if (arg == "--stream")
+			options.stream = true;
+		else if (arg == "--compact")
+			options.compact = true;
+		else if (arg.rfind("--", 0) == 0 && !has_value) {
+			std::fprintf(stderr, "Missing the value of %s\n", arg.c_str());
+			return false;
+		}
+		else if (arg == "--frames")
+			options.frames = (U32)std::max<I64>(1, astd::strToInt(args[++a]));
+		else if (arg == "--warmup")
+			options.warmup = (U32)std::max<I64>(0, astd::strToInt(args[++a]));
+		else if (arg == "--budget")
+			options.budget_mb = (size_t)std::max<I64>(0, astd::strToInt(args[++a]));
+		else if (arg == "--views")
+			options.views = (U32)std::max<I64>(1, astd::strToInt(args[++a]));
+		else if (arg == "--writers")
+			options.writers = (U32)std::max<I64>(1, astd::strToInt(args[++a]));
+		else if (arg == "--write")
+			options.write_dir = args[++a];
+		else if (arg == "--format") {
+			a++;
+			if (value == "ppm")
+				options.write_format = FrameFormat::PPM;
+			else if (value == "png")
+				options.write_format = FrameFormat::PNG;
+			else if (value == "raw")
+				options.write_format = FrameFormat::Raw;
+			else {
+				std::fprintf(stderr, "Unknown frame format %s\n", value.c_str());
+				return false;
+			}
+		}
+		else if (arg == "--threads")
+			options.threads = (U32)std::max<I64>(1, astd::strToInt(args[++a]));
+		else if (arg == "--tile")
+			options.tile_size = (U32)std::max<I64>(1, astd::strToInt(args[++a]));
+		else if (arg == "--fov")
+			options.fov = astd::strToPoint(args[++a]);
+		else if (arg == "--lod-error")
+			options.lod_pixel_error = std::max(0.0, astd::strToPoint(args[++a]));
+		else if (arg == "--path")
+			options.path_file = args[++a];
+		else if (arg == "--out")
+			options.out_file = args[++a];
+		else if (arg == "--raster") {
+			a++;
+			if (value == "scanline")
+				options.raster_mode = RasterMode::Scanline;
+			else if (value == "edge")
+				options.raster_mode = RasterMode::EdgeFunction;
+			else {
+				std::fprintf(stderr, "Unknown rasterizer %s\n", value.c_str());
+				return false;
+			}
+		}
+		else if (arg == "--precision") {
+			a++;
+			if (value != "double" && value != "float" && value != "fixed") {
+				std::fprintf(stderr, "Unknown precision %s\n", value.c_str());
+				return false;
+			}
+			options.precision = value;
+		}
+		else if (arg == "--depth") {
+			a++;
+			if (value == "linear")
+				options.depth_format = DepthFormat::Linear;
+			else if (value == "float")
+				options.depth_format = DepthFormat::ReversedFloat;
+			else if (value == "unorm24")
+				options.depth_format = DepthFormat::Unorm24;
+			else if (value == "unorm16")
+				options.depth_format = DepthFormat::Unorm16;
+			else {
+				std::fprintf(stderr, "Unknown depth format %s\n", value.c_str());
+				return false;
+			}
+			options.depth_name = value;
+		}
+		else if (arg == "--shading") {
+			a++;
+			if (value == "flat")
+				options.shading = Shading::Flat;
+			else if (value == "gouraud")
+				options.shading = Shading::Gouraud;
+			else if (value == "nearest")
+				options.shading = Shading::TexturedNearest;
+			else if (value == "bilinear")
+				options.shading = Shading::TexturedBilinear;
+			else {
+				std::fprintf(stderr, "Unknown shading %s\n", value.c_str());
+				return false;
+			}
+			options.shading_name = value;
+		}
+		else if (arg == "--resolution") {
+			a++;
+			Resolution resolution;
+			if (std::sscanf(value.c_str(), "%ux%u", &resolution.width, &resolution.height) != 2 || resolution.width == 0 || resolution.height == 0) {
+				std::fprintf(stderr, "Bad resolution %s, expected WxH\n", value.c_str());
+				return false;
+			}
+			options.resolutions.push_back(resolution);
+		}
+		else if (options.model.isEmpty() && arg.rfind("--", 0) != 0)
+			options.model = args[a];
+		else {
+			std::fprintf(stderr, "Unknown argument %s\n", arg.c_str());
+			return false;
+		}
+	}
+
+	if (options.resolutions.empty())
+		options.resolutions.push_back(Resolution{ 800, 600 });
+	if (options.model.isEmpty()) {
+		std::fprintf(stderr, "Usage: benchmark <model.obj> [--frames N] [--warmup N] [--resolution WxH]... [--threads N] [--tile N]\n"
+			"                 [--raster scanline|edge] [--precision double|float|fixed] [--depth linear|float|unorm24|unorm16]\n"
+			"                 [--path FILE] [--fov DEGREES] [--lod-error PIXELS]\n"
+			"                 [--views N] [--visibility] [--write DIR] [--format ppm|png|raw] [--writers N] [--no-cache]\n"
+			"                 [--stream] [--budget MB] [--compact] [--shading flat|gouraud|nearest|bilinear] [--out FILE]\n");
+		return false;
+	}
+	return true;
+}
+
+// Cluster file the model is streamed from
+static fs::path getClusterPath(sf::String model) {
+	fs::path path(model.toWideString());
+	path += ".bzclusters";
+	return path;
+}
+
+// Gives the model what the shading needs: vertex colors from where the vertices are within the bounds,
+// or texture coordinates across the bounds' X and Y with a checker of 8 by 8 squares
+static void shadeModel(IndexedMesh& mesh, Shading shading) {
+	const Bounds3& bounds = mesh.getBounds();
+	Point3 size = Point3{ bounds.max.x - bounds.min.x, bounds.max.y - bounds.min.y, bounds.max.z - bounds.min.z };
+	auto fraction = [](double value, double min, double size) -> double { return size > 0 ? (value - min) / size : 0; };
+	mesh.shading = shading;
+	for (const Point3& vertex : mesh.vertices) {
+		double fx = fraction(vertex.x, bounds.min.x, size.x), fy = fraction(vertex.y, bounds.min.y, size.y), fz = fraction(vertex.z, bounds.min.z, size.z);
+		if (shading == Shading::Gouraud)
+			mesh.vertex_colors.push_back(0xFF000000 | (U32)(fx * 255) | ((U32)(fy * 255) << 8) | ((U32)(fz * 255) << 16));
+		else
+			mesh.vertex_uvs.push_back(Point2{ fx, fy });
+	}
+	if (shading != Shading::Gouraud) {
+		std::shared_ptr<Texture> texture = std::make_shared<Texture>();
+		texture->width = 256;
+		texture->height = 256;
+		texture->pixels.resize(256 * 256);
+		for (U32 y = 0; y < 256; y++)
+			for (U32 x = 0; x < 256; x++)
+				texture->pixels[y * 256 + x] = ((x / 32 + y / 32) & 1) != 0 ? 0xFFFFFFFF : 0xFF404040;
+		mesh.texture = texture;
+	}
+}
+
+// Renders the path at one resolution with the layer instantiation of the wanted precision
+// When streaming, mesh is empty and every resolution opens the cluster file anew, so each starts with nothing loaded
+// With --compact, compact is drawn instead of mesh
+template <class Layer>
+static ResolutionResult measureResolution(const BenchmarkOptions& options, const IndexedMesh& mesh, const CompactMesh& compact,
+	const std::vector<Keyframe>& keyframes, const Resolution& resolution) {
+	Layer layer(resolution.width, resolution.height, options.fov, 50000, 0.1);
+	layer.thread_count = options.threads;
+	layer.tile_size = options.tile_size;
+	layer.raster_mode = options.raster_mode;
+	layer.lod_pixel_error = options.lod_pixel_error;
+	layer.visibility_buffer = options.visibility_buffer;
+	layer.depth_format = options.depth_format;
+	U64 model_tris = mesh.tris.size();
+	double model_radius = 0;
+	std::shared_ptr<ClusterStream> stream;
+	if (options.stream) {
+		stream = std::make_shared<ClusterStream>(2, options.budget_mb << 20);
+		if (!stream->open(getClusterPath(options.model))) {
+			std::fprintf(stderr, "Couldn't open the clusters of %s\n", options.model.toAnsiString().c_str());
+			ResolutionResult result;
+			result.failed = true;
+			return result;
+		}
+		StreamedMesh streamed;
+		streamed.stream = stream;
+		layer.streamed_meshes.push_back(streamed);
+		model_tris = stream->getTriCount();
+		model_radius = stream->getBounds().radius;
+	}
+	else if (options.compact) {
+		layer.compact_meshes.push_back(compact);
+		model_radius = layer.compact_meshes.back().getBounds().radius;
+	}
+	else {
+		layer.indexed_meshes.push_back(mesh);
+		model_radius = layer.indexed_meshes.back().getBounds().radius;
+	}
+	// Back the far clipping off so the whole path sees the model
+	layer.far_clipping = std::max(layer.far_clipping, model_radius * 16);
+
+	// With several views the layer only holds the model, the views share its geometry and render on its threads
+	std::vector<Layer*> views;
+	if (options.views > 1) {
+		for (U32 v = 0; v < options.views; v++) {
+			Layer* view = new Layer(resolution.width, resolution.height, options.fov, layer.far_clipping, 0.1);
+			view->tile_size = options.tile_size;
+			view->raster_mode = options.raster_mode;
+			view->lod_pixel_error = options.lod_pixel_error;
+			view->visibility_buffer = options.visibility_buffer;
+			view->depth_format = options.depth_format;
+			views.push_back(view);
+		}
+	}
+	std::vector<RenderStats> view_stats(views.size());
+
+	// Finished frames are handed to the writer, the layers carry on in buffers from its pool
+	FrameWriter* writer = options.write_dir.isEmpty() ? NULL : new FrameWriter(options.writers);
+	auto writeFrame = [&](Layer& frame_layer, U32 frame, I64 view) {
+		std::string name = std::to_string(resolution.width) + "x" + std::to_string(resolution.height) + "_";
+		std::string number = std::to_string(frame);
+		name += std::string(number.size() < 5 ? 5 - number.size() : 0, '0') + number;
+		if (view >= 0)
+			name += "_view" + std::to_string(view);
+		name += std::string(".") + FrameWriter::getExtension(options.write_format);
+		U32* finished = frame_layer.swapRenderBuffer(writer->acquireBuffer(frame_layer.width, frame_layer.height));
+		writer->write(finished, frame_layer.width, frame_layer.height, fs::path(options.write_dir.toWideString()) / name, options.write_format);
+	};
+
+	auto drawFrame = [&](const Keyframe& camera, RenderStats& stats) {
+		layer.position = camera.position;
+		layer.rotation = camera.rotation;
+		if (views.empty()) {
+			layer.clear(0xFF000000);
+			layer.render(&stats);
+		}
+		else {
+			for (U32 v = 0; v < views.size(); v++) {
+				views[v]->position = camera.position;
+				views[v]->rotation = Point3{ camera.rotation.x + 360.0 * v / views.size(), camera.rotation.y, camera.rotation.z };
+				views[v]->clear(0xFF000000);
+			}
+			layer.renderViews(views.data(), views.size(), view_stats.data());
+		}
+	};
+
+	ResolutionResult result;
+	result.frame_ms.reserve(options.frames);
+	Keyframe camera;
+	for (U32 frame = 0; frame < options.warmup + options.frames; frame++) {
+		bool measured = frame >= options.warmup;
+		camera = sampleFrame(keyframes, measured ? frame - options.warmup : frame % options.frames, options.frames);
+
+		RenderStats stats;
+		auto frame_start = std::chrono::steady_clock::now();
+		drawFrame(camera, stats);
+		if (frame == 0)
+			result.first_frame_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count();
+		if (stream != NULL)
+			result.peak_resident_bytes = std::max(result.peak_resident_bytes, stream->getResidentBytes());
+		if (writer != NULL && measured) {
+			if (views.empty())
+				writeFrame(layer, frame - options.warmup, -1);
+			for (U32 v = 0; v < views.size(); v++)
+				writeFrame(*views[v], frame - options.warmup, v);
+		}
+		double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count();
+
+		if (!measured)
+			continue;
+		result.frame_ms.push_back(elapsed);
+		// Every view counts towards the totals
+		for (size_t v = 0; v < std::max<size_t>(views.size(), 1); v++) {
+			const RenderStats& frame_stats = views.empty() ? stats : view_stats[v];
+			// Only the statistics know which level of detail was drawn
+			result.tris_rendered += frame_stats.collected ? frame_stats.tris_in : model_tris;
+			result.pixels_written += frame_stats.pixels_written;
+			RenderStats& totals = result.stage_totals;
+			totals.collected = frame_stats.collected;
+			totals.transform_ns += frame_stats.transform_ns;
+			totals.cull_ns += frame_stats.cull_ns;
+			totals.setup_ns += frame_stats.setup_ns;
+			totals.raster_ns += frame_stats.raster_ns;
+			totals.resolve_ns += frame_stats.resolve_ns;
+			totals.tris_rasterized += frame_stats.tris_rasterized;
+			totals.pixels_written += frame_stats.pixels_written;
+			totals.pixels_covered += frame_stats.pixels_covered;
+		}
+	}
+
+	// The layers keep what a frame needs, so drawing the same frame again mustn't allocate anything
+	// Streaming is left out, the clusters it loads change the scene between frames
+	if (stream == NULL) {
+		auto countAllocations = [&]() {
+			U64 count = layer.getAllocationCount();
+			for (Layer* view : views)
+				count += view->getAllocationCount();
+			return count;
+		};
+		RenderStats stats;
+		drawFrame(camera, stats);
+		U64 allocations = countAllocations();
+		drawFrame(camera, stats);
+		U64 repeated = countAllocations() - allocations;
+		if (repeated != 0) {
+			std::fprintf(stderr, "The layers made %llu allocations drawing the same frame again\n", (unsigned long long)repeated);
+			result.failed = true;
+		}
+	}
+
+	for (Layer* view : views)
+		delete view;
+	if (stream != NULL) {
+		result.resident_clusters = stream->getResidentCount();
+		result.clusters_loaded = stream->getLoadCount();
+		result.clusters_evicted = stream->getEvictCount();
+	}
+	if (writer != NULL) {
+		writer->finish();
+		result.frames_written = writer->getWrittenCount();
+		result.write_failures = writer->getFailedCount();
+		result.write_wait_ms = writer->getWaitNanos() / 1e6;
+		delete writer;
+	}
+	return result;
+}
+
+int entry(std::vector<sf::String> args) {
+	BenchmarkOptions options;
+	if (!parseOptions(args, options))
+		return 1;
+
+	// Streaming converts the model once and then only reads the cluster table, the triangles load while rendering
+	auto load_start = std::chrono::steady_clock::now();
+	IndexedMesh mesh;
+	Bounds3 model_bounds;
+	U64 model_tris = 0;
+	size_t cluster_count = 0;
+	if (options.stream) {
+		fs::path cluster_path = getClusterPath(options.model);
+		U64 source_size = 0;
+		I64 source_time = 0;
+		std::error_code error;
+		bool current = getMeshSourceStamp(options.model, source_size, source_time) && fs::exists(cluster_path, error) &&
+			(I64)fs::last_write_time(cluster_path, error).time_since_epoch().count() >= source_time && !error;
+		if (!current && !buildClusterFileFromObj(options.model, cluster_path)) {
+			std::fprintf(stderr, "Couldn't convert %s into clusters\n", options.model.toAnsiString().c_str());
+			return 1;
+		}
+		ClusterStream stream(1);
+		if (!stream.open(cluster_path)) {
+			std::fprintf(stderr, "Couldn't open the clusters of %s\n", options.model.toAnsiString().c_str());
+			return 1;
+		}
+		model_bounds = stream.getBounds();
+		model_tris = stream.getTriCount();
+		cluster_count = stream.getClusterCount();
+	}
+	else {
+		mesh = loadIndexedFromObj(options.model, options.use_cache);
+		model_bounds = mesh.getBounds();
+		model_tris = mesh.tris.size();
+	}
+	if (options.shading != Shading::Flat && !options.stream && !options.compact)
+		shadeModel(mesh, options.shading);
+	// Bytes of the triangles as the layer holds them, levels of detail aside
+	size_t model_bytes = mesh.vertices.size() * sizeof(Point3) + mesh.tris.size() * sizeof(IndexedTri);
+	CompactMesh compact;
+	if (options.compact && !options.stream) {
+		Mesh soup;
+		soup.solid_tris.reserve(mesh.tris.size());
+		for (const IndexedTri& tri : mesh.tris)
+			soup.solid_tris.push_back(SolidTri{ mesh.vertices[tri.a], mesh.vertices[tri.b], mesh.vertices[tri.c], tri.color });
+		compact = compressMesh(soup);
+		model_bytes = compact.getMemorySize();
+	}
+	double load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load_start).count();
+	if (model_tris == 0) {
+		std::fprintf(stderr, "Couldn't load any triangle from %s\n", options.model.toAnsiString().c_str());
+		return 1;
+	}
+
+	std::vector<Keyframe> keyframes;
+	if (!options.path_file.isEmpty()) {
+		if (!loadPath(options.path_file, keyframes)) {
+			std::fprintf(stderr, "Couldn't read any keyframe from %s\n", options.path_file.toAnsiString().c_str());
+			return 1;
+		}
+	}
+	else
+		keyframes = orbitPath(model_bounds, options.fov);
+
+	if (!options.write_dir.isEmpty()) {
+		std::error_code error;
+		fs::create_directories(fs::path(options.write_dir.toWideString()), error);
+		if (error) {
+			std::fprintf(stderr, "Couldn't create the directory %s\n", options.write_dir.toAnsiString().c_str());
+			return 1;
+		}
+	}
+
+	std::ostringstream json;
+	json.precision(6);
+	json << std::fixed;
+	json << "{\n";
+	json << "  \"model\": " << jsonString(options.model.toAnsiString()) << ",\n";
+	json << "  \"triangles\": " << model_tris << ",\n";
+	json << "  \"vertices\": " << mesh.vertices.size() << ",\n";
+	json << "  \"lod_levels\": " << mesh.lods.size() << ",\n";
+	json << "  \"lod_pixel_error\": " << options.lod_pixel_error << ",\n";
+	json << "  \"load_ms\": " << load_ms << ",\n";
+	json << "  \"streamed\": " << (options.stream ? "true" : "false") << ",\n";
+	json << "  \"clusters\": " << cluster_count << ",\n";
+	json << "  \"memory_budget_mb\": " << options.budget_mb << ",\n";
+	json << "  \"compact\": " << (options.compact && !options.stream ? "true" : "false") << ",\n";
+	json << "  \"model_bytes\": " << model_bytes << ",\n";
+	json << "  \"shading\": \"" << (options.stream || options.compact ? "flat" : options.shading_name) << "\",\n";
+	json << "  \"quantization_error\": " << (options.compact && !options.stream ? compact.getErrorBound() : 0) << ",\n";
+	json << "  \"frames\": " << options.frames << ",\n";
+	json << "  \"threads\": " << options.threads << ",\n";
+	json << "  \"raster\": \"" << (options.raster_mode == RasterMode::EdgeFunction ? "edge" : "scanline") << "\",\n";
+	json << "  \"views\": " << options.views << ",\n";
+	json << "  \"write_format\": \"" << (options.write_dir.isEmpty() ? "none" : FrameWriter::getExtension(options.write_format)) << "\",\n";
+	json << "  \"visibility_buffer\": " << (options.visibility_buffer ? "true" : "false") << ",\n";
+	json << "  \"precision\": \"" << options.precision << "\",\n";
+	json << "  \"depth_format\": \"" << options.depth_name << "\",\n";
+	json << "  \"projection_kernel\": \"" << getProjectKernelName() << "\",\n";
+	json << "  \"results\": [";
+
+	for (size_t r = 0; r < options.resolutions.size(); r++) {
+		const Resolution& resolution = options.resolutions[r];
+		ResolutionResult result;
+		if (options.precision == "float")
+			result = measureResolution<Render3DLayerFloat>(options, mesh, compact, keyframes, resolution);
+		else if (options.precision == "fixed")
+			result = measureResolution<Render3DLayerFixed>(options, mesh, compact, keyframes, resolution);
+		else
+			result = measureResolution<Render3DLayer>(options, mesh, compact, keyframes, resolution);
+		if (result.failed)
+			return 1;
+		std::vector<double>& frame_ms = result.frame_ms;
+		const RenderStats& stage_totals = result.stage_totals;
+		U64 tris_rendered = result.tris_rendered, pixels_written = result.pixels_written;
+
+		double total_ms = 0;
+		for (double ms : frame_ms)
+			total_ms += ms;
+		std::sort(frame_ms.begin(), frame_ms.end());
+		double total_seconds = total_ms / 1000;
+
+		json << (r == 0 ? "\n" : ",\n");
+		json << "    {\n";
+		json << "      \"width\": " << resolution.width << ",\n";
+		json << "      \"height\": " << resolution.height << ",\n";
+		json << "      \"min_ms\": " << frame_ms.front() << ",\n";
+		json << "      \"median_ms\": " << percentile(frame_ms, 0.5) << ",\n";
+		json << "      \"p99_ms\": " << percentile(frame_ms, 0.99) << ",\n";
+		json << "      \"max_ms\": " << frame_ms.back() << ",\n";
+		json << "      \"mean_ms\": " << total_ms / frame_ms.size() << ",\n";
+		json << "      \"triangles_per_second\": " << (total_seconds > 0 ? tris_rendered / total_seconds : 0) << ",\n";
+		json << "      \"pixels_written_per_second\": " << (total_seconds > 0 ? pixels_written / total_seconds : 0) << ",\n";
+		json << "      \"screen_pixels_per_second\": " << (total_seconds > 0 ? (double)resolution.width * resolution.height * frame_ms.size() / total_seconds : 0) << ",\n";
+		// Stage timings and pixel counts only exist in builds collecting render statistics
+		json << "      \"stats_collected\": " << (stage_totals.collected ? "true" : "false") << ",\n";
+		json << "      \"mean_transform_ms\": " << stage_totals.transform_ns / 1e6 / frame_ms.size() << ",\n";
+		json << "      \"mean_cull_ms\": " << stage_totals.cull_ns / 1e6 / frame_ms.size() << ",\n";
+		json << "      \"mean_setup_ms\": " << stage_totals.setup_ns / 1e6 / frame_ms.size() << ",\n";
+		json << "      \"mean_raster_ms\": " << stage_totals.raster_ns / 1e6 / frame_ms.size() << ",\n";
+		json << "      \"mean_resolve_ms\": " << stage_totals.resolve_ns / 1e6 / frame_ms.size() << ",\n";
+		json << "      \"mean_tris_rasterized\": " << (double)stage_totals.tris_rasterized / frame_ms.size() << ",\n";
+		json << "      \"frames_written\": " << result.frames_written << ",\n";
+		json << "      \"write_failures\": " << result.write_failures << ",\n";
+		json << "      \"write_wait_ms\": " << result.write_wait_ms << ",\n";
+		json << "      \"first_frame_ms\": " << result.first_frame_ms << ",\n";
+		json << "      \"peak_resident_mb\": " << result.peak_resident_bytes / 1048576.0 << ",\n";
+		json << "      \"resident_clusters\": " << result.resident_clusters << ",\n";
+		json << "      \"clusters_loaded\": " << result.clusters_loaded << ",\n";
+		json << "      \"clusters_evicted\": " << result.clusters_evicted << ",\n";
+		json << "      \"overdraw\": " << stage_totals.getOverdraw() << "\n";
+		json << "    }";
+	}
+	json << "\n  ]\n}\n";
+
+	if (options.out_file.isEmpty()) {
+		std::fputs(json.str().c_str(), stdout);
+		return 0;
+	}
+	std::string text = json.str();
+	if (!astd::writeToFile(options.out_file, std::vector<U8>(text.begin(), text.end()))) {
+		std::fprintf(stderr, "Couldn't write %s\n", options.out_file.toAnsiString().c_str());
+		return 1;
+	}
+	return 0;
+}
+
+#ifdef _WIN32
+int wmain(const int argc, wchar_t* argv[]) {
+	std::vector<sf::String> args;
+	for (int arg = 0; arg < argc; arg++)
+		args.push_back(argv[arg]);
+	return entry(args);
+}
+#else
+int main(const int argc, char* argv[]) {
+	std::vector<sf::String> args;
+	for (int arg = 0; arg < argc; arg++) {
+		std::string str = argv[arg];
+		args.push_back(sf::String::fromUtf8(str.begin(), str.end()));
+	}
+	return entry(args);
+}
+#endif